@@ -0,0 +1,357 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "event_loop.h"
+#include "framing.h"
+#include "outbound_queue.h"
+#include "buffer_pool.h"
+#include "file_descriptor.h"
+#include "pipe_ret_t.h"
+
+/*
+ * A client connection of a BasicTcpServer. Owned by the server and only
+ * touched on the event loop thread serving it: none of its members are thread
+ * safe, send() included. To send from another thread, post a task to
+ * eventLoop()->runInLoop() that finds the connection in the handler's own
+ * bookkeeping, since it may be disconnected and freed meanwhile.
+ */
+template <typename FramingT>
+class BasicConnection {
+
+    template <typename Handler, typename F> friend class BasicTcpServer;
+
+private:
+    FileDescriptor _sockfd;
+    std::string _ip;
+    in_addr_t _address = INADDR_ANY; // network byte order
+    EventLoop * _eventLoop = nullptr;
+    std::shared_ptr<const FramingT> _framing;
+    BasicFrameReassembler<FramingT> _reassembler;
+    AdaptiveReadSize _readSize;
+    OutboundQueue _outboundQueue;
+    bool _isWaitingForWritable = false;
+    bool _isDispatching = false; // messages of a read are being handled, sends wait for the end of it
+    bool _isConnected = true;
+
+    void flush();
+
+public:
+    BasicConnection(int sockfd, const struct sockaddr_in & address, EventLoop * eventLoop,
+                    const std::shared_ptr<const FramingT> & framing);
+
+    const std::string & getIp() const { return _ip; }
+    in_addr_t getAddress() const { return _address; }
+    int sockfd() const { return _sockfd.get(); }
+    EventLoop * eventLoop() const { return _eventLoop; }
+    bool isConnected() const { return _isConnected; }
+    size_t numOfQueuedBytes() const { return _outboundQueue.size(); }
+
+    void send(const char * msg, size_t size); // on the loop thread only
+};
+
+/*
+ * TCP server whose message handler and framing are template parameters, so the
+ * receive -> reassemble -> handle path holds no std::function and no virtual
+ * call, and the compiler can inline all of it into the read loop. TcpServer is
+ * its type-erased counterpart: observers, handler threads, idle timeouts,
+ * backpressure events and the io_uring backend live there.
+ *
+ * Handler must provide, called on the loop thread serving the connection (but see close()):
+ *   void onAccepted(BasicConnection<FramingT> & connection);
+ *   void onMessage(BasicConnection<FramingT> & connection, const char * msg, size_t size);
+ *   void onDisconnected(BasicConnection<FramingT> & connection, const std::string & reason);
+ * msg is a view into the read buffer, only valid during the call.
+ *
+ * FramingT is a concrete (final) framing like LengthPrefixedFraming or
+ * protocol::MessageFraming. With the Framing base class it works with any
+ * framing, through virtual calls.
+ */
+template <typename Handler, typename FramingT = Framing>
+class BasicTcpServer {
+
+public:
+    using connection_t = BasicConnection<FramingT>;
+
+private:
+    // a loop and the connections it serves, only touched on the loop thread
+    struct io_loop_t {
+        EventLoop eventLoop;
+        std::vector<connection_t*> connections;
+    };
+
+    Handler _handler;
+    std::shared_ptr<const FramingT> _framing;
+    FileDescriptor _sockfd;
+    std::vector<io_loop_t*> _ioLoops;
+    std::atomic<size_t> _nextIoLoop;
+
+    void acceptPendingClients();
+    void startServing(io_loop_t * ioLoop, int sockfd, const struct sockaddr_in & address);
+    void handleEvents(io_loop_t * ioLoop, connection_t * connection, uint32_t events);
+    void handleReadable(io_loop_t * ioLoop, connection_t * connection);
+    void disconnect(io_loop_t * ioLoop, connection_t * connection, const std::string & reason);
+    void release(io_loop_t * ioLoop, connection_t * connection);
+    void closeConnections(io_loop_t * ioLoop);
+
+public:
+    explicit BasicTcpServer(const Handler & handler = Handler(), const std::shared_ptr<const FramingT> & framing = nullptr) :
+        _handler{handler}, _framing{framing} {
+        _sockfd.set(-1);
+        _nextIoLoop = 0;
+    }
+    ~BasicTcpServer() { close(); }
+    BasicTcpServer(const BasicTcpServer &) = delete;
+    BasicTcpServer & operator=(const BasicTcpServer &) = delete;
+
+    Handler & handler() { return _handler; }
+
+    pipe_ret_t start(int port, size_t numOfIoThreads = 0, int maxNumOfClients = 128);
+    void close();
+};
+
+template <typename FramingT>
+BasicConnection<FramingT>::BasicConnection(int sockfd, const struct sockaddr_in & address, EventLoop * eventLoop,
+                                           const std::shared_ptr<const FramingT> & framing) :
+    _address{address.sin_addr.s_addr}, _eventLoop{eventLoop}, _framing{framing}, _reassembler{framing} {
+    _sockfd.set(sockfd);
+    char ip[INET_ADDRSTRLEN];
+    if (inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip)) != nullptr) {
+        _ip = ip;
+    }
+}
+
+/*
+ * Frame msg and queue it. Sends made while the messages of a read are handled
+ * go out together once the read is done (pipelined responses), others right away.
+ * Must be called on the connection's loop thread (from the handler, or in a
+ * task given to eventLoop()->runInLoop()).
+ */
+template <typename FramingT>
+void BasicConnection<FramingT>::send(const char * msg, size_t size) {
+    if (!_isConnected) {
+        return;
+    }
+    if (_framing) {
+        const std::string header = _framing->header(size);
+        _outboundQueue.append(header.data(), header.size());
+    }
+    _outboundQueue.append(msg, size);
+    if (_framing) {
+        const std::string trailer = _framing->trailer();
+        _outboundQueue.append(trailer.data(), trailer.size());
+    }
+    if (!_isDispatching) {
+        flush();
+    }
+}
+
+/*
+ * Send what the socket takes, and wait for EPOLLOUT for the rest. Queued bytes
+ * are dropped on failure; the read side reports the broken connection.
+ */
+template <typename FramingT>
+void BasicConnection<FramingT>::flush() {
+    if (_outboundQueue.flush(_sockfd.get()) != 0) {
+        _outboundQueue.clear();
+    }
+    const bool waitForWritable = !_outboundQueue.empty();
+    if (waitForWritable != _isWaitingForWritable) {
+        _isWaitingForWritable = waitForWritable;
+        uint32_t events = EPOLLIN | EPOLLRDHUP;
+        if (waitForWritable) {
+            events |= EPOLLOUT;
+        }
+        _eventLoop->modify(_sockfd.get(), events);
+    }
+}
+
+/*
+ * Listen on port and serve clients from numOfIoThreads event loops (one per
+ * hardware thread when 0). The first loop also accepts clients.
+ */
+template <typename Handler, typename FramingT>
+pipe_ret_t BasicTcpServer<Handler, FramingT>::start(int port, size_t numOfIoThreads, int maxNumOfClients) {
+    _sockfd.set(socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+    if (_sockfd.get() == -1) {
+        return pipe_ret_t::failure(strerror(errno));
+    }
+    const int option = 1;
+    setsockopt(_sockfd.get(), SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+
+    struct sockaddr_in serverAddress;
+    memset(&serverAddress, 0, sizeof(serverAddress));
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+    serverAddress.sin_port = htons(port);
+    if (bind(_sockfd.get(), (struct sockaddr *)&serverAddress, sizeof(serverAddress)) == -1 ||
+        listen(_sockfd.get(), maxNumOfClients) == -1) {
+        const std::string error = strerror(errno);
+        ::close(_sockfd.get());
+        _sockfd.set(-1);
+        return pipe_ret_t::failure(error);
+    }
+
+    if (numOfIoThreads == 0) {
+        numOfIoThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < numOfIoThreads; i++) {
+        io_loop_t * ioLoop = new io_loop_t();
+        ioLoop->eventLoop.start();
+        _ioLoops.push_back(ioLoop);
+    }
+    _ioLoops.front()->eventLoop.add(_sockfd.get(), EPOLLIN, [this](uint32_t) { acceptPendingClients(); });
+    return pipe_ret_t::success();
+}
+
+/*
+ * Accept every pending client, and hand each to the next loop round robin.
+ * Called on the first loop thread.
+ */
+template <typename Handler, typename FramingT>
+void BasicTcpServer<Handler, FramingT>::acceptPendingClients() {
+    while (true) {
+        struct sockaddr_in clientAddress;
+        socklen_t addressSize = sizeof(clientAddress);
+        const int sockfd = accept4(_sockfd.get(), (struct sockaddr*)&clientAddress, &addressSize, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sockfd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return; // EAGAIN: drained. Other errors (e.g. EMFILE) are retried on the next wakeup
+        }
+        io_loop_t * ioLoop = _ioLoops[_nextIoLoop++ % _ioLoops.size()];
+        ioLoop->eventLoop.runInLoop([this, ioLoop, sockfd, clientAddress]() {
+            startServing(ioLoop, sockfd, clientAddress);
+        });
+    }
+}
+
+/*
+ * Called on the loop thread of ioLoop. A client the loop fails to watch is
+ * dropped before the handler hears of it.
+ */
+template <typename Handler, typename FramingT>
+void BasicTcpServer<Handler, FramingT>::startServing(io_loop_t * ioLoop, int sockfd, const struct sockaddr_in & address) {
+    connection_t * connection = new connection_t(sockfd, address, &ioLoop->eventLoop, _framing);
+    ioLoop->connections.push_back(connection);
+    ioLoop->eventLoop.add(sockfd, EPOLLIN | EPOLLRDHUP, [this, ioLoop, connection](uint32_t events) {
+        handleEvents(ioLoop, connection, events);
+    }, [connection](const pipe_ret_t &) {
+        connection->_isConnected = false; // add() runs right away here, on the loop thread
+    });
+    if (!connection->_isConnected) {
+        ::close(sockfd);
+        release(ioLoop, connection);
+        return;
+    }
+    _handler.onAccepted(*connection);
+}
+
+template <typename Handler, typename FramingT>
+void BasicTcpServer<Handler, FramingT>::handleEvents(io_loop_t * ioLoop, connection_t * connection, uint32_t events) {
+    if (events & EPOLLOUT) {
+        connection->flush();
+    }
+    if (events & ~EPOLLOUT) {
+        handleReadable(ioLoop, connection);
+    }
+}
+
+/*
+ * Read into a pooled buffer and hand every complete message to the handler,
+ * straight from it. Responses sent meanwhile leave in one flush after the read.
+ */
+template <typename Handler, typename FramingT>
+void BasicTcpServer<Handler, FramingT>::handleReadable(io_loop_t * ioLoop, connection_t * connection) {
+    const PooledBuffer buffer = ioLoop->eventLoop.bufferPool().acquire(connection->_readSize.size());
+    const ssize_t numOfBytesReceived = recv(connection->_sockfd.get(), buffer.data(), buffer.capacity(), 0);
+
+    if (numOfBytesReceived == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            disconnect(ioLoop, connection, strerror(errno));
+        }
+        return;
+    }
+    if (numOfBytesReceived == 0) {
+        disconnect(ioLoop, connection, "Client closed connection");
+        return;
+    }
+    connection->_readSize.update(numOfBytesReceived);
+
+    connection->_isDispatching = true;
+    const bool isValidStream = connection->_reassembler.feed(buffer.data(), numOfBytesReceived,
+                                                             [this, connection](const char * msg, size_t size) {
+        _handler.onMessage(*connection, msg, size);
+    });
+    connection->_isDispatching = false;
+    if (!isValidStream) {
+        disconnect(ioLoop, connection, "Invalid frame");
+        return;
+    }
+    connection->flush();
+}
+
+/*
+ * Stop serving a connection, tell the handler and free it. Called on the loop thread.
+ */
+template <typename Handler, typename FramingT>
+void BasicTcpServer<Handler, FramingT>::disconnect(io_loop_t * ioLoop, connection_t * connection, const std::string & reason) {
+    ioLoop->eventLoop.remove(connection->_sockfd.get());
+    connection->_isConnected = false;
+    ::close(connection->_sockfd.get());
+    _handler.onDisconnected(*connection, reason);
+    release(ioLoop, connection);
+}
+
+/*
+ * Forget a closed connection and free it once the loop is done with the current
+ * handler; on a stopped loop that is right away, so nothing may use it after this.
+ * Called on the loop thread.
+ */
+template <typename Handler, typename FramingT>
+void BasicTcpServer<Handler, FramingT>::release(io_loop_t * ioLoop, connection_t * connection) {
+    std::vector<connection_t*> & connections = ioLoop->connections;
+    connections.erase(std::find(connections.begin(), connections.end(), connection));
+    ioLoop->eventLoop.queueInLoop([connection]() { delete connection; });
+}
+
+template <typename Handler, typename FramingT>
+void BasicTcpServer<Handler, FramingT>::closeConnections(io_loop_t * ioLoop) {
+    while (!ioLoop->connections.empty()) {
+        disconnect(ioLoop, ioLoop->connections.back(), "Server closed");
+    }
+}
+
+/*
+ * Stop accepting, stop the loops and disconnect every client. The handler is told
+ * about these disconnections on the calling thread.
+ */
+template <typename Handler, typename FramingT>
+void BasicTcpServer<Handler, FramingT>::close() {
+    if (_ioLoops.empty()) {
+        return;
+    }
+    _ioLoops.front()->eventLoop.remove(_sockfd.get());
+    ::close(_sockfd.get());
+    _sockfd.set(-1);
+    for (io_loop_t * ioLoop : _ioLoops) {
+        ioLoop->eventLoop.stop(); // runs clients handed to it meanwhile, and pending deletes
+        closeConnections(ioLoop);
+        delete ioLoop;
+    }
+    _ioLoops.clear();
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+class BufferPool;
+
+/*
+ * Buffer taken from a BufferPool, handed back to it when destroyed. Move only.
+ */
+class PooledBuffer {
+
+private:
+    BufferPool * _pool = nullptr;
+    char * _data = nullptr;
+    size_t _sizeClass = 0;
+
+    friend class BufferPool;
+    PooledBuffer(BufferPool * pool, char * data, size_t sizeClass) : _pool{pool}, _data{data}, _sizeClass{sizeClass} {}
+
+public:
+    PooledBuffer() = default;
+    PooledBuffer(PooledBuffer && other);
+    PooledBuffer & operator=(PooledBuffer && other);
+    PooledBuffer(const PooledBuffer &) = delete;
+    PooledBuffer & operator=(const PooledBuffer &) = delete;
+    ~PooledBuffer() { release(); }
+
+    char * data() const { return _data; }
+    size_t capacity() const;
+    void release();
+};
+
+/*
+ * Receive buffers in a few size classes (4, 16, 64 and 256 KiB), shared by
+ * every connection of a thread. A connection takes one only for the duration
+ * of a read, so idle connections hold none, and the buffers are reused
+ * instead of allocated per read. At most MAX_FREE_BUFFERS_PER_CLASS free
+ * buffers are kept per class, the rest are freed. Thread safe.
+ */
+class BufferPool {
+
+private:
+    std::mutex _freeBuffersMtx;
+    std::vector<std::vector<char*>> _freeBuffers; // per size class
+
+    friend class PooledBuffer;
+    void giveBack(char * data, size_t sizeClass);
+
+public:
+    static const size_t NUM_OF_SIZE_CLASSES = 4;
+    static const size_t MIN_BUFFER_SIZE = 4 * 1024;
+    static const size_t MAX_BUFFER_SIZE = MIN_BUFFER_SIZE << (2 * (NUM_OF_SIZE_CLASSES - 1));
+    static const size_t MAX_FREE_BUFFERS_PER_CLASS = 64;
+
+    BufferPool();
+    ~BufferPool();
+    BufferPool(const BufferPool &) = delete;
+    BufferPool & operator=(const BufferPool &) = delete;
+
+    static BufferPool & shared();
+    static size_t sizeOfClass(size_t sizeClass) { return MIN_BUFFER_SIZE << (2 * sizeClass); }
+    static size_t sizeClassFor(size_t size);
+
+    PooledBuffer acquire(size_t size);
+};
+
+/*
+ * How much one connection reads at a time. Starts at the smallest pool class,
+ * grows a class whenever a read fills the buffer (bulk transfer, fewer
+ * syscalls), and shrinks a class after SHRINK_AFTER_SMALL_READS reads in a row
+ * that used less than a quarter of it.
+ */
+class AdaptiveReadSize {
+
+private:
+    size_t _sizeClass = 0;
+    size_t _numOfSmallReads = 0;
+
+public:
+    static const size_t SHRINK_AFTER_SMALL_READS = 4;
+
+    size_t size() const { return BufferPool::sizeOfClass(_sizeClass); }
+    void update(size_t numOfBytesRead);
+};
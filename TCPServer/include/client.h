@@ -6,12 +6,21 @@
 #include <mutex>
 #include <atomic>
 #include <fstream>
+#include <netinet/in.h>
 #include "pipe_ret_t.h"
 #include "client_event.h"
 #include "file_descriptor.h"
+#include "event_loop.h"
+#include "outbound_queue.h"
+#include "framing.h"
 #include <iostream>
 #include <fstream>
 
+class IoUringLoop;
+
+// identifies a connection of a server for as long as the server runs, never reused. 0 is no connection
+typedef uint64_t connection_handle_t;
+
 struct Node{
     int data;
     struct Node* next;
@@ -19,19 +28,70 @@ struct Node{
 
 class Client {
 
-    using client_event_handler_t = std::function<void(const Client&, ClientEvent, const std::string&)>;
+    // data is only valid during the call, handlers keeping it must copy it
+    using client_event_handler_t = std::function<void(const Client&, ClientEvent, const char * data, size_t size)>;
 
 private:
     std::string _ip = "";
+    connection_handle_t _handle = 0;
+    in_addr_t _address = INADDR_ANY; // network byte order
     std::atomic<bool> _isConnected;
-    std::thread * _receiveThread = nullptr;
+    std::atomic<bool> _isListening;
+    EventLoop * _eventLoop = nullptr;
+    IoUringLoop * _ioUringLoop = nullptr;
+    EventLoop * _timerLoop = nullptr; // runs the idle timer when the client has no event loop (io_uring)
+    uint64_t _idleTimeoutMs = 0;
+    std::atomic<EventLoop::timer_id_t> _idleTimerId;
+    std::atomic<uint64_t> _lastActivityMs;
+    std::atomic<bool> _isIdleTimedOut;
+    mutable std::atomic<int> _sendError; // errno of the flush that lost queued bytes, 0 if none
     client_event_handler_t _eventHandlerCallback;
 
+    // bytes the socket did not take yet, flushed by the event loop once it is writable
+    mutable std::mutex _outboundMtx;
+    mutable OutboundQueue _outboundQueue;
+    mutable bool _isWaitingForWritable = false;
+    mutable bool _isFlushScheduled = false;
+    mutable bool _isBurstOpen = false; // the last send said more follows, hold the queue back
+    bool _coalesceSends = false;
+    std::shared_ptr<const Framing> _framing;
+    FrameReassembler _reassembler; // only used by the thread receiving for the client
+    AdaptiveReadSize _readSize; // only used by the event loop
+    size_t _zeroCopyThreshold = 0;
+
     void setConnected(bool flag) { _isConnected = flag; }
 
-    void receiveTask();
+    void handleEvents(uint32_t events);
+
+    void handleReadable();
+
+    void handleWritable();
+
+    void waitForWritable(bool enable) const;
+
+    bool canSendNow(bool hasMore) const;
+
+    size_t sendDirectly(const char * msg, size_t msgSize) const;
+
+    void handleQueued(bool hasMore, bool triedSendNow) const;
+
+    void flushOutbound() const;
 
-    void terminateReceiveThread();
+    void scheduleFlush() const;
+
+    void handleReceived(const char * data, ssize_t numOfBytesReceived);
+
+    void disconnect(const std::string & reason);
+
+    void stopListen();
+
+    EventLoop * idleTimerLoop() const { return _eventLoop ? _eventLoop : _timerLoop; }
+
+    void startIdleTimer();
+
+    void checkIdle();
+
+    void stopIdleTimer();
 
 public:
     Client(int);
@@ -39,16 +99,39 @@ public:
     bool operator ==(const Client & other) const ;
 
     void setIp(const std::string & ip) { _ip = ip; }
-    std::string getIp() const { return _ip; }
+    const std::string & getIp() const { return _ip; }
+    void setAddress(in_addr_t address) { _address = address; }
+    in_addr_t getAddress() const { return _address; }
+    void setHandle(connection_handle_t handle) { _handle = handle; }
+    connection_handle_t getHandle() const { return _handle; }
 
     void setEventsHandler(const client_event_handler_t & eventHandler) { _eventHandlerCallback = eventHandler; }
-    void publishEvent(ClientEvent clientEvent, const std::string &msg = "");
+    void setEventLoop(EventLoop * eventLoop) { _eventLoop = eventLoop; }
+    EventLoop * eventLoop() const { return _eventLoop; }
+    void setIoUringLoop(IoUringLoop * ioUringLoop) { _ioUringLoop = ioUringLoop; }
+    void setTimerLoop(EventLoop * timerLoop) { _timerLoop = timerLoop; }
+    void setIdleTimeout(uint64_t idleTimeoutMs) { _idleTimeoutMs = idleTimeoutMs; }
+    void setOutboundWatermarks(size_t highWatermark, size_t lowWatermark);
+    void setCoalesceSends(bool coalesceSends) { _coalesceSends = coalesceSends; }
+    void setFraming(const std::shared_ptr<const Framing> & framing) { _framing = framing; _reassembler.setFraming(framing); }
+    const std::shared_ptr<const Framing> & framing() const { return _framing; }
+    void setZeroCopyThreshold(size_t zeroCopyThreshold) { _zeroCopyThreshold = zeroCopyThreshold; }
+    void publishEvent(ClientEvent clientEvent, const char * data = nullptr, size_t size = 0) const;
+    void publishEvent(ClientEvent clientEvent, const std::string & msg) const { publishEvent(clientEvent, msg.data(), msg.size()); }
 
     bool isConnected() const { return _isConnected; }
+    bool isSendPaused() const;
+    size_t numOfQueuedBytes() const;
 
     void startListen();
 
-    void send(const char * msg, size_t msgSize) const;
+    void send(const char * msg, size_t msgSize, bool hasMore = false) const;
+
+    void send(const shared_payload_t & payload, bool hasMore = false) const;
+
+    void sendMessage(const char * msg, size_t msgSize, bool hasMore = false) const;
+
+    void sendFile(const shared_file_t & file, size_t offset, size_t size) const;
 
     void close();
 
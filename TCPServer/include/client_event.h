@@ -2,5 +2,7 @@
 
 enum ClientEvent {
     DISCONNECTED,
-    INCOMING_MSG
+    INCOMING_MSG,
+    SEND_PAUSED, // outbound queue above the high watermark
+    SEND_RESUMED // outbound queue drained to the low watermark
 };
\ No newline at end of file
@@ -2,16 +2,16 @@
 
 #include <cstdio>
 
-#define MAX_PACKET_SIZE 4096
-
 namespace fd_wait {
     enum Result {
         FAILURE,
         TIMEOUT,
-        SUCCESS
+        SUCCESS,
+        WAKEUP
     };
 
     Result waitFor(const FileDescriptor &fileDescriptor, uint32_t timeoutSeconds = 1);
+    Result waitFor(const FileDescriptor &fileDescriptor, const FileDescriptor &wakeupFileDescriptor, int timeoutMs = -1);
 };
 
 
@@ -0,0 +1,220 @@
+#pragma once
+
+/*
+ * Opt-in C++20 coroutine API, built with -DCORO_API=ON. Request flows are
+ * written as straight line code and suspend on the EventLoop that runs them
+ * instead of blocking a thread:
+ *
+ *     coro::Task<> serve(coro::Connection conn) {
+ *         std::string request = co_await conn.read();
+ *         co_await coro::sleep_for(100);
+ *         co_await conn.write(request);
+ *     }
+ *
+ * Connections, servers and sleeps belong to the loop they were created on, and
+ * must only be awaited from coroutines running on that loop (see coro::spawn).
+ * The observer based TcpServer / TcpClient API is independent of this layer.
+ */
+
+#if __cplusplus < 202002L
+#error "coro.h needs C++20, configure with -DCORO_API=ON"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <string>
+#include <utility>
+#include <cstdint>
+#include "event_loop.h"
+#include "pipe_ret_t.h"
+
+namespace coro {
+
+template<typename T>
+class Task;
+
+namespace detail {
+
+    /*
+     * Resumes whoever awaited the task once it finished (symmetric transfer,
+     * so long chains of awaits do not grow the stack)
+     */
+    struct final_awaiter_t {
+        bool await_ready() const noexcept { return false; }
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            std::coroutine_handle<> continuation = handle.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() const noexcept {}
+    };
+
+    struct promise_base_t {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr exception;
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        final_awaiter_t final_suspend() const noexcept { return {}; }
+        void unhandled_exception() { exception = std::current_exception(); }
+        void rethrowIfFailed() const {
+            if (exception) {
+                std::rethrow_exception(exception);
+            }
+        }
+    };
+
+    template<typename T>
+    struct promise_t : promise_base_t {
+        T value;
+
+        Task<T> get_return_object();
+        void return_value(T result) { value = std::move(result); }
+        T takeResult() {
+            rethrowIfFailed();
+            return std::move(value);
+        }
+    };
+
+    template<>
+    struct promise_t<void> : promise_base_t {
+        Task<void> get_return_object();
+        void return_void() {}
+        void takeResult() { rethrowIfFailed(); }
+    };
+}
+
+/*
+ * Lazily started coroutine producing a T. It runs when awaited, and resumes
+ * the awaiting coroutine when done; exceptions propagate to the awaiter.
+ */
+template<typename T = void>
+class Task {
+
+public:
+    using promise_type = detail::promise_t<T>;
+
+private:
+    std::coroutine_handle<promise_type> _handle;
+
+public:
+    explicit Task(std::coroutine_handle<promise_type> handle) : _handle{handle} {}
+    Task(Task && other) noexcept : _handle{std::exchange(other._handle, nullptr)} {}
+    Task & operator=(Task && other) noexcept {
+        if (this != &other) {
+            if (_handle) {
+                _handle.destroy();
+            }
+            _handle = std::exchange(other._handle, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task &) = delete;
+    Task & operator=(const Task &) = delete;
+    ~Task() {
+        if (_handle) {
+            _handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return !_handle || _handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        _handle.promise().continuation = awaiting;
+        return _handle;
+    }
+    T await_resume() { return _handle.promise().takeResult(); }
+};
+
+namespace detail {
+    template<typename T>
+    Task<T> promise_t<T>::get_return_object() {
+        return Task<T>(std::coroutine_handle<promise_t<T>>::from_promise(*this));
+    }
+
+    inline Task<void> promise_t<void>::get_return_object() {
+        return Task<void>(std::coroutine_handle<promise_t<void>>::from_promise(*this));
+    }
+}
+
+/*
+ * Run task to completion on loop without awaiting it. The task frame frees
+ * itself when done; an exception escaping it is reported on stderr.
+ */
+void spawn(EventLoop & loop, Task<void> task);
+
+/*
+ * Suspend the calling coroutine for delayMs, on the timer wheel of the loop running it
+ */
+class sleep_for {
+private:
+    uint64_t _delayMs;
+
+public:
+    explicit sleep_for(uint64_t delayMs) : _delayMs{delayMs} {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> awaiting) const;
+    void await_resume() const noexcept {}
+};
+
+/*
+ * Non blocking socket served by an EventLoop. read() and write() complete
+ * immediately when the socket allows it, and otherwise suspend until epoll
+ * reports readiness. At most one read and one write may be pending at a time.
+ */
+class Connection {
+
+private:
+    struct state_t;
+    std::shared_ptr<state_t> _state;
+
+    class readiness_awaiter_t;
+    readiness_awaiter_t readable();
+    readiness_awaiter_t writable();
+
+    friend class Server;
+    friend Task<Connection> connect(std::string host, int port);
+
+public:
+    Connection() = default;
+    Connection(EventLoop & loop, int sockfd);
+    Connection(Connection &&) noexcept = default;
+    Connection & operator=(Connection && other) noexcept;
+    Connection(const Connection &) = delete;
+    Connection & operator=(const Connection &) = delete;
+    ~Connection();
+
+    // returns an empty string once the peer closed the connection. throws on failure
+    Task<std::string> read(size_t maxSize = 4096);
+    // completes when every byte was handed to the kernel. throws on failure
+    Task<void> write(const char * data, size_t size);
+    Task<void> write(std::string data);
+    void close();
+
+    bool isOpen() const { return static_cast<bool>(_state); }
+    int fd() const;
+    std::string ip() const;
+};
+
+/*
+ * Listening socket whose clients are taken with co_await server.accept()
+ */
+class Server {
+
+private:
+    EventLoop & _loop;
+    Connection _listener;
+
+public:
+    explicit Server(EventLoop & loop) : _loop(loop) {}
+    pipe_ret_t listen(int port, int maxNumOfClients = 128);
+    Task<Connection> accept();
+    void close() { _listener.close(); }
+};
+
+/*
+ * Connect to host:port without blocking the loop
+ */
+Task<Connection> connect(std::string host, int port);
+
+}
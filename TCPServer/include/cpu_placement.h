@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+/*
+ * Thread pinning and NUMA topology helpers, read from sysfs so no NUMA library is needed
+ */
+namespace cpu_placement {
+    bool pinThread(pthread_t thread, const std::vector<int> & cpus);
+    std::vector<int> affinityOf(pthread_t thread);
+    int numaNodeOf(int cpu);
+    std::vector<int> numaNodesOf(const std::vector<int> & cpus);
+    std::string describe(const std::vector<int> & cpus);
+};
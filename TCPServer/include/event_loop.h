@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include "file_descriptor.h"
+#include "timer_wheel.h"
+#include "buffer_pool.h"
+#include "ring_buffer.h"
+#include "pipe_ret_t.h"
+
+/*
+ * epoll based reactor. A single thread waits on every registered file descriptor
+ * and dispatches readiness events to the handler registered for that descriptor.
+ * Handlers run on the loop thread, so they must not block. Timers run on the
+ * loop thread as well, and epoll_wait() only sleeps until the next one is due.
+ */
+class EventLoop {
+
+public:
+    using io_handler_t = std::function<void(uint32_t events)>;
+    using add_failure_handler_t = std::function<void(const pipe_ret_t & failure)>;
+    using task_t = std::function<void()>;
+    using timer_id_t = TimerWheel::timer_id_t;
+
+private:
+    FileDescriptor _epollfd;
+    FileDescriptor _wakeupfd;
+    std::thread * _loopThread = nullptr;
+    std::atomic<bool> _running;
+    std::atomic<bool> _isStopped;
+    bool _isLooping = false;
+    std::condition_variable _loopExitedCv;
+    std::atomic<std::thread::id> _loopThreadId;
+
+    // only accessed from the loop thread
+    std::unordered_map<int, std::shared_ptr<io_handler_t>> _handlers;
+    TimerWheel _timers;
+
+    std::atomic<timer_id_t> _nextTimerId;
+
+    // tasks queued from any thread, taken by the loop thread in batches. Once the
+    // ring is full, tasks go to the overflow list until the loop took them all,
+    // so the tasks of one thread still run in the order they were queued
+    MpscRing<task_t> _pendingTasks;
+    std::mutex _pendingTasksMtx; // guards the overflow list and the start/stop state
+    std::vector<task_t> _overflowTasks;
+    std::atomic<bool> _hasOverflowTasks;
+    std::atomic<size_t> _numOfQueueingThreads;
+
+    // receive buffers of the handlers of this loop. Handlers run one at a time and
+    // consume what they read before returning, so a few buffers serve them all
+    BufferPool _bufferPool;
+
+    void loop();
+    void wakeup();
+    void handleWakeup();
+    void runPendingTasks();
+    void runAllPendingTasks();
+    pipe_ret_t addNow(int fd, uint32_t events, const io_handler_t & handler);
+    void removeNow(int fd);
+
+public:
+    EventLoop();
+    ~EventLoop();
+
+    void start();
+    void run();
+    void stop();
+    bool isInLoopThread() const { return std::this_thread::get_id() == _loopThreadId; }
+    static EventLoop * current();
+    bool pinToCpu(int cpu);
+    bool pinToCpus(const std::vector<int> & cpus);
+    std::vector<int> cpus() const;
+
+    void add(int fd, uint32_t events, const io_handler_t & handler, const add_failure_handler_t & onFailure = nullptr);
+    void modify(int fd, uint32_t events);
+    void remove(int fd);
+
+    BufferPool & bufferPool() { return _bufferPool; }
+
+    void runInLoop(const task_t & task);
+    void queueInLoop(const task_t & task);
+    void runInLoopAndWait(const task_t & task);
+
+    timer_id_t runAfter(uint64_t delayMs, const task_t & task);
+    timer_id_t runEvery(uint64_t intervalMs, const task_t & task);
+    void cancelTimer(timer_id_t timerId);
+};
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <functional>
+#include <sys/types.h>
+
+/*
+ * How messages are delimited on a byte stream. A TCP read may end in the middle
+ * of a message or hold several, so receivers feed what they read to a
+ * FrameReassembler, which asks the framing where each message ends.
+ * Framings are stateless, so one instance can be shared by every connection.
+ */
+class Framing {
+
+public:
+    static const ssize_t FRAME_INCOMPLETE = 0;
+    static const ssize_t FRAME_INVALID = -1;
+
+    virtual ~Framing() {}
+
+    /*
+     * Look for the first frame in data. Returns its size in bytes once it is complete,
+     * and the message it carries in payloadOffset / payloadSize. Returns
+     * FRAME_INCOMPLETE when more bytes are needed, FRAME_INVALID on a protocol violation.
+     */
+    virtual ssize_t findFrame(const char * data, size_t size, size_t & payloadOffset, size_t & payloadSize) const = 0;
+
+    /*
+     * buffered is the start of an incomplete frame, and next the bytes read after it.
+     * Returns how many bytes of next complete the frame, FRAME_INCOMPLETE when all of
+     * next does not, FRAME_INVALID on a protocol violation. Only next is scanned, so a
+     * frame arriving in many reads is scanned once. The default joins both and calls findFrame.
+     */
+    virtual ssize_t findFrameEnd(const char * buffered, size_t bufferedSize, const char * next, size_t nextSize) const;
+
+    // bytes sent before / after a message of payloadSize bytes
+    virtual std::string header(size_t /*payloadSize*/) const { return ""; }
+    virtual std::string trailer() const { return ""; }
+    virtual bool canFrame(size_t /*payloadSize*/) const { return true; }
+};
+
+/*
+ * 4 byte big endian payload length, followed by the payload.
+ * The concrete framings are final and find frames inline, so a receiver typed
+ * on one of them (BasicFrameReassembler<LengthPrefixedFraming>) calls no virtual function.
+ */
+class LengthPrefixedFraming final : public Framing {
+
+private:
+    const size_t _maxPayloadSize;
+
+public:
+    static const size_t HEADER_SIZE = 4;
+
+    explicit LengthPrefixedFraming(size_t maxPayloadSize = 16 * 1024 * 1024) : _maxPayloadSize{maxPayloadSize} {}
+
+    ssize_t findFrame(const char * data, size_t size, size_t & payloadOffset, size_t & payloadSize) const override;
+    ssize_t findFrameEnd(const char * buffered, size_t bufferedSize, const char * next, size_t nextSize) const override;
+    std::string header(size_t payloadSize) const override;
+    bool canFrame(size_t payloadSize) const override { return payloadSize <= _maxPayloadSize; }
+};
+
+/*
+ * Payload followed by a delimiter (a newline by default). The payload must not contain it.
+ */
+class DelimiterFraming final : public Framing {
+
+private:
+    const std::string _delimiter;
+    const size_t _maxPayloadSize;
+
+    const char * findDelimiter(const char * data, size_t size) const;
+
+public:
+    explicit DelimiterFraming(const std::string & delimiter = "\n", size_t maxPayloadSize = 64 * 1024);
+
+    ssize_t findFrame(const char * data, size_t size, size_t & payloadOffset, size_t & payloadSize) const override;
+    ssize_t findFrameEnd(const char * buffered, size_t bufferedSize, const char * next, size_t nextSize) const override;
+    std::string trailer() const override { return _delimiter; }
+    bool canFrame(size_t payloadSize) const override { return payloadSize <= _maxPayloadSize; }
+};
+
+/*
+ * Every message is exactly frameSize bytes. A frameSize of 0 throws std::invalid_argument:
+ * an empty frame could never be told apart from FRAME_INCOMPLETE.
+ */
+class FixedSizeFraming final : public Framing {
+
+private:
+    const size_t _frameSize;
+
+public:
+    explicit FixedSizeFraming(size_t frameSize);
+
+    ssize_t findFrame(const char * data, size_t size, size_t & payloadOffset, size_t & payloadSize) const override;
+    ssize_t findFrameEnd(const char * buffered, size_t bufferedSize, const char * next, size_t nextSize) const override;
+    bool canFrame(size_t payloadSize) const override { return payloadSize == _frameSize; }
+};
+
+inline ssize_t LengthPrefixedFraming::findFrame(const char * data, size_t size, size_t & payloadOffset, size_t & payloadSize) const {
+    if (size < HEADER_SIZE) {
+        return FRAME_INCOMPLETE;
+    }
+    const unsigned char * header = reinterpret_cast<const unsigned char*>(data);
+    const uint32_t length = (uint32_t(header[0]) << 24) | (uint32_t(header[1]) << 16) |
+                            (uint32_t(header[2]) << 8) | uint32_t(header[3]);
+    if (length > _maxPayloadSize) {
+        return FRAME_INVALID;
+    }
+    if (size - HEADER_SIZE < length) {
+        return FRAME_INCOMPLETE;
+    }
+    payloadOffset = HEADER_SIZE;
+    payloadSize = length;
+    return HEADER_SIZE + length;
+}
+
+inline ssize_t LengthPrefixedFraming::findFrameEnd(const char * buffered, size_t bufferedSize, const char * next, size_t nextSize) const {
+    if (bufferedSize + nextSize < HEADER_SIZE) {
+        return FRAME_INCOMPLETE;
+    }
+    // the header itself may be split between both
+    uint32_t length = 0;
+    for (size_t i = 0; i < HEADER_SIZE; i++) {
+        const char byte = (i < bufferedSize) ? buffered[i] : next[i - bufferedSize];
+        length = (length << 8) | static_cast<unsigned char>(byte);
+    }
+    if (length > _maxPayloadSize) {
+        return FRAME_INVALID;
+    }
+    const size_t numOfBytesMissing = HEADER_SIZE + length - bufferedSize;
+    return (nextSize < numOfBytesMissing) ? FRAME_INCOMPLETE : numOfBytesMissing;
+}
+
+inline ssize_t FixedSizeFraming::findFrame(const char * /*data*/, size_t size, size_t & payloadOffset, size_t & payloadSize) const {
+    if (size < _frameSize) {
+        return FRAME_INCOMPLETE;
+    }
+    payloadOffset = 0;
+    payloadSize = _frameSize;
+    return _frameSize;
+}
+
+inline ssize_t FixedSizeFraming::findFrameEnd(const char * /*buffered*/, size_t bufferedSize, const char * /*next*/, size_t nextSize) const {
+    const size_t numOfBytesMissing = _frameSize - bufferedSize;
+    return (nextSize < numOfBytesMissing) ? FRAME_INCOMPLETE : numOfBytesMissing;
+}
+
+/*
+ * Per connection receive side of a framing: buffers a partial frame across reads
+ * and hands every complete message to the callback, once, with its length.
+ * Frames lying entirely within one read are delivered straight from the read
+ * buffer; only the incomplete tail is copied, and a later read only gives it the
+ * bytes completing it. The tail's buffer is reused from frame to frame, so split
+ * frames do not allocate either. Without a framing, every read is one message.
+ * FramingT is the framing type frames are found with, and the callback is taken
+ * by its own type, so with a concrete framing the whole path can be inlined.
+ * FrameReassembler works with any framing.
+ */
+template <typename FramingT>
+class BasicFrameReassembler {
+
+public:
+    using message_handler_t = std::function<void(const char * msg, size_t size)>;
+
+    // buffer kept for split frames between messages, larger ones are freed once delivered
+    static const size_t MAX_RETAINED_CAPACITY = 64 * 1024;
+
+private:
+    std::shared_ptr<const FramingT> _framing;
+    std::string _partialFrame;
+
+    template <typename MessageHandler>
+    bool deliverFrames(const char * data, size_t size, size_t & numOfBytesUsed, const MessageHandler & onMessage);
+
+public:
+    BasicFrameReassembler() = default;
+    explicit BasicFrameReassembler(const std::shared_ptr<const FramingT> & framing) : _framing{framing} {}
+
+    void setFraming(const std::shared_ptr<const FramingT> & framing) { _framing = framing; _partialFrame.clear(); }
+    const std::shared_ptr<const FramingT> & framing() const { return _framing; }
+
+    template <typename MessageHandler>
+    bool feed(const char * data, size_t size, const MessageHandler & onMessage);
+    size_t numOfBufferedBytes() const { return _partialFrame.size(); }
+};
+
+using FrameReassembler = BasicFrameReassembler<Framing>;
+
+/*
+ * Deliver every complete frame at the start of data. numOfBytesUsed tells how
+ * far it got; the rest is the start of an incomplete frame.
+ * Returns false on an invalid frame.
+ */
+template <typename FramingT>
+template <typename MessageHandler>
+bool BasicFrameReassembler<FramingT>::deliverFrames(const char * data, size_t size, size_t & numOfBytesUsed, const MessageHandler & onMessage) {
+    numOfBytesUsed = 0;
+    while (numOfBytesUsed < size) {
+        size_t payloadOffset = 0;
+        size_t payloadSize = 0;
+        const ssize_t frameSize = _framing->findFrame(data + numOfBytesUsed, size - numOfBytesUsed, payloadOffset, payloadSize);
+        if (frameSize == Framing::FRAME_INVALID) {
+            return false;
+        }
+        if (frameSize == Framing::FRAME_INCOMPLETE) {
+            break;
+        }
+        onMessage(data + numOfBytesUsed + payloadOffset, payloadSize);
+        numOfBytesUsed += frameSize;
+    }
+    return true;
+}
+
+/*
+ * Feed bytes read from the connection. Calls onMessage for every message they
+ * complete. Returns false when the stream violates the framing; the connection
+ * can not be resynchronized then and should be closed.
+ */
+template <typename FramingT>
+template <typename MessageHandler>
+bool BasicFrameReassembler<FramingT>::feed(const char * data, size_t size, const MessageHandler & onMessage) {
+    if (!_framing) {
+        onMessage(data, size);
+        return true;
+    }
+
+    if (!_partialFrame.empty()) {
+        // complete the buffered frame with the bytes it misses, then parse the rest in place
+        const ssize_t numOfBytesMissing = _framing->findFrameEnd(_partialFrame.data(), _partialFrame.size(), data, size);
+        if (numOfBytesMissing == Framing::FRAME_INVALID) {
+            return false;
+        }
+        if (numOfBytesMissing == Framing::FRAME_INCOMPLETE) {
+            _partialFrame.append(data, size);
+            return true;
+        }
+        _partialFrame.append(data, numOfBytesMissing);
+        size_t payloadOffset = 0;
+        size_t payloadSize = 0;
+        if (_framing->findFrame(_partialFrame.data(), _partialFrame.size(), payloadOffset, payloadSize) != static_cast<ssize_t>(_partialFrame.size())) {
+            return false;
+        }
+        onMessage(_partialFrame.data() + payloadOffset, payloadSize);
+        _partialFrame.clear(); // the next split frame reuses the buffer, unless it grew large
+        if (_partialFrame.capacity() > MAX_RETAINED_CAPACITY) {
+            std::string().swap(_partialFrame);
+        }
+        data += numOfBytesMissing;
+        size -= numOfBytesMissing;
+    }
+
+    size_t numOfBytesUsed = 0;
+    if (!deliverFrames(data, size, numOfBytesUsed, onMessage)) {
+        return false;
+    }
+    _partialFrame.assign(data + numOfBytesUsed, size - numOfBytesUsed);
+    return true;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "file_descriptor.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+/*
+ * io_uring based I/O loop, an alternative to EventLoop (build with IO_URING_BACKEND).
+ * Listening sockets use multishot accept, client sockets use multishot recv into
+ * a ring of provided buffers, and sends queued during a loop iteration are all
+ * submitted together with a single io_uring_enter().
+ * Talks to the kernel through the raw syscalls, so liburing is not needed.
+ */
+class IoUringLoop {
+
+public:
+    using accept_handler_t = std::function<void(int fd, const struct sockaddr_in & address)>;
+    // size > 0: data received, size == 0: peer closed, size < 0: -errno
+    using recv_handler_t = std::function<void(const char * data, ssize_t size)>;
+    using task_t = std::function<void()>;
+
+private:
+    struct connection_t {
+        uint32_t id;
+        int fd;
+        recv_handler_t handler;
+        bool isReceiving = false;
+        bool isSending = false;
+        bool isClosing = false;
+        bool isQueuedForFlush = false;
+        std::deque<std::string> queuedMsgs;
+        std::vector<std::string> inflightMsgs;
+        std::vector<struct iovec> inflightIov;
+        struct msghdr inflightMsghdr;
+    };
+
+    struct pending_send_t {
+        int fd;
+        std::string msg;
+    };
+
+    FileDescriptor _ringfd;
+    FileDescriptor _wakeupfd;
+    uint64_t _wakeupCounter = 0;
+
+    // submission / completion rings, shared with the kernel
+    void * _sqRingPtr = nullptr;
+    size_t _sqRingSize = 0;
+    void * _cqRingPtr = nullptr;
+    size_t _cqRingSize = 0;
+    struct io_uring_sqe * _sqes = nullptr;
+    size_t _sqesSize = 0;
+    unsigned * _sqHead = nullptr;
+    unsigned * _sqTail = nullptr;
+    unsigned * _sqMask = nullptr;
+    unsigned * _sqArray = nullptr;
+    unsigned _sqEntries = 0;
+    unsigned * _cqHead = nullptr;
+    unsigned * _cqTail = nullptr;
+    unsigned * _cqMask = nullptr;
+    struct io_uring_cqe * _cqes = nullptr;
+    unsigned _sqLocalTail = 0;
+    unsigned _numOfUnsubmitted = 0;
+
+    // provided receive buffers
+    struct io_uring_buf_ring * _bufRing = nullptr;
+    size_t _bufRingSize = 0;
+    char * _buffers = nullptr;
+    unsigned _numOfBuffers;
+    unsigned _bufferSize;
+    uint16_t _bufRingTail = 0;
+
+    std::thread * _loopThread = nullptr;
+    std::atomic<bool> _running;
+    std::atomic<std::thread::id> _loopThreadId;
+
+    // only accessed from the loop thread
+    std::vector<std::pair<int, accept_handler_t>> _acceptors;
+    std::unordered_map<uint32_t, connection_t*> _connections;
+    std::unordered_map<int, uint32_t> _connectionIdByFd;
+    std::vector<connection_t*> _connectionsToFlush;
+    std::vector<connection_t*> _closedConnections;
+    uint32_t _nextConnectionId = 0;
+
+    std::mutex _pendingMtx;
+    std::vector<task_t> _pendingTasks;
+    std::vector<pending_send_t> _pendingSends;
+
+    void setupRings(unsigned entries);
+    void setupBufferRing();
+    void teardownRings();
+    struct io_uring_sqe * getSqe();
+    void submit(unsigned waitFor);
+    void loop();
+    void reapCompletions();
+    void handleCompletion(const struct io_uring_cqe & cqe);
+    void handleRecvCompletion(connection_t * connection, const struct io_uring_cqe & cqe);
+    void handleSendCompletion(connection_t * connection, int result);
+    void armWakeup();
+    void armAccept(size_t acceptorIndex);
+    void armRecv(connection_t * connection);
+    void armSend(connection_t * connection);
+    void recycleBuffer(uint16_t bufferId);
+    void queueSend(int fd, std::string && msg);
+    void flushSends();
+    void releaseClosedConnections();
+    void wakeup();
+    void runPending();
+
+public:
+    IoUringLoop(unsigned entries = 1024, unsigned numOfBuffers = 512, unsigned bufferSize = 4096);
+    ~IoUringLoop();
+
+    void start();
+    void stop();
+    bool isInLoopThread() const { return std::this_thread::get_id() == _loopThreadId; }
+    bool pinToCpu(int cpu);
+    std::vector<int> cpus() const;
+
+    void acceptOn(int listeningfd, const accept_handler_t & handler);
+    void startReceiving(int fd, const recv_handler_t & handler);
+    void stopReceiving(int fd);
+    void send(int fd, const char * msg, size_t size);
+
+    void runInLoop(const task_t & task);
+    void queueInLoop(const task_t & task);
+};
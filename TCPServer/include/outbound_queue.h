@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include "file_descriptor.h"
+
+// immutable payload shared by every connection it is queued on (broadcasts)
+using shared_payload_t = std::shared_ptr<const std::string>;
+
+// open file, closed once the last queue streaming it let go of it
+using shared_file_t = std::shared_ptr<const FileDescriptor>;
+
+enum class WatermarkCrossing {
+    NONE,
+    ABOVE_HIGH, // the queue grew beyond the high watermark, producers should pause
+    BELOW_LOW   // a paused queue drained to the low watermark, producers may resume
+};
+
+/*
+ * Bytes accepted for a connection but not taken by the socket yet. flush()
+ * hands all queued chunks to one sendmsg() call (several for very long queues);
+ * partial writes leave the rest of the front chunk queued, and the next flush
+ * resumes from there. Not thread safe: Client guards it.
+ *
+ * Copied bytes are appended to the last chunk while it holds copied bytes and
+ * stays under MAX_MERGED_CHUNK_SIZE, so many small responses share one buffer
+ * and one iovec instead of an allocation and an iovec each.
+ *
+ * Shared payloads are queued by reference. With a zero copy threshold set (and
+ * SO_ZEROCOPY enabled on the socket), shared payloads at least that large are
+ * sent with MSG_ZEROCOPY, and referenced until the kernel reports it is done
+ * with them (see reapZeroCopyCompletions()).
+ *
+ * File ranges are queued as (file, offset, size) and streamed with sendfile(),
+ * straight from the page cache, in order with the chunks around them.
+ */
+class OutboundQueue {
+
+private:
+    struct chunk_t {
+        std::string ownedData;
+        shared_payload_t sharedData;
+        shared_file_t file;
+        size_t fileSize = 0;
+        size_t offset = 0; // bytes already sent
+
+        const std::string & data() const { return sharedData ? *sharedData : ownedData; }
+        bool isOwned() const { return !sharedData && !file; }
+        size_t size() const { return file ? fileSize : data().size(); }
+        size_t numOfBytesLeft() const { return size() - offset; }
+    };
+
+    struct zero_copy_send_t {
+        uint32_t sendId;
+        shared_payload_t payload;
+    };
+
+    std::deque<chunk_t> _chunks;
+    size_t _numOfQueuedBytes = 0;
+    size_t _highWatermark;
+    size_t _lowWatermark;
+    bool _isAboveHighWatermark = false;
+
+    size_t _zeroCopyThreshold = 0; // 0 disables MSG_ZEROCOPY
+    uint32_t _nextZeroCopySendId = 0; // the kernel numbers zero copy sends per socket, from 0
+    std::deque<zero_copy_send_t> _zeroCopySends; // sent, but possibly still read by the kernel
+
+    bool isZeroCopy(const chunk_t & chunk) const;
+    void consume(size_t numOfBytes);
+    int sendFileChunk(int sockfd);
+
+public:
+    static const size_t DEFAULT_HIGH_WATERMARK = 1024 * 1024;
+    static const size_t DEFAULT_LOW_WATERMARK = 256 * 1024;
+    static const size_t MAX_CHUNKS_PER_SEND = 64;
+    static const size_t MAX_MERGED_CHUNK_SIZE = 16 * 1024;
+
+    OutboundQueue(size_t highWatermark = DEFAULT_HIGH_WATERMARK, size_t lowWatermark = DEFAULT_LOW_WATERMARK);
+
+    void setWatermarks(size_t highWatermark, size_t lowWatermark);
+    void setZeroCopyThreshold(size_t zeroCopyThreshold) { _zeroCopyThreshold = zeroCopyThreshold; }
+    void append(const char * data, size_t size);
+    void append(const shared_payload_t & payload, size_t offset = 0);
+    void appendFile(const shared_file_t & file, size_t offset, size_t size);
+    int flush(int sockfd, bool moreToCome = false);
+    void reapZeroCopyCompletions(int sockfd);
+    void clear();
+    WatermarkCrossing checkWatermarks();
+
+    bool empty() const { return _numOfQueuedBytes == 0; }
+    size_t size() const { return _numOfQueuedBytes; }
+    bool isAboveHighWatermark() const { return _isAboveHighWatermark; }
+    bool hasZeroCopySends() const { return !_zeroCopySends.empty(); }
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "framing.h"
+
+/*
+ * Binary request / response protocol spoken by the example server and client.
+ * Every message is a 12 byte header followed by its payload, integers little endian:
+ *
+ *   offset 0  version       uint8   VERSION
+ *   offset 1  opcode        uint8   Opcode
+ *   offset 2  flags         uint16  reserved, 0
+ *   offset 4  requestId     uint32  chosen by the client, echoed in the response
+ *   offset 8  payloadSize   uint32  bytes following the header
+ *
+ * Decoding never throws: it is a bounds check and a memcpy per field.
+ */
+namespace protocol {
+
+    const uint8_t VERSION = 1;
+    const size_t HEADER_SIZE = 12;
+    const uint32_t MAX_PAYLOAD_SIZE = 16 * 1024 * 1024;
+
+    enum class Opcode : uint8_t {
+        GET_NEXT_NUMBER = 0x01, // uint32 client id
+        GET_LIST = 0x02,        // uint32 client id
+        NEXT_NUMBER = 0x81,     // int32 number
+        LIST = 0x82,            // int32 numbers, sorted
+        ERROR = 0xFF            // uint32 ErrorCode
+    };
+
+    enum class ErrorCode : uint32_t {
+        UNKNOWN_OPCODE = 1,
+        BAD_PAYLOAD = 2,
+        UNKNOWN_CLIENT = 3
+    };
+
+    struct message_header_t {
+        uint8_t version = VERSION;
+        Opcode opcode = Opcode::ERROR;
+        uint16_t flags = 0;
+        uint32_t requestId = 0;
+        uint32_t payloadSize = 0;
+    };
+
+    // a decoded message, payload points into the buffer it was decoded from
+    struct message_t {
+        message_header_t header;
+        const char * payload = nullptr;
+    };
+
+    void encodeHeader(const message_header_t & header, char * out);
+    bool decodeHeader(const char * data, size_t size, message_header_t & header);
+    bool decode(const char * data, size_t size, message_t & message);
+
+    std::string encode(Opcode opcode, uint32_t requestId, const char * payload = nullptr, size_t payloadSize = 0);
+    std::string encodeUint32(Opcode opcode, uint32_t requestId, uint32_t value);
+    std::string encodeInt32s(Opcode opcode, uint32_t requestId, const std::vector<int32_t> & values);
+    std::string encodeError(uint32_t requestId, ErrorCode errorCode);
+
+    bool decodeUint32(const message_t & message, uint32_t & value);
+    bool decodeInt32s(const message_t & message, std::vector<int32_t> & values);
+
+    /*
+     * Framing of protocol messages: the header carries the length, and the whole
+     * message, header included, is handed to the receiver. Senders pass messages
+     * made by encode(), which are already framed.
+     */
+    class MessageFraming final : public Framing {
+
+    public:
+        ssize_t findFrame(const char * data, size_t size, size_t & payloadOffset, size_t & payloadSize) const override;
+        bool canFrame(size_t messageSize) const override;
+    };
+}
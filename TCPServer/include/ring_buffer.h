@@ -0,0 +1,199 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
+
+namespace ring_buffer {
+    static const size_t CACHE_LINE_SIZE = 64;
+
+    // smallest power of 2 holding capacity items (at least 2)
+    inline size_t roundUpCapacity(size_t capacity) {
+        size_t roundedCapacity = 2;
+        while (roundedCapacity < capacity) {
+            roundedCapacity <<= 1;
+        }
+        return roundedCapacity;
+    }
+}
+
+/*
+ * Bounded lock free queue for exactly one producer thread and one consumer
+ * thread. The producer's and the consumer's index each sit on a cache line of
+ * their own, next to a cached copy of the other side's index, so the two threads
+ * only exchange cache lines when the cached copy no longer tells whether the
+ * ring is full (or empty). The consumer takes items in batches with drain(),
+ * and publishes the freed slots once per batch.
+ */
+template <typename T>
+class SpscRing {
+
+private:
+    char _padBefore[ring_buffer::CACHE_LINE_SIZE];
+
+    // consumer side
+    std::atomic<size_t> _head; // next item to take
+    size_t _cachedTail = 0;
+    char _padHead[ring_buffer::CACHE_LINE_SIZE];
+
+    // producer side
+    std::atomic<size_t> _tail; // next slot to fill
+    size_t _cachedHead = 0;
+    char _padTail[ring_buffer::CACHE_LINE_SIZE];
+
+    const size_t _capacity;
+    const size_t _mask;
+    std::unique_ptr<T[]> _slots;
+
+public:
+    explicit SpscRing(size_t capacity) :
+        _capacity{ring_buffer::roundUpCapacity(capacity)},
+        _mask{_capacity - 1},
+        _slots{new T[_capacity]} {
+        _head = 0;
+        _tail = 0;
+    }
+    SpscRing(const SpscRing &) = delete;
+    SpscRing & operator=(const SpscRing &) = delete;
+
+    size_t capacity() const { return _capacity; }
+
+    /*
+     * Producer only. Returns false, leaving item untouched, when the ring is full.
+     */
+    bool tryPush(T && item) {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _cachedHead == _capacity) {
+            _cachedHead = _head.load(std::memory_order_acquire);
+            if (tail - _cachedHead == _capacity) {
+                return false;
+            }
+        }
+        _slots[tail & _mask] = std::move(item);
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*
+     * Consumer only. Hands up to maxItems items to consume (as T&&), oldest first.
+     * Returns how many it handed over.
+     */
+    template <typename Consumer>
+    size_t drain(const Consumer & consume, size_t maxItems) {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (_cachedTail == head) {
+            _cachedTail = _tail.load(std::memory_order_acquire);
+        }
+        const size_t numOfItems = std::min(_cachedTail - head, maxItems);
+        for (size_t i = 0; i < numOfItems; i++) {
+            consume(std::move(_slots[(head + i) & _mask]));
+        }
+        if (numOfItems > 0) {
+            _head.store(head + numOfItems, std::memory_order_release);
+        }
+        return numOfItems;
+    }
+
+    // consumer only
+    bool empty() const {
+        return _tail.load(std::memory_order_acquire) == _head.load(std::memory_order_relaxed);
+    }
+};
+
+/*
+ * Bounded lock free queue for any number of producer threads and one consumer
+ * thread. Producers claim a slot by advancing the shared tail, and every slot
+ * carries a sequence number telling whether it is free, filled or being filled,
+ * so the consumer never waits on a producer that has not finished its item yet
+ * beyond that item. Items of one producer are taken in the order it pushed them.
+ */
+template <typename T>
+class MpscRing {
+
+private:
+    struct slot_t {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    char _padBefore[ring_buffer::CACHE_LINE_SIZE];
+    std::atomic<size_t> _tail; // next slot to claim, shared by the producers
+    char _padTail[ring_buffer::CACHE_LINE_SIZE];
+    size_t _head = 0; // next item to take, consumer only
+    char _padHead[ring_buffer::CACHE_LINE_SIZE];
+
+    const size_t _capacity;
+    const size_t _mask;
+    std::unique_ptr<slot_t[]> _slots;
+
+public:
+    explicit MpscRing(size_t capacity) :
+        _capacity{ring_buffer::roundUpCapacity(capacity)},
+        _mask{_capacity - 1},
+        _slots{new slot_t[_capacity]} {
+        _tail = 0;
+        for (size_t i = 0; i < _capacity; i++) {
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    MpscRing(const MpscRing &) = delete;
+    MpscRing & operator=(const MpscRing &) = delete;
+
+    size_t capacity() const { return _capacity; }
+
+    /*
+     * Any thread. Returns false, leaving item untouched, when the ring is full.
+     */
+    bool tryPush(T && item) {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        slot_t * slot;
+        while (true) {
+            slot = &_slots[tail & _mask];
+            const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            const intptr_t lag = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(tail);
+            if (lag == 0) {
+                if (_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (lag < 0) {
+                return false; // the slot still holds an item a lap behind
+            } else {
+                tail = _tail.load(std::memory_order_relaxed);
+            }
+        }
+        slot->item = std::move(item);
+        slot->sequence.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*
+     * Consumer only. Hands up to maxItems items to consume (as T&&), oldest first.
+     * Returns how many it handed over. Each slot is freed before its item is
+     * consumed, so consume may itself push, or drain from the same thread.
+     */
+    template <typename Consumer>
+    size_t drain(const Consumer & consume, size_t maxItems) {
+        size_t numOfItems = 0;
+        while (numOfItems < maxItems) {
+            const size_t head = _head;
+            slot_t & slot = _slots[head & _mask];
+            if (slot.sequence.load(std::memory_order_acquire) != head + 1) {
+                break; // empty, or the next item is still being filled
+            }
+            T item(std::move(slot.item));
+            _head = head + 1;
+            slot.sequence.store(head + _capacity, std::memory_order_release);
+            consume(std::move(item));
+            numOfItems++;
+        }
+        return numOfItems;
+    }
+
+    // consumer only. An item still being filled counts as one
+    bool empty() const {
+        return _tail.load(std::memory_order_acquire) == _head;
+    }
+};
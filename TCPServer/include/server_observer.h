@@ -5,8 +5,16 @@
 #include "client.h"
 
 struct server_observer_t {
+	// when set, only this connection's events are observed (wantedIP is ignored), and the
+	// subscription ends with its disconnection. See Client::getHandle()
+	connection_handle_t wantedConnection = 0;
 	std::string wantedIP = "";
-	std::function<void(const std::string &clientIP, const char * msg, size_t size)> incomingPacketHandler;
-	std::function<void(const std::string &ip, const std::string &msg)> disconnectionHandler;
+	std::function<void(connection_handle_t connection, const std::string &clientIP, const char * msg, size_t size)> incomingPacketHandler;
+	std::function<void(connection_handle_t connection, const std::string &ip, const std::string &msg)> disconnectionHandler;
+	// called on the server's timer thread, client is only valid during the call
+	std::function<void(const Client &client)> clientAcceptedHandler;
+	// isPaused: the client's outbound queue passed the high watermark, stop producing
+	// for it until called again with false (drained to the low watermark)
+	std::function<void(connection_handle_t connection, const std::string &clientIP, bool isPaused)> sendBackpressureHandler;
 };
 
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include "framing.h"
+
+enum class IoBackend {
+    EPOLL,
+    IO_URING // needs a build configured with -DIO_URING_BACKEND=ON
+};
+
+struct server_options_t {
+    int maxNumOfClients = 10;
+    bool removeDeadClientsAutomatically = true;
+    size_t numOfIoThreads = 0; // event loops serving client sockets, 0 means one per hardware thread
+
+    // when > 0, open this many SO_REUSEPORT listening sockets, each accepted and served
+    // by its own event loop pinned to one cpu. Clients are then accepted by the server
+    // itself, and acceptClient() must not be used
+    size_t numOfAcceptors = 0;
+
+    IoBackend ioBackend = IoBackend::EPOLL;
+
+    // when > 0, observer callbacks run on this many worker threads instead of the I/O
+    // threads. Each worker has a lock free queue per I/O thread, holding at most
+    // handlerQueueCapacity events (rounded up to a power of 2); past that, events
+    // for the worker go to a locked overflow list, an I/O thread never waits on it
+    size_t numOfHandlerThreads = 0;
+    size_t handlerQueueCapacity = 1024;
+
+    // worker threads of the work stealing scheduler behind TcpServer::spawn().
+    // 0 means no scheduler, spawn() then runs the task on the calling thread
+    size_t numOfTaskThreads = 0;
+
+    // bytes queued for a slow client past which observers are asked to pause sending
+    // to it (sendBackpressureHandler), and to which the queue must drain to resume
+    size_t outboundHighWatermark = 1024 * 1024;
+    size_t outboundLowWatermark = 256 * 1024;
+
+    // queue every send and let the client's event loop flush all of them with one
+    // sendmsg() per loop iteration, instead of one send() per message
+    bool coalesceSends = true;
+
+    // broadcast payloads of at least this many bytes are sent with MSG_ZEROCOPY (the
+    // kernel then reads them straight from the shared buffer). Pinning pages costs more
+    // than copying small payloads, so keep it in the tens of KB; 0 disables it
+    size_t zeroCopyThreshold = 0;
+
+    // how messages are delimited on client connections, in both directions. Observers
+    // then get one incomingPacketHandler call per complete message, however it was split
+    // into reads, and sent messages are framed. Null means every read is one message
+    std::shared_ptr<const Framing> framing;
+
+    // disconnect clients nothing was received from for this long, 0 disables it
+    uint64_t clientIdleTimeoutMs = 0;
+
+    // cpus the I/O loops are pinned to, loop i to ioCpus[i % ioCpus.size()]. When empty,
+    // only multi acceptor loops are pinned (loop i to cpu i), and other loops float.
+    // When the pinned loops span several NUMA nodes, client state is allocated by the
+    // loop serving the client, so it lands on that loop's node
+    std::vector<int> ioCpus;
+
+    // cpus the handler, task and timer threads may run on, empty means any cpu
+    std::vector<int> workerCpus;
+
+    // print the cpus every thread may run on to stdout when the server starts
+    bool reportPlacement = false;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+/*
+ * Work stealing scheduler for short request tasks. Every worker owns a deque:
+ * tasks spawned from a worker go to the back of its own deque and it pops from
+ * the back, while idle workers steal from the front of the other deques.
+ * Tasks spawned from outside the scheduler are spread over the workers round robin.
+ */
+class TaskScheduler {
+
+public:
+    using task_t = std::function<void()>;
+
+private:
+    struct worker_t {
+        std::mutex tasksMtx;
+        std::deque<task_t> tasks;
+        std::thread * thread = nullptr;
+    };
+
+    std::vector<worker_t*> _workers;
+    std::atomic<bool> _running;
+    std::atomic<size_t> _numOfQueuedTasks;
+    std::atomic<size_t> _nextWorker;
+
+    std::mutex _idleMtx;
+    std::condition_variable _idleCv;
+    std::atomic<size_t> _numOfIdleWorkers;
+
+    void workerTask(size_t workerIndex);
+    bool popLocal(size_t workerIndex, task_t & task);
+    bool steal(size_t thiefIndex, task_t & task);
+    void push(size_t workerIndex, task_t && task);
+
+public:
+    explicit TaskScheduler(size_t numOfWorkers);
+    ~TaskScheduler();
+
+    void start();
+    void stop();
+    bool pinToCpus(const std::vector<int> & cpus);
+    std::vector<int> cpusOf(size_t workerIndex) const;
+    void spawn(task_t task);
+    bool isWorkerThread() const;
+    size_t size() const { return _workers.size(); }
+};
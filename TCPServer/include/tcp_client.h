@@ -19,6 +19,8 @@
 #include "client_observer.h"
 #include "pipe_ret_t.h"
 #include "file_descriptor.h"
+#include "framing.h"
+#include "buffer_pool.h"
 #include <iostream>
 #include <fstream>
 
@@ -32,8 +34,13 @@ private:
     struct sockaddr_in _server;
     std::vector<client_observer_t> _subscibers;
     std::thread * _receiveTask = nullptr;
+    FileDescriptor _wakeupfd; // eventfd, written by close() to stop the receive thread at once
 
     std::mutex _subscribersMtx;
+    std::mutex _sendMtx;
+    std::shared_ptr<const Framing> _framing;
+    FrameReassembler _reassembler; // only used by the receive thread
+    AdaptiveReadSize _readSize; // only used by the receive thread
 
     void initializeSocket();
     void startReceivingMessages();
@@ -42,12 +49,15 @@ private:
     void publishServerDisconnected(const pipe_ret_t & ret);
     void receiveTask();
     void terminateReceiveThread();
+    pipe_ret_t sendAll(const char * data, size_t size);
 
 public:
     TcpClient();
     ~TcpClient();
     pipe_ret_t connectTo(const std::string & address, int port);
     pipe_ret_t sendMsg(const char * msg, size_t size);
+    pipe_ret_t sendMsgs(const std::vector<std::string> & msgs);
+    void setFraming(const std::shared_ptr<const Framing> & framing);
     FileDescriptor _sockfd;
     int getID();
     void subscribe(const client_observer_t & observer);
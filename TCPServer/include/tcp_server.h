@@ -12,59 +12,176 @@
 #include <functional>
 #include <cstring>
 #include <map>
+#include <unordered_map>
 #include <errno.h>
 #include <iostream>
 #include <mutex>
+#include <memory>
 #include "client.h"
 #include "tcp_client.h"
 #include "server_observer.h"
+#include "server_options.h"
+#include "event_loop.h"
+#include "thread_pool.h"
+#include "task_scheduler.h"
 #include "pipe_ret_t.h"
 #include "file_descriptor.h"
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
 
+class IoUringLoop;
+
+// returned by TcpServer::subscribe(), increasing in subscription order
+typedef size_t subscription_id_t;
+
+/*
+ * Observers keyed by the connection or client address they want (network byte
+ * order), and the ones wanting every client. Publishing walks only the lists of
+ * the client's connection and address and the wildcard list, merged back into
+ * subscription order.
+ * Never modified once published: subscribe() and unsubscribe() swap in a copy.
+ */
+struct subscriber_index_t {
+    struct entry_t {
+        subscription_id_t id;
+        server_observer_t observer;
+    };
+
+    std::unordered_map<connection_handle_t, std::vector<entry_t>> byConnection;
+    std::unordered_map<in_addr_t, std::vector<entry_t>> byAddress;
+    std::vector<entry_t> wildcard;
+    subscription_id_t nextId = 0;
+};
+
+struct client_send_result_t {
+    connection_handle_t connection;
+    std::string clientIP;
+    pipe_ret_t result;
+};
+
 class TcpServer {
 private:
     FileDescriptor _sockfd; //used to keep track of the file descriptor of the server 
     struct sockaddr_in _serverAddress; 
     struct sockaddr_in _clientAddress;
     fd_set _fds;
-    std::vector<server_observer_t> _subscribers;
-    std::mutex _subscribersMtx;
+    std::shared_ptr<const subscriber_index_t> _subscribers; // stored atomically under _subscribersMtx, loaded atomically by publishers
+    std::atomic<uint64_t> _subscribersVersion; // changes after _subscribers, checked by publishers
+    std::mutex _subscribersMtx; // serializes the writers only
+    ThreadPool * _handlerPool = nullptr; // runs observer callbacks off the I/O threads when configured
+    TaskScheduler * _taskScheduler = nullptr; // runs tasks handed to spawn()
+    std::mutex _numbersMtx;
+    std::unordered_map<connection_handle_t, Client*> _clientsByHandle; // under _clientsMtx
+    std::atomic<connection_handle_t> _nextConnectionHandle;
+
+    EventLoop * _timerLoop = nullptr; // server wide timers: dead clients removal, sendAfter(), runAfter()
+    uint64_t _clientIdleTimeoutMs = 0;
+    size_t _outboundHighWatermark = OutboundQueue::DEFAULT_HIGH_WATERMARK;
+    size_t _outboundLowWatermark = OutboundQueue::DEFAULT_LOW_WATERMARK;
+    bool _coalesceSends = true;
+    size_t _zeroCopyThreshold = 0;
+    std::shared_ptr<const Framing> _framing; // shared by every client, null when reads are not framed
+    std::vector<int> _ioLoopCpus; // cpu each I/O loop is pinned to, -1 when not pinned
+    bool _allocateClientsOnLoops = false; // pinned I/O loops span several NUMA nodes
+
+    struct accepted_client_t {
+        int sockfd;
+        struct sockaddr_in address;
+        EventLoop * eventLoop;
+    };
+
+    // clients grouped by the event loop serving them. A broadcast fans out to the loops,
+    // each queueing the payload on its own shard, without holding _clientsMtx.
+    // The last shard holds the clients without an event loop (io_uring backend)
+    struct client_shard_t {
+        EventLoop * eventLoop = nullptr;
+        std::mutex clientsMtx;
+        std::vector<Client*> clients;
+    };
 
-    std::thread * _clientsRemoverThread = nullptr;
-    std::atomic<bool> _stopRemoveClientsTask;
+    std::vector<EventLoop*> _eventLoops;
+    std::vector<client_shard_t*> _clientShards;
+    std::atomic<size_t> _nextEventLoop;
+    std::vector<FileDescriptor> _acceptorSockfds; // SO_REUSEPORT listeners, one per event loop
+    std::vector<IoUringLoop*> _ioUringLoops;
+    EventLoop * _acceptLoop = nullptr; // driven by runAcceptLoop() on the caller thread
     
     void startSorting(std::vector<Client*> _clients);
-    void publishClientMsg(const Client & client, const char * msg, size_t msgSize);
-    void publishClientDisconnected(const std::string&, const std::string&);
+    const subscriber_index_t & subscribersSnapshot();
+    void replaceSubscribers(const std::shared_ptr<const subscriber_index_t> & subscribers);
+    void publishClientMsg(connection_handle_t connection, in_addr_t clientAddress, const std::string &clientIP, const char * msg, size_t msgSize);
+    void publishClientBackpressure(connection_handle_t connection, in_addr_t clientAddress, const std::string &clientIP, bool isPaused);
+    void publishClientDisconnected(connection_handle_t connection, in_addr_t clientAddress, const std::string &clientIP, const std::string &clientMsg);
+    void dropConnectionSubscriptions(connection_handle_t connection);
+    void publishClientAccepted(const Client & client);
+    void publishClientsAccepted(const std::vector<connection_handle_t> & handles);
     pipe_ret_t waitForClient(uint32_t timeout);
-    void clientEventHandler(const Client&, ClientEvent, const std::string &msg);
+    void clientEventHandler(const Client&, ClientEvent, const char * data, size_t size);
+    void dispatchToHandlerPool(const Client&, ClientEvent, const char * data, size_t size);
     void removeDeadClients();
-    void terminateDeadClientsRemover();
+    void startTimerLoop(const server_options_t & options);
+    void stopTimerLoop();
+    void startEventLoops(size_t numOfIoThreads, const server_options_t & options);
+    int ioCpuFor(size_t loopIndex, const server_options_t & options) const;
+    void placeThreads(const server_options_t & options);
+    void reportPlacement() const;
+    std::vector<Client*> createClients(const std::vector<accepted_client_t> & acceptedClients);
+    void stopEventLoops();
+    EventLoop * nextEventLoop();
+    void openAcceptorSockets(int port, const server_options_t & options);
+    void startAcceptors();
+    void closeAcceptors();
+    void acceptPendingClients(int listeningSockfd, EventLoop * eventLoop);
+    void startIoUringLoops(const server_options_t & options);
+    void stopIoUringLoops();
+    void deleteIoUringLoops();
+    Client * registerClient(Client * newClient, const struct sockaddr_in & clientAddress);
+    void registerClients(const std::vector<Client*> & newClients);
+    pipe_ret_t closeClients(const std::vector<Client*> & clients);
+    void createClientShards();
+    void clearClientShards();
+    void deleteClientShards();
+    client_shard_t * shardOf(const Client * client) const;
+    void removeFromShard(const Client * client);
+    static void broadcastToShard(client_shard_t * shard, const shared_payload_t & payload,
+                                 std::vector<client_send_result_t> & sendingResults);
 
 public:
     TcpServer();
     ~TcpServer();
     std::mutex _clientsMtx;
     pipe_ret_t start(int port, int maxNumOfClients = 10, bool removeDeadClientsAutomatically = true);
+    pipe_ret_t start(int port, const server_options_t & options);
     void initializeSocket();
     void bindAddress(int port);
     void listenToClients(int maxNumOfClients);
     Client* acceptClient(uint timeout);
-    void subscribe(const server_observer_t & observer);
+    pipe_ret_t runAcceptLoop();
+    void spawn(std::function<void()> task);
+    EventLoop::timer_id_t runAfter(uint64_t delayMs, const std::function<void()> & task);
+    EventLoop::timer_id_t runEvery(uint64_t intervalMs, const std::function<void()> & task);
+    void cancelTimer(EventLoop::timer_id_t timerId);
+    pipe_ret_t sendAfter(const Client & client, uint64_t delayMs, const std::string & payload);
+    pipe_ret_t sendAfter(connection_handle_t connection, uint64_t delayMs, const std::string & payload);
+    subscription_id_t subscribe(const server_observer_t & observer);
+    bool unsubscribe(subscription_id_t subscriptionId);
     pipe_ret_t sendToAllClients(const char * msg, size_t size);
-    pipe_ret_t sendToClient(const std::string & clientIP, const char * msg, size_t size);
+    std::vector<client_send_result_t> broadcast(const char * msg, size_t size, const std::function<void()> & onReleased = nullptr);
+    std::vector<client_send_result_t> broadcast(const shared_payload_t & payload);
+    pipe_ret_t sendToClient(connection_handle_t connection, const char * msg, size_t size, bool hasMore = false);
+    pipe_ret_t sendToClient(const std::string & clientIP, const char * msg, size_t size, bool hasMore = false);
+    pipe_ret_t sendFileToClient(connection_handle_t connection, const std::string & filePath);
     pipe_ret_t close();
     void printClients();
-    int numClientsConnected; //used to increment number of clients server is connected to 
+    std::atomic<int> numClientsConnected; //clients connected to the server, changed by the accept path and the I/O loops
     std::vector<int> numbers; //used to ensure unique num across day for each client 
     std::map<std::string, Client*> myMap;
     void sort(std::vector<Client*> _clients);
     int generateNumber(int number);
     std::vector<Client*> _clients;
     void sortList(int ID, std::string clientFileName);
-    static pipe_ret_t sendToClient(const Client & client, const char * msg, size_t size);
+    static pipe_ret_t sendToClient(const Client & client, const char * msg, size_t size, bool hasMore = false);
+    static pipe_ret_t sendFileToClient(const Client & client, const std::string & filePath);
 };
 
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+#include "ring_buffer.h"
+
+/*
+ * Fixed set of worker threads, each with its own bounded task queues.
+ * Tasks submitted with the same key always run on the same worker, in
+ * submission order, so per client ordering is kept while different
+ * clients are handled concurrently.
+ *
+ * Every worker has one lock free single producer lane per producer thread
+ * (e.g. per I/O loop) and a shared multi producer lane for any other thread.
+ * A worker takes its tasks in batches and only sleeps once all its lanes are
+ * empty, so a busy worker is handed tasks without any lock or notification.
+ * submit() never blocks: once a lane is full, tasks for that worker go to its
+ * overflow list until the worker emptied its lanes and took the list.
+ */
+class ThreadPool {
+
+public:
+    using task_t = std::function<void()>;
+
+    // submit() from a thread that is not one of the numOfProducers producers
+    static const size_t ANY_PRODUCER = static_cast<size_t>(-1);
+
+private:
+    struct worker_t {
+        std::vector<SpscRing<task_t>*> lanes; // one per producer
+        MpscRing<task_t> sharedLane;
+        std::mutex overflowMtx;
+        std::vector<task_t> overflowTasks; // under overflowMtx
+        std::atomic<bool> hasOverflowTasks;
+        std::atomic<bool> isSleeping;
+        std::mutex sleepMtx;
+        std::condition_variable wakeupCv;
+        std::thread * thread = nullptr;
+
+        worker_t(size_t numOfProducers, size_t queueCapacity);
+        ~worker_t();
+        bool lanesEmpty() const;
+        bool hasTasks() const;
+    };
+
+    std::vector<worker_t*> _workers;
+    std::atomic<bool> _running;
+    std::atomic<bool> _stopWorkers;
+    std::atomic<size_t> _numOfSubmittingThreads;
+
+    void workerTask(worker_t * worker);
+    size_t runOverflowTasks(worker_t * worker);
+    bool waitForTasks(worker_t * worker);
+    void wakeup(worker_t * worker);
+
+public:
+    ThreadPool(size_t numOfThreads, size_t queueCapacity, size_t numOfProducers = 0);
+    ~ThreadPool();
+
+    void start();
+    void stop();
+    bool pinToCpus(const std::vector<int> & cpus);
+    std::vector<int> cpusOf(size_t workerIndex) const;
+    bool submit(size_t key, task_t task, size_t producer = ANY_PRODUCER);
+    bool isWorkerThread() const;
+    size_t size() const { return _workers.size(); }
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+/*
+ * Hierarchical timer wheel (four levels of 256, 64, 64 and 64 slots). Scheduling
+ * and cancelling are O(1); timers far in the future sit in the upper levels and
+ * are cascaded down as the wheel turns. Delays are rounded up to the tick, and
+ * delays beyond the wheel's range (about 7.7 days at 10ms ticks) are clamped.
+ * Not thread safe: EventLoop drives it from its loop thread.
+ */
+class TimerWheel {
+
+public:
+    using task_t = std::function<void()>;
+    using timer_id_t = uint64_t;
+
+private:
+    struct timer_node_t {
+        timer_id_t id;
+        uint64_t expiryTick;
+        uint64_t intervalTicks; // 0 for one shot timers
+        task_t task;
+        bool isCancelled = false;
+        timer_node_t * prev = nullptr;
+        timer_node_t * next = nullptr;
+        timer_node_t ** slot = nullptr;
+    };
+
+    static const int ROOT_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const int NUM_OF_LEVELS = 4;
+    static const uint64_t ROOT_SIZE = 1u << ROOT_BITS;
+    static const uint64_t LEVEL_SIZE = 1u << LEVEL_BITS;
+
+    const uint64_t _tickMs;
+    const uint64_t _startMs;
+    uint64_t _nextTick = 0; // next tick to be processed
+
+    timer_node_t * _rootSlots[ROOT_SIZE];
+    timer_node_t * _levelSlots[NUM_OF_LEVELS - 1][LEVEL_SIZE];
+    uint64_t _rootOccupancy[ROOT_SIZE / 64]; // bit per non empty root slot
+
+    std::unordered_map<timer_id_t, timer_node_t*> _timers;
+    timer_node_t * _runningTimer = nullptr;
+
+    uint64_t tickAt(uint64_t timeMs) const;
+    void link(timer_node_t * timer);
+    void unlink(timer_node_t * timer);
+    void cascade(int level, uint64_t slotIndex);
+    void processTick();
+    uint64_t nextRootTick() const;
+
+public:
+    explicit TimerWheel(uint64_t tickMs = 10);
+    ~TimerWheel();
+
+    void schedule(timer_id_t id, uint64_t delayMs, uint64_t intervalMs, const task_t & task);
+    bool cancel(timer_id_t id);
+    void advance();
+    int timeoutMs() const;
+    bool empty() const { return _timers.empty(); }
+    size_t size() const { return _timers.size(); }
+
+    static uint64_t nowMs();
+};
@@ -0,0 +1,115 @@
+#include <utility>
+
+#include "../include/buffer_pool.h"
+
+const size_t BufferPool::NUM_OF_SIZE_CLASSES;
+const size_t BufferPool::MIN_BUFFER_SIZE;
+const size_t BufferPool::MAX_BUFFER_SIZE;
+const size_t BufferPool::MAX_FREE_BUFFERS_PER_CLASS;
+const size_t AdaptiveReadSize::SHRINK_AFTER_SMALL_READS;
+
+PooledBuffer::PooledBuffer(PooledBuffer && other) :
+    _pool{other._pool}, _data{other._data}, _sizeClass{other._sizeClass} {
+    other._pool = nullptr;
+    other._data = nullptr;
+}
+
+PooledBuffer & PooledBuffer::operator=(PooledBuffer && other) {
+    if (this != &other) {
+        release();
+        std::swap(_pool, other._pool);
+        std::swap(_data, other._data);
+        std::swap(_sizeClass, other._sizeClass);
+    }
+    return *this;
+}
+
+size_t PooledBuffer::capacity() const {
+    return _data ? BufferPool::sizeOfClass(_sizeClass) : 0;
+}
+
+void PooledBuffer::release() {
+    if (_data) {
+        _pool->giveBack(_data, _sizeClass);
+        _data = nullptr;
+        _pool = nullptr;
+    }
+}
+
+BufferPool::BufferPool() : _freeBuffers(NUM_OF_SIZE_CLASSES) {
+    for (std::vector<char*> & freeBuffers : _freeBuffers) {
+        freeBuffers.reserve(MAX_FREE_BUFFERS_PER_CLASS);
+    }
+}
+
+BufferPool::~BufferPool() {
+    for (const std::vector<char*> & freeBuffers : _freeBuffers) {
+        for (char * buffer : freeBuffers) {
+            delete[] buffer;
+        }
+    }
+}
+
+/*
+ * Pool of the threads without one of their own (TcpClient receive threads)
+ */
+BufferPool & BufferPool::shared() {
+    static BufferPool pool;
+    return pool;
+}
+
+// smallest class holding size bytes, the largest class for anything bigger
+size_t BufferPool::sizeClassFor(size_t size) {
+    size_t sizeClass = 0;
+    while (sizeClass + 1 < NUM_OF_SIZE_CLASSES && sizeOfClass(sizeClass) < size) {
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+/*
+ * Take a buffer of at least size bytes (of MAX_BUFFER_SIZE at most).
+ * It returns to the pool when the PooledBuffer is destroyed or released.
+ */
+PooledBuffer BufferPool::acquire(size_t size) {
+    const size_t sizeClass = sizeClassFor(size);
+    {
+        std::lock_guard<std::mutex> lock(_freeBuffersMtx);
+        std::vector<char*> & freeBuffers = _freeBuffers[sizeClass];
+        if (!freeBuffers.empty()) {
+            char * buffer = freeBuffers.back();
+            freeBuffers.pop_back();
+            return PooledBuffer(this, buffer, sizeClass);
+        }
+    }
+    return PooledBuffer(this, new char[sizeOfClass(sizeClass)], sizeClass);
+}
+
+void BufferPool::giveBack(char * data, size_t sizeClass) {
+    {
+        std::lock_guard<std::mutex> lock(_freeBuffersMtx);
+        std::vector<char*> & freeBuffers = _freeBuffers[sizeClass];
+        if (freeBuffers.size() < MAX_FREE_BUFFERS_PER_CLASS) {
+            freeBuffers.push_back(data);
+            return;
+        }
+    }
+    delete[] data;
+}
+
+void AdaptiveReadSize::update(size_t numOfBytesRead) {
+    const size_t currentSize = size();
+    if (numOfBytesRead >= currentSize) {
+        if (_sizeClass + 1 < BufferPool::NUM_OF_SIZE_CLASSES) {
+            _sizeClass++;
+        }
+        _numOfSmallReads = 0;
+    } else if (numOfBytesRead < currentSize / 4) {
+        if (++_numOfSmallReads >= SHRINK_AFTER_SMALL_READS && _sizeClass > 0) {
+            _sizeClass--;
+            _numOfSmallReads = 0;
+        }
+    } else {
+        _numOfSmallReads = 0;
+    }
+}
@@ -2,16 +2,26 @@
 #include <cstring>
 #include <cerrno>
 #include <unistd.h>
+#include <fcntl.h>
 #include <stdexcept>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <iostream>
 
 #include "../include/client.h"
 #include "../include/common.h"
+#ifdef IO_URING_BACKEND
+#include "../include/io_uring_loop.h"
+#endif
 
 Client::Client(int fileDescriptor) {
     _sockfd.set(fileDescriptor);
     setConnected(false);
+    _isListening = false;
+    _idleTimerId = 0;
+    _lastActivityMs = 0;
+    _isIdleTimedOut = false;
+    _sendError = 0;
 }
 
 bool Client::operator==(const Client & other) const {
@@ -22,62 +32,382 @@ bool Client::operator==(const Client & other) const {
     return false;
 }
 
+/*
+ * Register the client socket with its event loop. Incoming packets are read
+ * on the loop thread whenever the socket becomes readable.
+ */
 void Client::startListen() {
+#ifdef IO_URING_BACKEND
+    if (_ioUringLoop) {
+        setConnected(true);
+        _isListening = true;
+        startIdleTimer();
+        _ioUringLoop->startReceiving(_sockfd.get(), [this](const char * data, ssize_t size) {
+            handleReceived(data, size);
+        });
+        return;
+    }
+#endif
+    if (!_eventLoop) {
+        throw std::runtime_error("client has no event loop");
+    }
+    const int flags = fcntl(_sockfd.get(), F_GETFL, 0);
+    fcntl(_sockfd.get(), F_SETFL, flags | O_NONBLOCK);
+
+    if (_zeroCopyThreshold > 0) {
+        // without SO_ZEROCOPY the kernel ignores MSG_ZEROCOPY, and no completion would release the payloads
+        const int enable = 1;
+        if (setsockopt(_sockfd.get(), SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == -1) {
+            _zeroCopyThreshold = 0;
+        }
+        std::lock_guard<std::mutex> lock(_outboundMtx);
+        _outboundQueue.setZeroCopyThreshold(_zeroCopyThreshold);
+    }
+
     setConnected(true);
-    _receiveThread = new std::thread(&Client::receiveTask, this);
+    _isListening = true;
+    startIdleTimer();
+    _eventLoop->add(_sockfd.get(), EPOLLIN | EPOLLRDHUP, [this](uint32_t events) { handleEvents(events); },
+                    [this](const pipe_ret_t & failure) { disconnect(failure.message()); });
 }
 
-void Client::send(const char *msg, size_t msgSize) const {
-    const size_t numBytesSent = ::send(_sockfd.get(), (char *)msg, msgSize, 0);
+/*
+ * Send msg without blocking. Whatever the socket does not take right away is
+ * queued and flushed by the event loop, in order, once the socket is writable.
+ * With coalesced sends every message is queued, and the loop flushes all messages
+ * of the client with one sendmsg() per iteration. hasMore holds msg back until
+ * a send without it (the end of a burst), and the burst goes out with MSG_MORE
+ * so it is packed into full segments.
+ * When the queue grows past the high watermark a SEND_PAUSED event is published,
+ * and SEND_RESUMED once it drained to the low watermark; sends are never refused.
+ * Throws when the connection failed.
+ */
+void Client::send(const char *msg, size_t msgSize, bool hasMore) const {
+#ifdef IO_URING_BACKEND
+    if (_ioUringLoop) {
+        _ioUringLoop->send(_sockfd.get(), msg, msgSize);
+        return;
+    }
+#endif
+    std::lock_guard<std::mutex> lock(_outboundMtx);
 
-    const bool sendFailed = (numBytesSent < 0);
-    if (sendFailed) {
-        throw std::runtime_error(strerror(errno));
+    const bool sendNow = canSendNow(hasMore);
+    const size_t numBytesSent = sendNow ? sendDirectly(msg, msgSize) : 0;
+    if (numBytesSent == msgSize) {
+        return;
     }
+    _outboundQueue.append(msg + numBytesSent, msgSize - numBytesSent);
+    handleQueued(hasMore, sendNow);
+}
 
-    const bool notAllBytesWereSent = (numBytesSent < msgSize);
-    if (notAllBytesWereSent) {
-        char errorMsg[100];
-        sprintf(errorMsg, "Only %lu bytes out of %lu was sent to client", numBytesSent, msgSize);
-        throw std::runtime_error(errorMsg);
+/*
+ * Like send(), but queues a reference to payload instead of a copy, so one
+ * payload can be queued on many clients (broadcasts). Large payloads go out
+ * with MSG_ZEROCOPY when the client has a zero copy threshold.
+ */
+void Client::send(const shared_payload_t & payload, bool hasMore) const {
+#ifdef IO_URING_BACKEND
+    if (_ioUringLoop) {
+        _ioUringLoop->send(_sockfd.get(), payload->data(), payload->size());
+        return;
+    }
+#endif
+    std::lock_guard<std::mutex> lock(_outboundMtx);
+
+    const bool isZeroCopy = (_zeroCopyThreshold > 0 && payload->size() >= _zeroCopyThreshold);
+    const bool sendNow = canSendNow(hasMore) && !isZeroCopy; // zero copy sends are made by the flush
+    const size_t numBytesSent = sendNow ? sendDirectly(payload->data(), payload->size()) : 0;
+    if (numBytesSent == payload->size()) {
+        return;
+    }
+    _outboundQueue.append(payload, numBytesSent);
+    handleQueued(hasMore, sendNow);
+}
+
+/*
+ * Send msg as one message of the client's framing: header, msg and trailer are
+ * queued together, so messages sent concurrently never interleave. Without a
+ * framing this is send(). Throws when msg can not be framed or the connection failed.
+ */
+void Client::sendMessage(const char * msg, size_t msgSize, bool hasMore) const {
+    if (!_framing) {
+        send(msg, msgSize, hasMore);
+        return;
+    }
+    if (!_framing->canFrame(msgSize)) {
+        throw std::runtime_error("message does not fit the framing of the connection");
+    }
+    const std::string header = _framing->header(msgSize);
+    const std::string trailer = _framing->trailer();
+#ifdef IO_URING_BACKEND
+    if (_ioUringLoop) {
+        const std::string framedMsg = header + std::string(msg, msgSize) + trailer;
+        _ioUringLoop->send(_sockfd.get(), framedMsg.data(), framedMsg.size());
+        return;
+    }
+#endif
+    std::lock_guard<std::mutex> lock(_outboundMtx);
+    _outboundQueue.append(header.data(), header.size());
+    _outboundQueue.append(msg, msgSize);
+    _outboundQueue.append(trailer.data(), trailer.size());
+    handleQueued(hasMore, false);
+}
+
+/*
+ * Queue size bytes of file, from offset on, as one message of the client's
+ * framing. The event loop streams them with sendfile(), so they never pass
+ * through user space, after anything queued before them.
+ * Throws when the range can not be framed, or read (io_uring backend only). A file
+ * shrinking before its range is sent disconnects the client.
+ */
+void Client::sendFile(const shared_file_t & file, size_t offset, size_t size) const {
+    if (_framing && !_framing->canFrame(size)) {
+        throw std::runtime_error("file does not fit the framing of the connection");
     }
+    const std::string header = _framing ? _framing->header(size) : "";
+    const std::string trailer = _framing ? _framing->trailer() : "";
+#ifdef IO_URING_BACKEND
+    if (_ioUringLoop) { // the ring has no file sends yet, read the range and queue a copy
+        std::string content(size, '\0');
+        const ssize_t numOfBytesRead = ::pread(file->get(), &content[0], size, offset);
+        if (numOfBytesRead == -1) {
+            throw std::runtime_error(strerror(errno));
+        }
+        if (static_cast<size_t>(numOfBytesRead) != size) { // the header promised size bytes
+            throw std::runtime_error("file is shorter than the range to send");
+        }
+        const std::string framedContent = header + content + trailer;
+        _ioUringLoop->send(_sockfd.get(), framedContent.data(), framedContent.size());
+        return;
+    }
+#endif
+    std::lock_guard<std::mutex> lock(_outboundMtx);
+    _outboundQueue.append(header.data(), header.size());
+    _outboundQueue.appendFile(file, offset, size);
+    _outboundQueue.append(trailer.data(), trailer.size());
+    handleQueued(false, false);
 }
 
 /*
- * Receive client packets, and notify user
+ * Whether a message may skip the queue. Called with _outboundMtx held.
  */
-void Client::receiveTask() {
-    while(isConnected()) {
-        const fd_wait::Result waitResult = fd_wait::waitFor(_sockfd);
+bool Client::canSendNow(bool hasMore) const {
+    return !_coalesceSends && !hasMore && !_isBurstOpen && _outboundQueue.empty();
+}
 
-        if (waitResult == fd_wait::Result::FAILURE) {
+/*
+ * One non blocking send. Returns how many bytes the socket took, throws on failure
+ */
+size_t Client::sendDirectly(const char * msg, size_t msgSize) const {
+    while (true) {
+        const ssize_t sendResult = ::send(_sockfd.get(), msg, msgSize, MSG_NOSIGNAL);
+        if (sendResult >= 0) {
+            return sendResult;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        if (errno != EINTR) {
             throw std::runtime_error(strerror(errno));
-        } else if (waitResult == fd_wait::Result::TIMEOUT) {
-            continue;
         }
+    }
+}
 
-        char receivedMessage[MAX_PACKET_SIZE];
-        const size_t numOfBytesReceived = recv(_sockfd.get(), receivedMessage, MAX_PACKET_SIZE, 0);
+/*
+ * Get queued bytes on their way, and tell producers to pause when the queue
+ * passed the high watermark. Called with _outboundMtx held.
+ */
+void Client::handleQueued(bool hasMore, bool triedSendNow) const {
+    _isBurstOpen = hasMore;
+    if (hasMore) {
+        // held back until the burst ends
+    } else if (triedSendNow) {
+        waitForWritable(true); // the socket is full, the rest goes out when it drains
+    } else if (_coalesceSends) {
+        scheduleFlush();
+    } else if (!_isWaitingForWritable) {
+        flushOutbound();
+    }
 
-        if(numOfBytesReceived < 1) {
-            const bool clientClosedConnection = (numOfBytesReceived == 0);
-            std::string disconnectionMessage;
-            if (clientClosedConnection) {
-                disconnectionMessage = "Client closed connection";
-            } else {
-                disconnectionMessage = strerror(errno);
+    // flushOutbound() above may have drained a paused queue again, which must be
+    // published as well or the producers stay paused
+    const WatermarkCrossing watermarkCrossing = _outboundQueue.checkWatermarks();
+    if (watermarkCrossing != WatermarkCrossing::NONE) {
+        const ClientEvent clientEvent = (watermarkCrossing == WatermarkCrossing::ABOVE_HIGH) ?
+                                        ClientEvent::SEND_PAUSED : ClientEvent::SEND_RESUMED;
+        // client events are published from the loop thread, in order with the rest
+        _eventLoop->queueInLoop([this, clientEvent]() {
+            if (_isListening) {
+                publishEvent(clientEvent);
             }
-            setConnected(false);
-            publishEvent(ClientEvent::DISCONNECTED, disconnectionMessage);
-            return;
+        });
+    }
+}
+
+/*
+ * Queue one flush of the outbound queue on the loop, after the handlers of the
+ * current iteration, unless one is queued already or EPOLLOUT will trigger it.
+ * Called with _outboundMtx held.
+ */
+void Client::scheduleFlush() const {
+    if (_isFlushScheduled || _isWaitingForWritable) {
+        return;
+    }
+    _isFlushScheduled = true;
+    _eventLoop->queueInLoop([this]() {
+        WatermarkCrossing watermarkCrossing;
+        {
+            std::lock_guard<std::mutex> lock(_outboundMtx);
+            _isFlushScheduled = false;
+            flushOutbound();
+            watermarkCrossing = _outboundQueue.checkWatermarks();
+        }
+        if (watermarkCrossing == WatermarkCrossing::BELOW_LOW) {
+            publishEvent(ClientEvent::SEND_RESUMED);
+        }
+    });
+}
+
+/*
+ * Send what the socket takes, and wait for EPOLLOUT for the rest. Queued bytes
+ * are dropped on failure, which leaves the peer out of sync with the stream
+ * (a file may also have shrunk under its send), so the socket is shut down and
+ * the read side reports the disconnection. Called with _outboundMtx held.
+ */
+void Client::flushOutbound() const {
+    const int sendError = _outboundQueue.flush(_sockfd.get(), _isBurstOpen);
+    if (sendError != 0) {
+        _outboundQueue.clear();
+        _sendError = sendError;
+        ::shutdown(_sockfd.get(), SHUT_RDWR);
+    }
+    waitForWritable(!_outboundQueue.empty());
+}
+
+/*
+ * Add or drop EPOLLOUT. Called with _outboundMtx held.
+ */
+void Client::waitForWritable(bool enable) const {
+    if (_isWaitingForWritable == enable || !_eventLoop) {
+        return;
+    }
+    _isWaitingForWritable = enable;
+    uint32_t events = EPOLLIN | EPOLLRDHUP;
+    if (enable) {
+        events |= EPOLLOUT;
+    }
+    _eventLoop->modify(_sockfd.get(), events);
+}
+
+void Client::setOutboundWatermarks(size_t highWatermark, size_t lowWatermark) {
+    std::lock_guard<std::mutex> lock(_outboundMtx);
+    _outboundQueue.setWatermarks(highWatermark, lowWatermark);
+}
+
+bool Client::isSendPaused() const {
+    std::lock_guard<std::mutex> lock(_outboundMtx);
+    return _outboundQueue.isAboveHighWatermark();
+}
+
+size_t Client::numOfQueuedBytes() const {
+    std::lock_guard<std::mutex> lock(_outboundMtx);
+    return _outboundQueue.size();
+}
+
+/*
+ * Dispatch epoll events of the client socket. Called on the event loop thread.
+ */
+void Client::handleEvents(uint32_t events) {
+    if ((events & EPOLLERR) && _zeroCopyThreshold > 0) {
+        std::lock_guard<std::mutex> lock(_outboundMtx);
+        _outboundQueue.reapZeroCopyCompletions(_sockfd.get());
+    }
+    if (events & EPOLLOUT) {
+        handleWritable();
+    }
+    if (events & ~EPOLLOUT) {
+        handleReadable();
+    }
+}
+
+void Client::handleWritable() {
+    WatermarkCrossing watermarkCrossing;
+    {
+        std::lock_guard<std::mutex> lock(_outboundMtx);
+        flushOutbound();
+        watermarkCrossing = _outboundQueue.checkWatermarks();
+    }
+    if (watermarkCrossing == WatermarkCrossing::BELOW_LOW) {
+        publishEvent(ClientEvent::SEND_RESUMED);
+    }
+}
+
+/*
+ * Receive client packets, and notify user. Called on the event loop thread.
+ * Reads into a buffer of the event loop's pool, sized to what the client has
+ * been sending lately, and hands it back once the data is published. Messages
+ * are published as views into it, so nothing is copied or allocated between
+ * the read and the observers, and an idle client holds no buffer.
+ */
+void Client::handleReadable() {
+    const PooledBuffer buffer = _eventLoop->bufferPool().acquire(_readSize.size());
+    const ssize_t numOfBytesReceived = recv(_sockfd.get(), buffer.data(), buffer.capacity(), 0);
+
+    if (numOfBytesReceived == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+    if (numOfBytesReceived > 0) {
+        _readSize.update(numOfBytesReceived);
+    }
+
+    handleReceived(buffer.data(), numOfBytesReceived == -1 ? -errno : numOfBytesReceived);
+}
+
+/*
+ * Handle the result of a receive: data, peer closed (0) or failure (-errno)
+ */
+void Client::handleReceived(const char * data, ssize_t numOfBytesReceived) {
+    if(numOfBytesReceived < 1) {
+        const bool clientClosedConnection = (numOfBytesReceived == 0);
+        std::string disconnectionMessage;
+        if (_isIdleTimedOut) {
+            disconnectionMessage = "Idle timeout";
+        } else if (_sendError == ENODATA) {
+            disconnectionMessage = "File shrank while sending";
+        } else if (_sendError != 0) {
+            disconnectionMessage = strerror(_sendError);
+        } else if (clientClosedConnection) {
+            disconnectionMessage = "Client closed connection";
         } else {
-            publishEvent(ClientEvent::INCOMING_MSG, receivedMessage);
+            disconnectionMessage = strerror(-numOfBytesReceived);
+        }
+        disconnect(disconnectionMessage);
+    } else {
+        if (_idleTimeoutMs > 0) {
+            _lastActivityMs = TimerWheel::nowMs();
+        }
+        // one event per complete message, however the stream was split into reads
+        const bool isValidStream = _reassembler.feed(data, numOfBytesReceived, [this](const char * msg, size_t msgSize) {
+            publishEvent(ClientEvent::INCOMING_MSG, msg, msgSize);
+        });
+        if (!isValidStream) {
+            ::shutdown(_sockfd.get(), SHUT_RDWR);
+            disconnect("Invalid frame");
         }
     }
 }
 
-void Client::publishEvent(ClientEvent clientEvent, const std::string &msg) {
-    _eventHandlerCallback(*this, clientEvent, msg);
+/*
+ * Stop serving the client and tell the server. Called on the thread receiving for it.
+ */
+void Client::disconnect(const std::string & reason) {
+    setConnected(false);
+    stopListen();
+    publishEvent(ClientEvent::DISCONNECTED, reason);
+}
+
+void Client::publishEvent(ClientEvent clientEvent, const char * data, size_t size) const {
+    _eventHandlerCallback(*this, clientEvent, data, size);
 }
 
 void Client::print() const {
@@ -88,17 +418,70 @@ void Client::print() const {
               "Socket FD: " << _sockfd.get() << std::endl;
 }
 
-void Client::terminateReceiveThread() {
-    // setConnected(false);
-    if (_receiveThread) {
-        _receiveThread->join();
-        delete _receiveThread;
-        _receiveThread = nullptr;
+/*
+ * Disconnect the client when nothing is received from it for the idle timeout.
+ * Activity only stamps a time; the single timer per client checks it when it
+ * fires and re-arms itself for the remaining time.
+ */
+void Client::startIdleTimer() {
+    if (_idleTimeoutMs == 0 || !idleTimerLoop()) {
+        return;
     }
+    _lastActivityMs = TimerWheel::nowMs();
+    _idleTimerId = idleTimerLoop()->runAfter(_idleTimeoutMs, [this]() { checkIdle(); });
+}
+
+/*
+ * Called on the idle timer's loop (idleTimerLoop()): the client's own event loop,
+ * or the server's timer loop for a client without one (io_uring backend)
+ */
+void Client::checkIdle() {
+    if (!_isListening) {
+        return;
+    }
+    const uint64_t idleMs = TimerWheel::nowMs() - _lastActivityMs;
+    if (idleMs < _idleTimeoutMs) {
+        _idleTimerId = idleTimerLoop()->runAfter(_idleTimeoutMs - idleMs, [this]() { checkIdle(); });
+        return;
+    }
+    // let the receive path see the disconnection and clean up as for any other
+    _isIdleTimedOut = true;
+    ::shutdown(_sockfd.get(), SHUT_RDWR);
+}
+
+/*
+ * Waits for the idle timer's loop, so once this returns the idle timer will not touch the client anymore
+ */
+void Client::stopIdleTimer() {
+    if (_idleTimeoutMs == 0 || !idleTimerLoop()) {
+        return;
+    }
+    EventLoop * timerLoop = idleTimerLoop();
+    timerLoop->runInLoopAndWait([this, timerLoop]() {
+        timerLoop->cancelTimer(_idleTimerId.exchange(0));
+    });
+}
+
+void Client::stopListen() {
+    if (!_isListening.exchange(false)) {
+        return;
+    }
+    stopIdleTimer();
+#ifdef IO_URING_BACKEND
+    if (_ioUringLoop) {
+        _ioUringLoop->stopReceiving(_sockfd.get());
+        return;
+    }
+#endif
+    _eventLoop->remove(_sockfd.get());
 }
 
 void Client::close() {
-    terminateReceiveThread();
+    stopListen();
+    if (_eventLoop) {
+        // let flushes and events already queued for this client run before it goes away
+        _eventLoop->runInLoopAndWait([]() {});
+    }
 
     const bool closeFailed = (::close(_sockfd.get()) == -1);
     if (closeFailed) {
@@ -3,6 +3,7 @@
 #include "../include/common.h"
 
 #include <sys/select.h>
+#include <poll.h>
 
 #define SELECT_FAILED -1
 #define SELECT_TIMEOUT 0
@@ -28,5 +29,28 @@ namespace fd_wait {
         }
         return Result::SUCCESS;
     }
-}
 
+    /**
+     * monitor file descriptor and a wakeup descriptor (eventfd or pipe read end).
+     * Returns WAKEUP as soon as the wakeup descriptor is readable, so another thread
+     * can interrupt the wait immediately instead of waiting for a timeout
+     */
+    Result waitFor(const FileDescriptor &fileDescriptor, const FileDescriptor &wakeupFileDescriptor, int timeoutMs) {
+        struct pollfd fds[2];
+        fds[0].fd = fileDescriptor.get();
+        fds[0].events = POLLIN;
+        fds[1].fd = wakeupFileDescriptor.get();
+        fds[1].events = POLLIN;
+
+        const int pollRet = poll(fds, 2, timeoutMs);
+
+        if (pollRet == -1) {
+            return Result::FAILURE;
+        } else if (pollRet == 0) {
+            return Result::TIMEOUT;
+        } else if (fds[1].revents != 0) {
+            return Result::WAKEUP;
+        }
+        return Result::SUCCESS;
+    }
+}
@@ -0,0 +1,278 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../include/coro.h"
+
+namespace coro {
+
+namespace {
+
+    struct detached_t {
+        struct promise_type {
+            detached_t get_return_object() const noexcept { return {}; }
+            std::suspend_never initial_suspend() const noexcept { return {}; }
+            std::suspend_never final_suspend() const noexcept { return {}; }
+            void return_void() const noexcept {}
+            void unhandled_exception() const noexcept { std::terminate(); }
+        };
+    };
+
+    detached_t runDetached(Task<void> task) {
+        try {
+            co_await task;
+        } catch (const std::exception & error) {
+            fprintf(stderr, "coroutine failed: %s\n", error.what());
+        } catch (...) {
+            fprintf(stderr, "coroutine failed\n");
+        }
+    }
+
+    EventLoop & currentLoop() {
+        EventLoop * loop = EventLoop::current();
+        if (!loop) {
+            throw std::runtime_error("coroutine is not running on an event loop");
+        }
+        return *loop;
+    }
+
+    std::string peerIp(int sockfd) {
+        struct sockaddr_in address;
+        socklen_t addressSize = sizeof(address);
+        char ip[INET_ADDRSTRLEN] = "";
+        if (getpeername(sockfd, (struct sockaddr*)&address, &addressSize) == 0) {
+            inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip));
+        }
+        return ip;
+    }
+}
+
+void spawn(EventLoop & loop, Task<void> task) {
+    // std::function needs a copyable callable, so hand the task over through a shared_ptr
+    std::shared_ptr<Task<void>> sharedTask = std::make_shared<Task<void>>(std::move(task));
+    loop.runInLoop([sharedTask]() { runDetached(std::move(*sharedTask)); });
+}
+
+void sleep_for::await_suspend(std::coroutine_handle<> awaiting) const {
+    currentLoop().runAfter(_delayMs, [awaiting]() { awaiting.resume(); });
+}
+
+/*
+ * Registered once, edge triggered, for both directions. A coroutine only waits
+ * after its syscall returned EAGAIN, so the next edge always wakes it.
+ */
+struct Connection::state_t {
+    EventLoop & loop;
+    int sockfd;
+    std::string ip;
+    std::coroutine_handle<> reader;
+    std::coroutine_handle<> writer;
+
+    state_t(EventLoop & eventLoop, int fd) : loop(eventLoop), sockfd{fd} {}
+
+    void handleEvents(uint32_t events) {
+        const uint32_t failureEvents = EPOLLHUP | EPOLLERR;
+        if (reader && (events & (EPOLLIN | EPOLLRDHUP | failureEvents))) {
+            std::exchange(reader, nullptr).resume();
+        }
+        if (writer && (events & (EPOLLOUT | failureEvents))) {
+            std::exchange(writer, nullptr).resume();
+        }
+    }
+};
+
+class Connection::readiness_awaiter_t {
+private:
+    std::coroutine_handle<> & _waiter;
+
+public:
+    explicit readiness_awaiter_t(std::coroutine_handle<> & waiter) : _waiter(waiter) {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> awaiting) {
+        if (_waiter) {
+            throw std::runtime_error("another coroutine is already waiting on this connection");
+        }
+        _waiter = awaiting;
+    }
+    void await_resume() const noexcept {}
+};
+
+Connection::Connection(EventLoop & loop, int sockfd) :
+    _state{std::make_shared<state_t>(loop, sockfd)}
+{
+    const int flags = fcntl(sockfd, F_GETFL, 0);
+    fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+    _state->ip = peerIp(sockfd);
+
+    std::shared_ptr<state_t> state = _state;
+    loop.add(sockfd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, [state](uint32_t events) {
+        state->handleEvents(events);
+    });
+}
+
+Connection & Connection::operator=(Connection && other) noexcept {
+    if (this != &other) {
+        close();
+        _state = std::move(other._state);
+    }
+    return *this;
+}
+
+Connection::~Connection() {
+    close();
+}
+
+/*
+ * Unregister and close the socket. A coroutine still waiting on it is never resumed.
+ */
+void Connection::close() {
+    if (!_state) {
+        return;
+    }
+    _state->loop.remove(_state->sockfd);
+    ::close(_state->sockfd);
+    _state.reset();
+}
+
+int Connection::fd() const {
+    return _state ? _state->sockfd : -1;
+}
+
+std::string Connection::ip() const {
+    return _state ? _state->ip : "";
+}
+
+Connection::readiness_awaiter_t Connection::readable() {
+    return readiness_awaiter_t(_state->reader);
+}
+
+Connection::readiness_awaiter_t Connection::writable() {
+    return readiness_awaiter_t(_state->writer);
+}
+
+Task<std::string> Connection::read(size_t maxSize) {
+    if (!_state) {
+        throw std::runtime_error("connection is closed");
+    }
+    std::string data(maxSize, '\0');
+    while (true) {
+        const ssize_t numOfBytesReceived = ::recv(_state->sockfd, &data[0], maxSize, 0);
+        if (numOfBytesReceived >= 0) {
+            data.resize(numOfBytesReceived);
+            co_return data;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            co_await readable();
+        } else if (errno != EINTR) {
+            throw std::runtime_error(strerror(errno));
+        }
+    }
+}
+
+Task<void> Connection::write(const char * data, size_t size) {
+    if (!_state) {
+        throw std::runtime_error("connection is closed");
+    }
+    size_t numOfBytesSent = 0;
+    while (numOfBytesSent < size) {
+        const ssize_t sendResult = ::send(_state->sockfd, data + numOfBytesSent, size - numOfBytesSent, MSG_NOSIGNAL);
+        if (sendResult >= 0) {
+            numOfBytesSent += sendResult;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            co_await writable();
+        } else if (errno != EINTR) {
+            throw std::runtime_error(strerror(errno));
+        }
+    }
+}
+
+Task<void> Connection::write(std::string data) {
+    co_await write(data.data(), data.size());
+}
+
+pipe_ret_t Server::listen(int port, int maxNumOfClients) {
+    const int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd == -1) {
+        return pipe_ret_t::failure(strerror(errno));
+    }
+    const int option = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+
+    struct sockaddr_in serverAddress;
+    memset(&serverAddress, 0, sizeof(serverAddress));
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+    serverAddress.sin_port = htons(port);
+
+    if (bind(sockfd, (struct sockaddr *)&serverAddress, sizeof(serverAddress)) == -1 ||
+        ::listen(sockfd, maxNumOfClients) == -1) {
+        const std::string errorMsg = strerror(errno);
+        ::close(sockfd);
+        return pipe_ret_t::failure(errorMsg);
+    }
+    _listener = Connection(_loop, sockfd);
+    return pipe_ret_t::success();
+}
+
+Task<Connection> Server::accept() {
+    if (!_listener.isOpen()) {
+        throw std::runtime_error("server is not listening");
+    }
+    while (true) {
+        const int sockfd = accept4(_listener.fd(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sockfd != -1) {
+            co_return Connection(_loop, sockfd);
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            co_await _listener.readable();
+        } else if (errno != EINTR && errno != ECONNABORTED) {
+            throw std::runtime_error(strerror(errno));
+        }
+    }
+}
+
+Task<Connection> connect(std::string host, int port) {
+    EventLoop & loop = currentLoop();
+    struct sockaddr_in serverAddress;
+    memset(&serverAddress, 0, sizeof(serverAddress));
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &serverAddress.sin_addr) != 1) {
+        throw std::runtime_error("invalid address: " + host);
+    }
+
+    const int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd == -1) {
+        throw std::runtime_error(strerror(errno));
+    }
+    const int connectResult = ::connect(sockfd, (struct sockaddr *)&serverAddress, sizeof(serverAddress));
+    if (connectResult == -1 && errno != EINPROGRESS) {
+        const std::string errorMsg = strerror(errno);
+        ::close(sockfd);
+        throw std::runtime_error(errorMsg);
+    }
+
+    Connection connection(loop, sockfd);
+    if (connectResult == -1) {
+        co_await connection.writable();
+        int connectError = 0;
+        socklen_t connectErrorSize = sizeof(connectError);
+        getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &connectError, &connectErrorSize);
+        if (connectError != 0) {
+            throw std::runtime_error(strerror(connectError));
+        }
+        connection._state->ip = peerIp(sockfd);
+    }
+    co_return connection;
+}
+
+}
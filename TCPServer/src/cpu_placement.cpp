@@ -0,0 +1,103 @@
+#include <set>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <sched.h>
+#include "../include/cpu_placement.h"
+
+namespace cpu_placement {
+    /**
+     * restrict thread to the given cpus. An empty set leaves the thread unpinned.
+     * Returns false, leaving the thread as it was, when a cpu does not fit a
+     * cpu_set_t or the kernel refused the mask
+     */
+    bool pinThread(pthread_t thread, const std::vector<int> & cpus) {
+        if (cpus.empty()) {
+            return true;
+        }
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        for (int cpu : cpus) {
+            if (cpu < 0 || cpu >= CPU_SETSIZE) {
+                return false;
+            }
+            CPU_SET(cpu, &cpuSet);
+        }
+        return pthread_setaffinity_np(thread, sizeof(cpuSet), &cpuSet) == 0;
+    }
+
+    /**
+     * cpus the kernel lets thread run on, in order. Empty when it can not be read
+     */
+    std::vector<int> affinityOf(pthread_t thread) {
+        std::vector<int> cpus;
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        if (pthread_getaffinity_np(thread, sizeof(cpuSet), &cpuSet) != 0) {
+            return cpus;
+        }
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &cpuSet)) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    /**
+     * NUMA node of cpu: sysfs links every cpu to its node as cpu<N>/node<M>.
+     * Returns -1 when the kernel does not expose it
+     */
+    int numaNodeOf(int cpu) {
+        const std::string cpuDirPath = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        DIR * cpuDir = opendir(cpuDirPath.c_str());
+        if (!cpuDir) {
+            return -1;
+        }
+        int node = -1;
+        while (struct dirent * entry = readdir(cpuDir)) {
+            if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+                node = atoi(entry->d_name + 4);
+                break;
+            }
+        }
+        closedir(cpuDir);
+        return node;
+    }
+
+    std::vector<int> numaNodesOf(const std::vector<int> & cpus) {
+        std::set<int> nodes;
+        for (int cpu : cpus) {
+            nodes.insert(numaNodeOf(cpu));
+        }
+        return std::vector<int>(nodes.begin(), nodes.end());
+    }
+
+    /**
+     * e.g. "cpus 0-3,6 (numa node 0)", or "any cpu" for an empty set. Runs of
+     * consecutive cpus, as in a thread's affinity, are shown as ranges
+     */
+    std::string describe(const std::vector<int> & cpus) {
+        if (cpus.empty()) {
+            return "any cpu";
+        }
+        std::string description = cpus.size() == 1 ? "cpu " : "cpus ";
+        for (size_t i = 0; i < cpus.size(); i++) {
+            size_t last = i;
+            while (last + 1 < cpus.size() && cpus[last + 1] == cpus[last] + 1) {
+                last++;
+            }
+            description += (i > 0 ? "," : "") + std::to_string(cpus[i]);
+            if (last > i) {
+                description += (last == i + 1 ? "," : "-") + std::to_string(cpus[last]);
+                i = last;
+            }
+        }
+        const std::vector<int> nodes = numaNodesOf(cpus);
+        description += nodes.size() == 1 ? " (numa node " : " (numa nodes ";
+        for (size_t i = 0; i < nodes.size(); i++) {
+            description += (i > 0 ? "," : "") + (nodes[i] == -1 ? std::string("?") : std::to_string(nodes[i]));
+        }
+        return description + ")";
+    }
+}
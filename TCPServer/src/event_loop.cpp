@@ -0,0 +1,369 @@
+#include <cstring>
+#include <cerrno>
+#include <future>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "../include/event_loop.h"
+#include "../include/cpu_placement.h"
+
+#define MAX_EVENTS_PER_WAIT 256
+#define PENDING_TASKS_CAPACITY 1024
+
+namespace {
+    thread_local EventLoop * currentLoop = nullptr;
+}
+
+EventLoop::EventLoop() :
+    _pendingTasks{PENDING_TASKS_CAPACITY}
+{
+    _running = false;
+    _isStopped = false;
+    _hasOverflowTasks = false;
+    _numOfQueueingThreads = 0;
+    _nextTimerId = 1; // 0 is never a valid timer id
+
+    _epollfd.set(epoll_create1(EPOLL_CLOEXEC));
+    if (_epollfd.get() == -1) {
+        throw std::runtime_error(strerror(errno));
+    }
+
+    _wakeupfd.set(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    if (_wakeupfd.get() == -1) {
+        ::close(_epollfd.get());
+        throw std::runtime_error(strerror(errno));
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = _wakeupfd.get();
+    epoll_ctl(_epollfd.get(), EPOLL_CTL_ADD, _wakeupfd.get(), &event);
+}
+
+EventLoop::~EventLoop() {
+    stop();
+    ::close(_wakeupfd.get());
+    ::close(_epollfd.get());
+}
+
+/*
+ * Start the loop thread. Events for registered descriptors are dispatched from it.
+ */
+void EventLoop::start() {
+    {
+        std::lock_guard<std::mutex> lock(_pendingTasksMtx);
+        if (_loopThread || _isStopped) {
+            return;
+        }
+        _running = true;
+    }
+    _loopThread = new std::thread(&EventLoop::loop, this);
+}
+
+/*
+ * Run the loop on the calling thread until stop() is called.
+ */
+void EventLoop::run() {
+    {
+        std::lock_guard<std::mutex> lock(_pendingTasksMtx);
+        if (_running || _isStopped) {
+            return;
+        }
+        _running = true;
+        _isLooping = true;
+    }
+    loop();
+    {
+        std::lock_guard<std::mutex> lock(_pendingTasksMtx);
+        _isLooping = false;
+    }
+    _loopExitedCv.notify_all();
+}
+
+/*
+ * Wake the loop thread, let it finish its current iteration and wait for it to exit.
+ * Tasks queued after this point run on the calling thread. A stopped loop can not be restarted.
+ */
+void EventLoop::stop() {
+    bool wasRunning;
+    {
+        std::lock_guard<std::mutex> lock(_pendingTasksMtx);
+        _isStopped = true;
+        wasRunning = _running;
+        _running = false;
+    }
+    if (!wasRunning) {
+        runAllPendingTasks(); // queued for a loop that never started
+        return;
+    }
+    wakeup();
+    if (_loopThread) {
+        _loopThread->join();
+        delete _loopThread;
+        _loopThread = nullptr;
+    } else if (!isInLoopThread()) {
+        std::unique_lock<std::mutex> lock(_pendingTasksMtx);
+        _loopExitedCv.wait(lock, [this]() { return !_isLooping; });
+    }
+    _loopThreadId = std::thread::id();
+    runAllPendingTasks();
+}
+
+/*
+ * Restrict the loop thread to a single cpu. Must be called after start().
+ * Returns false if the loop is not running or the kernel refused the mask.
+ */
+bool EventLoop::pinToCpu(int cpu) {
+    return pinToCpus(std::vector<int>(1, cpu));
+}
+
+bool EventLoop::pinToCpus(const std::vector<int> & cpus) {
+    if (!_loopThread) {
+        return false;
+    }
+    return cpu_placement::pinThread(_loopThread->native_handle(), cpus);
+}
+
+/*
+ * The cpus the loop thread may run on, as the kernel has them. Empty if the loop is not running
+ */
+std::vector<int> EventLoop::cpus() const {
+    return _loopThread ? cpu_placement::affinityOf(_loopThread->native_handle()) : std::vector<int>();
+}
+
+/*
+ * The loop running on the calling thread, or nullptr when called from any other thread
+ */
+EventLoop * EventLoop::current() {
+    return currentLoop;
+}
+
+void EventLoop::loop() {
+    _loopThreadId = std::this_thread::get_id();
+    currentLoop = this;
+    struct epoll_event events[MAX_EVENTS_PER_WAIT];
+
+    while (_running) {
+        const int numOfEvents = epoll_wait(_epollfd.get(), events, MAX_EVENTS_PER_WAIT, _timers.timeoutMs());
+        if (numOfEvents == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(strerror(errno));
+        }
+
+        for (int i = 0; i < numOfEvents; i++) {
+            const int fd = events[i].data.fd;
+            if (fd == _wakeupfd.get()) {
+                handleWakeup();
+                continue;
+            }
+            const auto handlerIter = _handlers.find(fd);
+            if (handlerIter == _handlers.end()) {
+                continue; // removed by an earlier handler of this batch
+            }
+            // hold a reference so the handler may safely remove itself
+            const std::shared_ptr<io_handler_t> handler = handlerIter->second;
+            (*handler)(events[i].events);
+        }
+
+        _timers.advance();
+        runPendingTasks();
+    }
+    currentLoop = nullptr;
+}
+
+void EventLoop::wakeup() {
+    const uint64_t one = 1;
+    const ssize_t numBytesWritten = ::write(_wakeupfd.get(), &one, sizeof(one));
+    (void)numBytesWritten; // counter already non zero when write would block
+}
+
+void EventLoop::handleWakeup() {
+    uint64_t counter;
+    const ssize_t numBytesRead = ::read(_wakeupfd.get(), &counter, sizeof(counter));
+    (void)numBytesRead;
+}
+
+/*
+ * Run the tasks queued so far, in batches taken without a lock. At most one lap
+ * of the ring is taken, so tasks queueing more tasks can not hold the loop here.
+ */
+void EventLoop::runPendingTasks() {
+    // everything queued before the overflow list was started fits in one lap
+    _pendingTasks.drain([](task_t && task) { task(); }, _pendingTasks.capacity());
+
+    // overflowed tasks were queued after the ones in the ring, so wait for the ring to
+    // drain first. Checked under the lock: a thread that put a task in the ring before
+    // overflowing its next one had claimed the slot by then. Its thread, or the one
+    // still writing it, wakes the loop again
+    if (!_hasOverflowTasks.load(std::memory_order_acquire)) {
+        return;
+    }
+    std::vector<task_t> tasks;
+    {
+        std::lock_guard<std::mutex> lock(_pendingTasksMtx);
+        if (!_pendingTasks.empty()) {
+            return;
+        }
+        tasks.swap(_overflowTasks);
+        _hasOverflowTasks = false;
+    }
+    for (const task_t & task : tasks) {
+        task();
+    }
+}
+
+/*
+ * Run pending tasks on the stopping thread until none is left. Tasks queued by
+ * them run right away, as the loop is stopped.
+ */
+void EventLoop::runAllPendingTasks() {
+    // a queueInLoop() that saw the loop running is still queueing, wait for its task
+    while (_numOfQueueingThreads.load() > 0) {
+        std::this_thread::yield();
+    }
+    while (!_pendingTasks.empty() || _hasOverflowTasks) {
+        runPendingTasks();
+    }
+}
+
+/*
+ * Run task on the loop thread. Runs immediately when called from the loop
+ * thread, otherwise it is queued.
+ */
+void EventLoop::runInLoop(const task_t & task) {
+    if (isInLoopThread()) {
+        task();
+    } else {
+        queueInLoop(task);
+    }
+}
+
+/*
+ * Queue task for the loop thread. Tasks queued before the loop is started run
+ * once it is; once it is stopped, they run on the calling thread instead.
+ */
+void EventLoop::queueInLoop(const task_t & task) {
+    // paired with stop(): either this sees the loop stopped, or stop() waits for this task
+    _numOfQueueingThreads++;
+    if (_isStopped) {
+        _numOfQueueingThreads--;
+        task();
+        return;
+    }
+    task_t queuedTask(task);
+    if (_hasOverflowTasks.load(std::memory_order_acquire) || !_pendingTasks.tryPush(std::move(queuedTask))) {
+        std::lock_guard<std::mutex> lock(_pendingTasksMtx);
+        _overflowTasks.push_back(std::move(queuedTask));
+        _hasOverflowTasks = true;
+    }
+    wakeup();
+    _numOfQueueingThreads--;
+}
+
+/*
+ * Like runInLoop(), but when called from another thread, blocks until the loop thread ran task
+ */
+void EventLoop::runInLoopAndWait(const task_t & task) {
+    if (isInLoopThread() || !_running) { // nobody to wait for
+        task();
+        return;
+    }
+    std::promise<void> done;
+    std::future<void> doneFuture = done.get_future();
+    queueInLoop([&task, &done]() {
+        task();
+        done.set_value();
+    });
+    doneFuture.wait();
+}
+
+/*
+ * Run task on the loop thread once, delayMs from now. Returns an id for cancelTimer().
+ */
+EventLoop::timer_id_t EventLoop::runAfter(uint64_t delayMs, const task_t & task) {
+    const timer_id_t timerId = _nextTimerId++;
+    runInLoop([this, timerId, delayMs, task]() { _timers.schedule(timerId, delayMs, 0, task); });
+    return timerId;
+}
+
+/*
+ * Run task on the loop thread every intervalMs, until the timer is cancelled
+ */
+EventLoop::timer_id_t EventLoop::runEvery(uint64_t intervalMs, const task_t & task) {
+    const timer_id_t timerId = _nextTimerId++;
+    runInLoop([this, timerId, intervalMs, task]() { _timers.schedule(timerId, intervalMs, intervalMs, task); });
+    return timerId;
+}
+
+/*
+ * Cancel a timer. From another thread the cancellation is queued, so the
+ * timer may still fire once before it is processed; use runInLoopAndWait()
+ * when the timer's task must be known not to run anymore.
+ */
+void EventLoop::cancelTimer(timer_id_t timerId) {
+    runInLoop([this, timerId]() { _timers.cancel(timerId); });
+}
+
+/*
+ * Register fd for the given epoll events. The handler is called on the loop thread.
+ * Registering happens on the loop thread as well; if epoll refuses fd, onFailure
+ * is called there instead of throwing out of the loop.
+ */
+void EventLoop::add(int fd, uint32_t events, const io_handler_t & handler, const add_failure_handler_t & onFailure) {
+    runInLoop([this, fd, events, handler, onFailure]() {
+        const pipe_ret_t addRet = addNow(fd, events, handler);
+        if (!addRet.isSuccessful() && onFailure) {
+            onFailure(addRet);
+        }
+    });
+}
+
+pipe_ret_t EventLoop::addNow(int fd, uint32_t events, const io_handler_t & handler) {
+    _handlers[fd] = std::make_shared<io_handler_t>(handler);
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(_epollfd.get(), EPOLL_CTL_ADD, fd, &event) == -1) {
+        const pipe_ret_t failure = pipe_ret_t::failure(strerror(errno));
+        _handlers.erase(fd);
+        return failure;
+    }
+    return pipe_ret_t::success();
+}
+
+/*
+ * Change the epoll events fd is registered for. epoll_ctl is thread safe,
+ * so this does not need to go through the loop thread.
+ */
+void EventLoop::modify(int fd, uint32_t events) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+    epoll_ctl(_epollfd.get(), EPOLL_CTL_MOD, fd, &event);
+}
+
+/*
+ * Unregister fd. When called from another thread, blocks until the loop thread
+ * removed the handler, so the caller may close fd and free the handler's state
+ * right after this returns.
+ */
+void EventLoop::remove(int fd) {
+    runInLoopAndWait([this, fd]() { removeNow(fd); });
+}
+
+void EventLoop::removeNow(int fd) {
+    const auto handlerIter = _handlers.find(fd);
+    if (handlerIter == _handlers.end()) {
+        return;
+    }
+    epoll_ctl(_epollfd.get(), EPOLL_CTL_DEL, fd, nullptr);
+    _handlers.erase(handlerIter);
+}
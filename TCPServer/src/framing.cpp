@@ -0,0 +1,96 @@
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../include/framing.h"
+
+const ssize_t Framing::FRAME_INCOMPLETE;
+const ssize_t Framing::FRAME_INVALID;
+const size_t LengthPrefixedFraming::HEADER_SIZE;
+
+ssize_t Framing::findFrameEnd(const char * buffered, size_t bufferedSize, const char * next, size_t nextSize) const {
+    std::string frame(buffered, bufferedSize);
+    frame.append(next, nextSize);
+    size_t payloadOffset = 0;
+    size_t payloadSize = 0;
+    const ssize_t frameSize = findFrame(frame.data(), frame.size(), payloadOffset, payloadSize);
+    return (frameSize > 0) ? frameSize - static_cast<ssize_t>(bufferedSize) : frameSize;
+}
+
+std::string LengthPrefixedFraming::header(size_t payloadSize) const {
+    const uint32_t length = static_cast<uint32_t>(payloadSize);
+    const char header[HEADER_SIZE] = {
+        static_cast<char>(length >> 24), static_cast<char>(length >> 16),
+        static_cast<char>(length >> 8), static_cast<char>(length)
+    };
+    return std::string(header, HEADER_SIZE);
+}
+
+DelimiterFraming::DelimiterFraming(const std::string & delimiter, size_t maxPayloadSize) :
+    _delimiter{delimiter.empty() ? std::string("\n") : delimiter},
+    _maxPayloadSize{maxPayloadSize}
+{}
+
+/*
+ * First delimiter in data, or data + size. memchr() finds the candidates, so a
+ * frame is scanned at memory speed rather than byte by byte.
+ */
+const char * DelimiterFraming::findDelimiter(const char * data, size_t size) const {
+    const char * end = data + size;
+    const char * candidate = data;
+    while (static_cast<size_t>(end - candidate) >= _delimiter.size()) {
+        candidate = static_cast<const char*>(memchr(candidate, _delimiter[0], end - candidate - _delimiter.size() + 1));
+        if (!candidate) {
+            return end;
+        }
+        if (memcmp(candidate + 1, _delimiter.data() + 1, _delimiter.size() - 1) == 0) {
+            return candidate;
+        }
+        candidate++;
+    }
+    return end;
+}
+
+ssize_t DelimiterFraming::findFrame(const char * data, size_t size, size_t & payloadOffset, size_t & payloadSize) const {
+    const char * end = data + size;
+    const char * delimiter = findDelimiter(data, size);
+    if (delimiter == end) {
+        // a frame still missing its delimiter past the limit never will be valid
+        return (size > _maxPayloadSize + _delimiter.size()) ? FRAME_INVALID : FRAME_INCOMPLETE;
+    }
+    payloadOffset = 0;
+    payloadSize = delimiter - data;
+    if (payloadSize > _maxPayloadSize) {
+        return FRAME_INVALID;
+    }
+    return payloadSize + _delimiter.size();
+}
+
+ssize_t DelimiterFraming::findFrameEnd(const char * buffered, size_t bufferedSize, const char * next, size_t nextSize) const {
+    // buffered holds no whole delimiter, but may end with the first bytes of one
+    const size_t numOfBytesCarried = std::min(bufferedSize, _delimiter.size() - 1);
+    for (size_t carried = numOfBytesCarried; carried > 0; carried--) {
+        const size_t numOfBytesNeeded = _delimiter.size() - carried;
+        if (nextSize >= numOfBytesNeeded &&
+            memcmp(buffered + bufferedSize - carried, _delimiter.data(), carried) == 0 &&
+            memcmp(next, _delimiter.data() + carried, numOfBytesNeeded) == 0) {
+            return (bufferedSize - carried > _maxPayloadSize) ? FRAME_INVALID : numOfBytesNeeded;
+        }
+    }
+    const char * end = next + nextSize;
+    const char * delimiter = findDelimiter(next, nextSize);
+    if (delimiter == end) {
+        return (bufferedSize + nextSize > _maxPayloadSize + _delimiter.size()) ? FRAME_INVALID : FRAME_INCOMPLETE;
+    }
+    const size_t payloadSize = bufferedSize + (delimiter - next);
+    if (payloadSize > _maxPayloadSize) {
+        return FRAME_INVALID;
+    }
+    return (delimiter - next) + _delimiter.size();
+}
+
+FixedSizeFraming::FixedSizeFraming(size_t frameSize) : _frameSize{frameSize} {
+    if (frameSize == 0) {
+        throw std::invalid_argument("FixedSizeFraming needs a frame size of at least 1 byte");
+    }
+}
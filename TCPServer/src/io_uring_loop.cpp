@@ -0,0 +1,616 @@
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <future>
+#include <stdexcept>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "../include/io_uring_loop.h"
+#include "../include/cpu_placement.h"
+
+#define MAX_IOV_PER_SEND 1024
+
+namespace {
+    enum OpType : uint64_t {
+        OP_WAKEUP = 1,
+        OP_ACCEPT,
+        OP_RECV,
+        OP_SEND,
+        OP_CANCEL
+    };
+
+    uint64_t userData(OpType type, uint32_t id) {
+        return (static_cast<uint64_t>(type) << 32) | id;
+    }
+
+    OpType opTypeOf(uint64_t userData) {
+        return static_cast<OpType>(userData >> 32);
+    }
+
+    uint32_t idOf(uint64_t userData) {
+        return static_cast<uint32_t>(userData);
+    }
+}
+
+IoUringLoop::IoUringLoop(unsigned entries, unsigned numOfBuffers, unsigned bufferSize) :
+    _numOfBuffers{numOfBuffers},
+    _bufferSize{bufferSize}
+{
+    _running = false;
+
+    if (numOfBuffers == 0 || (numOfBuffers & (numOfBuffers - 1)) != 0 || numOfBuffers > 32768) {
+        throw std::runtime_error("number of io_uring buffers must be a power of 2 up to 32768");
+    }
+
+    _wakeupfd.set(eventfd(0, EFD_CLOEXEC));
+    if (_wakeupfd.get() == -1) {
+        throw std::runtime_error(strerror(errno));
+    }
+
+    try {
+        setupRings(entries);
+        setupBufferRing();
+    } catch (const std::runtime_error &) {
+        teardownRings();
+        ::close(_wakeupfd.get());
+        throw;
+    }
+}
+
+IoUringLoop::~IoUringLoop() {
+    stop();
+    teardownRings();
+    ::close(_wakeupfd.get());
+    for (auto & connection : _connections) {
+        delete connection.second;
+    }
+}
+
+void IoUringLoop::setupRings(unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    const int ringfd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ringfd < 0) {
+        throw std::runtime_error(strerror(errno));
+    }
+    _ringfd.set(ringfd);
+
+    _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP);
+    if (singleMmap) {
+        _sqRingSize = std::max(_sqRingSize, _cqRingSize);
+    }
+
+    _sqRingPtr = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ringfd, IORING_OFF_SQ_RING);
+    if (_sqRingPtr == MAP_FAILED) {
+        _sqRingPtr = nullptr;
+        throw std::runtime_error(strerror(errno));
+    }
+
+    if (singleMmap) {
+        _cqRingPtr = _sqRingPtr;
+    } else {
+        _cqRingPtr = mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          ringfd, IORING_OFF_CQ_RING);
+        if (_cqRingPtr == MAP_FAILED) {
+            _cqRingPtr = nullptr;
+            throw std::runtime_error(strerror(errno));
+        }
+    }
+
+    _sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void * sqes = mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ringfd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        throw std::runtime_error(strerror(errno));
+    }
+    _sqes = static_cast<struct io_uring_sqe *>(sqes);
+
+    char * sqRing = static_cast<char *>(_sqRingPtr);
+    _sqHead = reinterpret_cast<unsigned *>(sqRing + params.sq_off.head);
+    _sqTail = reinterpret_cast<unsigned *>(sqRing + params.sq_off.tail);
+    _sqMask = reinterpret_cast<unsigned *>(sqRing + params.sq_off.ring_mask);
+    _sqArray = reinterpret_cast<unsigned *>(sqRing + params.sq_off.array);
+    _sqEntries = params.sq_entries;
+    _sqLocalTail = *_sqTail;
+
+    char * cqRing = static_cast<char *>(_cqRingPtr);
+    _cqHead = reinterpret_cast<unsigned *>(cqRing + params.cq_off.head);
+    _cqTail = reinterpret_cast<unsigned *>(cqRing + params.cq_off.tail);
+    _cqMask = reinterpret_cast<unsigned *>(cqRing + params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<struct io_uring_cqe *>(cqRing + params.cq_off.cqes);
+}
+
+/*
+ * Register a ring of provided buffers (group 0). Multishot recv picks a buffer
+ * from it for every completion, and the buffer is handed back after dispatch.
+ */
+void IoUringLoop::setupBufferRing() {
+    _bufRingSize = _numOfBuffers * sizeof(struct io_uring_buf);
+    void * bufRing = mmap(nullptr, _bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufRing == MAP_FAILED) {
+        throw std::runtime_error(strerror(errno));
+    }
+    _bufRing = static_cast<struct io_uring_buf_ring *>(bufRing);
+    _buffers = new char[static_cast<size_t>(_numOfBuffers) * _bufferSize];
+
+    struct io_uring_buf_reg bufReg;
+    memset(&bufReg, 0, sizeof(bufReg));
+    bufReg.ring_addr = reinterpret_cast<uint64_t>(bufRing);
+    bufReg.ring_entries = _numOfBuffers;
+    bufReg.bgid = 0;
+    if (syscall(__NR_io_uring_register, _ringfd.get(), IORING_REGISTER_PBUF_RING, &bufReg, 1) < 0) {
+        throw std::runtime_error(strerror(errno));
+    }
+
+    for (unsigned bufferId = 0; bufferId < _numOfBuffers; bufferId++) {
+        recycleBuffer(static_cast<uint16_t>(bufferId));
+    }
+}
+
+void IoUringLoop::teardownRings() {
+    if (_ringfd.get() > 0) {
+        ::close(_ringfd.get());
+        _ringfd.set(0);
+    }
+    if (_sqes) {
+        munmap(_sqes, _sqesSize);
+        _sqes = nullptr;
+    }
+    if (_cqRingPtr && _cqRingPtr != _sqRingPtr) {
+        munmap(_cqRingPtr, _cqRingSize);
+    }
+    _cqRingPtr = nullptr;
+    if (_sqRingPtr) {
+        munmap(_sqRingPtr, _sqRingSize);
+        _sqRingPtr = nullptr;
+    }
+    if (_bufRing) {
+        munmap(_bufRing, _bufRingSize);
+        _bufRing = nullptr;
+    }
+    delete[] _buffers;
+    _buffers = nullptr;
+}
+
+struct io_uring_sqe * IoUringLoop::getSqe() {
+    unsigned head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+    if (_sqLocalTail - head >= _sqEntries) {
+        submit(0);
+        head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+        if (_sqLocalTail - head >= _sqEntries) {
+            throw std::runtime_error("io_uring submission queue is full");
+        }
+    }
+    const unsigned index = _sqLocalTail & *_sqMask;
+    struct io_uring_sqe * sqe = &_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    _sqArray[index] = index;
+    _sqLocalTail++;
+    _numOfUnsubmitted++;
+    return sqe;
+}
+
+/*
+ * Hand every queued sqe to the kernel, and optionally wait for completions,
+ * in a single io_uring_enter()
+ */
+void IoUringLoop::submit(unsigned waitFor) {
+    __atomic_store_n(_sqTail, _sqLocalTail, __ATOMIC_RELEASE);
+    const unsigned flags = waitFor > 0 ? IORING_ENTER_GETEVENTS : 0;
+    const int numSubmitted = syscall(__NR_io_uring_enter, _ringfd.get(), _numOfUnsubmitted, waitFor, flags, nullptr, 0);
+    if (numSubmitted < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+            return; // completions are reaped and the rest is submitted on the next iteration
+        }
+        throw std::runtime_error(strerror(errno));
+    }
+    _numOfUnsubmitted -= numSubmitted;
+}
+
+void IoUringLoop::start() {
+    if (_loopThread) {
+        return;
+    }
+    _running = true;
+    _loopThread = new std::thread(&IoUringLoop::loop, this);
+}
+
+/*
+ * Wake the loop thread and join it. Tasks queued after this point run on the calling thread.
+ */
+void IoUringLoop::stop() {
+    {
+        std::lock_guard<std::mutex> lock(_pendingMtx);
+        if (!_running) {
+            return;
+        }
+        _running = false;
+    }
+    wakeup();
+    if (_loopThread) {
+        _loopThread->join();
+        delete _loopThread;
+        _loopThread = nullptr;
+    }
+    _loopThreadId = std::thread::id();
+    runPending();
+}
+
+bool IoUringLoop::pinToCpu(int cpu) {
+    if (!_loopThread) {
+        return false;
+    }
+    return cpu_placement::pinThread(_loopThread->native_handle(), std::vector<int>(1, cpu));
+}
+
+/*
+ * The cpus the loop thread may run on, as the kernel has them. Empty if the loop is not running
+ */
+std::vector<int> IoUringLoop::cpus() const {
+    return _loopThread ? cpu_placement::affinityOf(_loopThread->native_handle()) : std::vector<int>();
+}
+
+void IoUringLoop::loop() {
+    _loopThreadId = std::this_thread::get_id();
+    armWakeup();
+
+    while (_running) {
+        runPending();
+        flushSends();
+        releaseClosedConnections();
+        submit(1);
+        reapCompletions();
+    }
+}
+
+void IoUringLoop::reapCompletions() {
+    unsigned head = *_cqHead;
+    while (true) {
+        const unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            break;
+        }
+        const struct io_uring_cqe cqe = _cqes[head & *_cqMask];
+        head++;
+        __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+        handleCompletion(cqe);
+    }
+}
+
+void IoUringLoop::handleCompletion(const struct io_uring_cqe & cqe) {
+    const uint32_t id = idOf(cqe.user_data);
+
+    switch (opTypeOf(cqe.user_data)) {
+        case OP_WAKEUP: {
+            armWakeup();
+            break;
+        }
+        case OP_ACCEPT: {
+            if (cqe.res >= 0) {
+                struct sockaddr_in address;
+                socklen_t addressSize = sizeof(address);
+                memset(&address, 0, sizeof(address));
+                getpeername(cqe.res, (struct sockaddr *)&address, &addressSize);
+                _acceptors[id].second(cqe.res, address);
+            }
+            const bool listenerGone = (cqe.res == -EBADF || cqe.res == -EINVAL || cqe.res == -ECANCELED);
+            if (!(cqe.flags & IORING_CQE_F_MORE) && !listenerGone && _running) {
+                armAccept(id);
+            }
+            break;
+        }
+        case OP_RECV: {
+            const auto connectionIter = _connections.find(id);
+            if (connectionIter != _connections.end()) {
+                handleRecvCompletion(connectionIter->second, cqe);
+            } else if (cqe.flags & IORING_CQE_F_BUFFER) {
+                recycleBuffer(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+            }
+            break;
+        }
+        case OP_SEND: {
+            const auto connectionIter = _connections.find(id);
+            if (connectionIter != _connections.end()) {
+                handleSendCompletion(connectionIter->second, cqe.res);
+            }
+            break;
+        }
+        case OP_CANCEL:
+            break;
+    }
+}
+
+void IoUringLoop::handleRecvCompletion(connection_t * connection, const struct io_uring_cqe & cqe) {
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        connection->isReceiving = false;
+    }
+
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        const uint16_t bufferId = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        if (!connection->isClosing && cqe.res > 0) {
+            connection->handler(_buffers + static_cast<size_t>(bufferId) * _bufferSize, cqe.res);
+        }
+        recycleBuffer(bufferId);
+    } else if (!connection->isClosing && cqe.res != -ENOBUFS) {
+        connection->handler(nullptr, cqe.res); // peer closed (0) or failed (-errno)
+    }
+
+    const bool canRearm = (cqe.res > 0 || cqe.res == -ENOBUFS);
+    if (!connection->isReceiving && !connection->isClosing && canRearm) {
+        armRecv(connection);
+    }
+}
+
+void IoUringLoop::handleSendCompletion(connection_t * connection, int result) {
+    connection->isSending = false;
+
+    if (result >= 0) {
+        size_t numBytesLeftToSkip = static_cast<size_t>(result);
+        std::deque<std::string> notSent;
+        for (std::string & msg : connection->inflightMsgs) {
+            if (numBytesLeftToSkip >= msg.size()) {
+                numBytesLeftToSkip -= msg.size();
+                continue;
+            }
+            notSent.push_back(msg.substr(numBytesLeftToSkip));
+            numBytesLeftToSkip = 0;
+        }
+        // a partial write puts the rest back in front of the queue
+        connection->queuedMsgs.insert(connection->queuedMsgs.begin(), notSent.begin(), notSent.end());
+    }
+    connection->inflightMsgs.clear();
+
+    if (!connection->queuedMsgs.empty() && !connection->isClosing) {
+        armSend(connection);
+    }
+}
+
+void IoUringLoop::armWakeup() {
+    struct io_uring_sqe * sqe = getSqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = _wakeupfd.get();
+    sqe->addr = reinterpret_cast<uint64_t>(&_wakeupCounter);
+    sqe->len = sizeof(_wakeupCounter);
+    sqe->user_data = userData(OP_WAKEUP, 0);
+}
+
+void IoUringLoop::armAccept(size_t acceptorIndex) {
+    struct io_uring_sqe * sqe = getSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = _acceptors[acceptorIndex].first;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = userData(OP_ACCEPT, static_cast<uint32_t>(acceptorIndex));
+}
+
+void IoUringLoop::armRecv(connection_t * connection) {
+    struct io_uring_sqe * sqe = getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = connection->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = userData(OP_RECV, connection->id);
+    connection->isReceiving = true;
+}
+
+/*
+ * Send everything queued for the connection with one sendmsg. Only one send
+ * per connection is in flight at a time so the byte order is kept.
+ */
+void IoUringLoop::armSend(connection_t * connection) {
+    while (!connection->queuedMsgs.empty() && connection->inflightMsgs.size() < MAX_IOV_PER_SEND) {
+        connection->inflightMsgs.push_back(std::move(connection->queuedMsgs.front()));
+        connection->queuedMsgs.pop_front();
+    }
+
+    connection->inflightIov.clear();
+    for (std::string & msg : connection->inflightMsgs) {
+        struct iovec iov;
+        iov.iov_base = &msg[0];
+        iov.iov_len = msg.size();
+        connection->inflightIov.push_back(iov);
+    }
+    memset(&connection->inflightMsghdr, 0, sizeof(connection->inflightMsghdr));
+    connection->inflightMsghdr.msg_iov = connection->inflightIov.data();
+    connection->inflightMsghdr.msg_iovlen = connection->inflightIov.size();
+
+    struct io_uring_sqe * sqe = getSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = connection->fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&connection->inflightMsghdr);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = userData(OP_SEND, connection->id);
+    connection->isSending = true;
+}
+
+void IoUringLoop::recycleBuffer(uint16_t bufferId) {
+    // index the entries by hand: the flexible array in io_uring_buf_ring is not laid out
+    // at offset 0 when the kernel header is compiled as C++
+    struct io_uring_buf * bufs = reinterpret_cast<struct io_uring_buf *>(_bufRing);
+    struct io_uring_buf * buf = &bufs[_bufRingTail & (_numOfBuffers - 1)];
+    buf->addr = reinterpret_cast<uint64_t>(_buffers + static_cast<size_t>(bufferId) * _bufferSize);
+    buf->len = _bufferSize;
+    buf->bid = bufferId;
+    _bufRingTail++;
+    __atomic_store_n(&_bufRing->tail, _bufRingTail, __ATOMIC_RELEASE);
+}
+
+void IoUringLoop::flushSends() {
+    for (connection_t * connection : _connectionsToFlush) {
+        connection->isQueuedForFlush = false;
+        if (!connection->isSending && !connection->isClosing && !connection->queuedMsgs.empty()) {
+            armSend(connection);
+        }
+    }
+    _connectionsToFlush.clear();
+}
+
+/*
+ * Free connections that were stopped once the kernel no longer references their buffers
+ */
+void IoUringLoop::releaseClosedConnections() {
+    for (size_t i = 0; i < _closedConnections.size();) {
+        connection_t * connection = _closedConnections[i];
+        if (connection->isReceiving || connection->isSending) {
+            i++;
+            continue;
+        }
+        _connections.erase(connection->id);
+        delete connection;
+        _closedConnections[i] = _closedConnections.back();
+        _closedConnections.pop_back();
+    }
+}
+
+void IoUringLoop::wakeup() {
+    const uint64_t one = 1;
+    const ssize_t numBytesWritten = ::write(_wakeupfd.get(), &one, sizeof(one));
+    (void)numBytesWritten;
+}
+
+void IoUringLoop::runPending() {
+    std::vector<task_t> tasks;
+    std::vector<pending_send_t> sends;
+    {
+        std::lock_guard<std::mutex> lock(_pendingMtx);
+        tasks.swap(_pendingTasks);
+        sends.swap(_pendingSends);
+    }
+    for (pending_send_t & pendingSend : sends) {
+        queueSend(pendingSend.fd, std::move(pendingSend.msg));
+    }
+    for (const task_t & task : tasks) {
+        task();
+    }
+}
+
+void IoUringLoop::queueSend(int fd, std::string && msg) {
+    const auto idIter = _connectionIdByFd.find(fd);
+    if (idIter == _connectionIdByFd.end()) {
+        return; // connection already stopped
+    }
+    connection_t * connection = _connections[idIter->second];
+    connection->queuedMsgs.push_back(std::move(msg));
+    if (!connection->isQueuedForFlush) {
+        connection->isQueuedForFlush = true;
+        _connectionsToFlush.push_back(connection);
+    }
+}
+
+void IoUringLoop::runInLoop(const task_t & task) {
+    if (isInLoopThread()) {
+        task();
+    } else {
+        queueInLoop(task);
+    }
+}
+
+void IoUringLoop::queueInLoop(const task_t & task) {
+    {
+        std::lock_guard<std::mutex> lock(_pendingMtx);
+        if (_running) {
+            _pendingTasks.push_back(task);
+            wakeup();
+            return;
+        }
+    }
+    task();
+}
+
+/*
+ * Accept connections on listeningfd with a multishot accept.
+ * The handler is called on the loop thread for every accepted socket.
+ */
+void IoUringLoop::acceptOn(int listeningfd, const accept_handler_t & handler) {
+    runInLoop([this, listeningfd, handler]() {
+        _acceptors.push_back(std::make_pair(listeningfd, handler));
+        if (_running) {
+            armAccept(_acceptors.size() - 1);
+        }
+    });
+}
+
+/*
+ * Start a multishot recv on fd. The handler is called on the loop thread.
+ */
+void IoUringLoop::startReceiving(int fd, const recv_handler_t & handler) {
+    runInLoop([this, fd, handler]() {
+        connection_t * connection = new connection_t();
+        connection->id = _nextConnectionId++;
+        connection->fd = fd;
+        connection->handler = handler;
+        _connections[connection->id] = connection;
+        _connectionIdByFd[fd] = connection->id;
+        if (_running) {
+            armRecv(connection);
+        }
+    });
+}
+
+/*
+ * Stop receiving on fd and drop its unsent data. When called from another thread,
+ * blocks until the loop thread stopped the connection, so the caller may close fd
+ * and free the handler's state right after this returns.
+ */
+void IoUringLoop::stopReceiving(int fd) {
+    const task_t stopTask = [this, fd]() {
+        const auto idIter = _connectionIdByFd.find(fd);
+        if (idIter == _connectionIdByFd.end()) {
+            return;
+        }
+        connection_t * connection = _connections[idIter->second];
+        _connectionIdByFd.erase(idIter);
+        connection->isClosing = true;
+        connection->queuedMsgs.clear();
+        if (connection->isReceiving && _running) {
+            struct io_uring_sqe * sqe = getSqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = userData(OP_RECV, connection->id);
+            sqe->user_data = userData(OP_CANCEL, connection->id);
+        }
+        _closedConnections.push_back(connection);
+    };
+
+    if (isInLoopThread()) {
+        stopTask();
+        return;
+    }
+    std::promise<void> stopped;
+    std::future<void> stoppedFuture = stopped.get_future();
+    queueInLoop([&stopTask, &stopped]() {
+        stopTask();
+        stopped.set_value();
+    });
+    stoppedFuture.wait();
+}
+
+/*
+ * Queue msg for fd. Sends queued during one loop iteration are submitted together.
+ */
+void IoUringLoop::send(int fd, const char * msg, size_t size) {
+    if (isInLoopThread()) {
+        queueSend(fd, std::string(msg, size));
+        return;
+    }
+    std::lock_guard<std::mutex> lock(_pendingMtx);
+    if (!_running) {
+        return;
+    }
+    pending_send_t pendingSend;
+    pendingSend.fd = fd;
+    pendingSend.msg.assign(msg, size);
+    _pendingSends.push_back(std::move(pendingSend));
+    wakeup();
+}
@@ -0,0 +1,221 @@
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
+
+#include "../include/outbound_queue.h"
+
+const size_t OutboundQueue::MAX_CHUNKS_PER_SEND;
+const size_t OutboundQueue::MAX_MERGED_CHUNK_SIZE;
+
+OutboundQueue::OutboundQueue(size_t highWatermark, size_t lowWatermark) {
+    setWatermarks(highWatermark, lowWatermark);
+}
+
+void OutboundQueue::setWatermarks(size_t highWatermark, size_t lowWatermark) {
+    _highWatermark = highWatermark;
+    _lowWatermark = std::min(lowWatermark, highWatermark);
+}
+
+void OutboundQueue::append(const char * data, size_t size) {
+    if (size == 0) {
+        return;
+    }
+    _numOfQueuedBytes += size;
+    if (!_chunks.empty() && _chunks.back().isOwned() &&
+        _chunks.back().ownedData.size() + size <= MAX_MERGED_CHUNK_SIZE) {
+        _chunks.back().ownedData.append(data, size);
+        return;
+    }
+    _chunks.emplace_back();
+    _chunks.back().ownedData.assign(data, size);
+}
+
+/*
+ * Queue a reference to payload, from offset on. The bytes are not copied.
+ */
+void OutboundQueue::append(const shared_payload_t & payload, size_t offset) {
+    if (offset >= payload->size()) {
+        return;
+    }
+    _chunks.emplace_back();
+    _chunks.back().sharedData = payload;
+    _chunks.back().offset = offset;
+    _numOfQueuedBytes += payload->size() - offset;
+}
+
+/*
+ * Queue size bytes of file, from offset on, to be sent with sendfile()
+ */
+void OutboundQueue::appendFile(const shared_file_t & file, size_t offset, size_t size) {
+    if (size == 0) {
+        return;
+    }
+    _chunks.emplace_back();
+    _chunks.back().file = file;
+    _chunks.back().fileSize = offset + size;
+    _chunks.back().offset = offset;
+    _numOfQueuedBytes += size;
+}
+
+bool OutboundQueue::isZeroCopy(const chunk_t & chunk) const {
+    return _zeroCopyThreshold > 0 && chunk.sharedData && chunk.numOfBytesLeft() >= _zeroCopyThreshold;
+}
+
+/*
+ * Send queued bytes until the queue is empty or the socket would block, gathering
+ * up to MAX_CHUNKS_PER_SEND chunks per sendmsg(). Every call but the one carrying
+ * the last queued byte is flagged MSG_MORE, and that one too when moreToCome, so
+ * the kernel packs a burst into full segments. A zero copy chunk gets a call of its own.
+ * Returns 0, or the errno of a failed send (the queue is left as it was).
+ */
+int OutboundQueue::flush(int sockfd, bool moreToCome) {
+    struct iovec chunks[MAX_CHUNKS_PER_SEND];
+
+    while (!_chunks.empty()) {
+        if (_chunks.front().file) {
+            const int sendError = sendFileChunk(sockfd);
+            if (sendError != 0) {
+                return (sendError == EAGAIN) ? 0 : sendError;
+            }
+            continue;
+        }
+        const bool isZeroCopySend = isZeroCopy(_chunks.front());
+        const size_t maxNumOfChunks = isZeroCopySend ? 1 : std::min(_chunks.size(), MAX_CHUNKS_PER_SEND);
+        size_t numOfChunks = 0;
+        while (numOfChunks < maxNumOfChunks && !_chunks[numOfChunks].file &&
+               (numOfChunks == 0 || !isZeroCopy(_chunks[numOfChunks]))) {
+            const chunk_t & chunk = _chunks[numOfChunks];
+            chunks[numOfChunks].iov_base = const_cast<char*>(chunk.data().data() + chunk.offset);
+            chunks[numOfChunks].iov_len = chunk.numOfBytesLeft();
+            numOfChunks++;
+        }
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = chunks;
+        message.msg_iovlen = numOfChunks;
+
+        const bool isLastSend = (numOfChunks == _chunks.size());
+        int flags = MSG_NOSIGNAL | ((!isLastSend || moreToCome) ? MSG_MORE : 0);
+        if (isZeroCopySend) {
+            flags |= MSG_ZEROCOPY;
+        }
+        const ssize_t sendResult = ::sendmsg(sockfd, &message, flags);
+        if (sendResult == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == ENOBUFS && isZeroCopySend) {
+                _zeroCopyThreshold = 0; // out of locked memory to pin pages, copy from now on
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : errno;
+        }
+        if (isZeroCopySend) {
+            zero_copy_send_t zeroCopySend;
+            zeroCopySend.sendId = _nextZeroCopySendId++;
+            zeroCopySend.payload = _chunks.front().sharedData;
+            _zeroCopySends.push_back(zeroCopySend);
+        }
+        consume(sendResult);
+    }
+    return 0;
+}
+
+/*
+ * Stream the file range at the front of the queue until it is sent or the
+ * socket would block. Returns 0 once the range is sent, EAGAIN when the socket is
+ * full, the errno of a failed sendfile(), or ENODATA when the file shrank since
+ * it was queued: the peer was promised the whole range, so it can not be ended early.
+ */
+int OutboundQueue::sendFileChunk(int sockfd) {
+    chunk_t & front = _chunks.front();
+    while (front.numOfBytesLeft() > 0) {
+        off_t fileOffset = front.offset;
+        const ssize_t sendResult = ::sendfile(sockfd, front.file->get(), &fileOffset, front.numOfBytesLeft());
+        if (sendResult == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EWOULDBLOCK) ? EAGAIN : errno;
+        }
+        if (sendResult == 0) { // end of file before the end of the range
+            return ENODATA;
+        }
+        _numOfQueuedBytes -= sendResult;
+        front.offset += sendResult;
+    }
+    _chunks.pop_front();
+    return 0;
+}
+
+/*
+ * Drop numOfBytes sent bytes from the front of the queue
+ */
+void OutboundQueue::consume(size_t numOfBytes) {
+    _numOfQueuedBytes -= numOfBytes;
+    while (numOfBytes > 0) {
+        chunk_t & front = _chunks.front();
+        const size_t numOfBytesLeftInFront = front.numOfBytesLeft();
+        if (numOfBytes < numOfBytesLeftInFront) {
+            front.offset += numOfBytes;
+            return;
+        }
+        numOfBytes -= numOfBytesLeftInFront;
+        _chunks.pop_front();
+    }
+}
+
+/*
+ * Read the kernel's MSG_ZEROCOPY completions from the socket error queue, and
+ * release the payloads of the sends it is done with. A completion covers a
+ * range of send ids, and they complete in order. Drains the error queue, as
+ * epoll keeps reporting EPOLLERR while it is not empty.
+ */
+void OutboundQueue::reapZeroCopyCompletions(int sockfd) {
+    char control[128];
+    while (true) {
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (::recvmsg(sockfd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            return;
+        }
+        for (struct cmsghdr * header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+            const struct sock_extended_err * error = reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(header));
+            if (error->ee_errno != 0 || error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            const uint32_t lastCompletedSendId = error->ee_data;
+            while (!_zeroCopySends.empty() &&
+                   static_cast<int32_t>(_zeroCopySends.front().sendId - lastCompletedSendId) <= 0) {
+                _zeroCopySends.pop_front();
+            }
+        }
+    }
+}
+
+void OutboundQueue::clear() {
+    _chunks.clear();
+    _numOfQueuedBytes = 0;
+}
+
+/*
+ * Report a watermark the queue crossed since the last call. The gap between
+ * the two watermarks keeps a producer from flapping between paused and resumed.
+ */
+WatermarkCrossing OutboundQueue::checkWatermarks() {
+    if (!_isAboveHighWatermark && _numOfQueuedBytes > _highWatermark) {
+        _isAboveHighWatermark = true;
+        return WatermarkCrossing::ABOVE_HIGH;
+    }
+    if (_isAboveHighWatermark && _numOfQueuedBytes <= _lowWatermark) {
+        _isAboveHighWatermark = false;
+        return WatermarkCrossing::BELOW_LOW;
+    }
+    return WatermarkCrossing::NONE;
+}
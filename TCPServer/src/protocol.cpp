@@ -0,0 +1,146 @@
+#include <cstring>
+#include <endian.h>
+
+#include "../include/protocol.h"
+
+namespace protocol {
+
+    static void writeUint16(char * out, uint16_t value) {
+        value = htole16(value);
+        memcpy(out, &value, sizeof(value));
+    }
+
+    static void writeUint32(char * out, uint32_t value) {
+        value = htole32(value);
+        memcpy(out, &value, sizeof(value));
+    }
+
+    static uint16_t readUint16(const char * in) {
+        uint16_t value;
+        memcpy(&value, in, sizeof(value));
+        return le16toh(value);
+    }
+
+    static uint32_t readUint32(const char * in) {
+        uint32_t value;
+        memcpy(&value, in, sizeof(value));
+        return le32toh(value);
+    }
+
+    void encodeHeader(const message_header_t & header, char * out) {
+        out[0] = static_cast<char>(header.version);
+        out[1] = static_cast<char>(header.opcode);
+        writeUint16(out + 2, header.flags);
+        writeUint32(out + 4, header.requestId);
+        writeUint32(out + 8, header.payloadSize);
+    }
+
+    /*
+     * Decode the header at the start of data.
+     * Returns false when data is shorter than a header, or of another version.
+     */
+    bool decodeHeader(const char * data, size_t size, message_header_t & header) {
+        if (size < HEADER_SIZE) {
+            return false;
+        }
+        header.version = static_cast<uint8_t>(data[0]);
+        header.opcode = static_cast<Opcode>(static_cast<uint8_t>(data[1]));
+        header.flags = readUint16(data + 2);
+        header.requestId = readUint32(data + 4);
+        header.payloadSize = readUint32(data + 8);
+        return header.version == VERSION;
+    }
+
+    /*
+     * Decode one complete message. Returns false unless data holds exactly a
+     * header and the payload it announces.
+     */
+    bool decode(const char * data, size_t size, message_t & message) {
+        if (!decodeHeader(data, size, message.header)) {
+            return false;
+        }
+        if (size - HEADER_SIZE != message.header.payloadSize) {
+            return false;
+        }
+        message.payload = data + HEADER_SIZE;
+        return true;
+    }
+
+    std::string encode(Opcode opcode, uint32_t requestId, const char * payload, size_t payloadSize) {
+        message_header_t header;
+        header.opcode = opcode;
+        header.requestId = requestId;
+        header.payloadSize = static_cast<uint32_t>(payloadSize);
+
+        std::string message(HEADER_SIZE + payloadSize, '\0');
+        encodeHeader(header, &message[0]);
+        if (payloadSize > 0) {
+            memcpy(&message[HEADER_SIZE], payload, payloadSize);
+        }
+        return message;
+    }
+
+    std::string encodeUint32(Opcode opcode, uint32_t requestId, uint32_t value) {
+        char payload[sizeof(uint32_t)];
+        writeUint32(payload, value);
+        return encode(opcode, requestId, payload, sizeof(payload));
+    }
+
+    std::string encodeInt32s(Opcode opcode, uint32_t requestId, const std::vector<int32_t> & values) {
+        message_header_t header;
+        header.opcode = opcode;
+        header.requestId = requestId;
+        header.payloadSize = static_cast<uint32_t>(values.size() * sizeof(int32_t));
+
+        std::string message(HEADER_SIZE + header.payloadSize, '\0');
+        encodeHeader(header, &message[0]);
+        for (size_t i = 0; i < values.size(); i++) {
+            writeUint32(&message[HEADER_SIZE + i * sizeof(int32_t)], static_cast<uint32_t>(values[i]));
+        }
+        return message;
+    }
+
+    std::string encodeError(uint32_t requestId, ErrorCode errorCode) {
+        return encodeUint32(Opcode::ERROR, requestId, static_cast<uint32_t>(errorCode));
+    }
+
+    bool decodeUint32(const message_t & message, uint32_t & value) {
+        if (message.header.payloadSize != sizeof(uint32_t)) {
+            return false;
+        }
+        value = readUint32(message.payload);
+        return true;
+    }
+
+    bool decodeInt32s(const message_t & message, std::vector<int32_t> & values) {
+        if (message.header.payloadSize % sizeof(int32_t) != 0) {
+            return false;
+        }
+        const size_t numOfValues = message.header.payloadSize / sizeof(int32_t);
+        values.resize(numOfValues);
+        for (size_t i = 0; i < numOfValues; i++) {
+            values[i] = static_cast<int32_t>(readUint32(message.payload + i * sizeof(int32_t)));
+        }
+        return true;
+    }
+
+    ssize_t MessageFraming::findFrame(const char * data, size_t size, size_t & payloadOffset, size_t & payloadSize) const {
+        message_header_t header;
+        if (size < HEADER_SIZE) {
+            return FRAME_INCOMPLETE;
+        }
+        if (!decodeHeader(data, size, header) || header.payloadSize > MAX_PAYLOAD_SIZE) {
+            return FRAME_INVALID;
+        }
+        if (size - HEADER_SIZE < header.payloadSize) {
+            return FRAME_INCOMPLETE;
+        }
+        payloadOffset = 0;
+        payloadSize = HEADER_SIZE + header.payloadSize;
+        return payloadSize;
+    }
+
+    bool MessageFraming::canFrame(size_t messageSize) const {
+        return messageSize >= HEADER_SIZE && messageSize - HEADER_SIZE <= MAX_PAYLOAD_SIZE;
+    }
+}
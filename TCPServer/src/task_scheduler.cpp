@@ -0,0 +1,160 @@
+#include <utility>
+#include "../include/task_scheduler.h"
+#include "../include/cpu_placement.h"
+
+namespace {
+    // the scheduler and worker the current thread belongs to, if any
+    thread_local const TaskScheduler * currentScheduler = nullptr;
+    thread_local size_t currentWorkerIndex = 0;
+}
+
+TaskScheduler::TaskScheduler(size_t numOfWorkers) {
+    _running = false;
+    _numOfQueuedTasks = 0;
+    _nextWorker = 0;
+    _numOfIdleWorkers = 0;
+    for (size_t i = 0; i < numOfWorkers; i++) {
+        _workers.push_back(new worker_t());
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    stop();
+    for (worker_t * worker : _workers) {
+        delete worker;
+    }
+}
+
+void TaskScheduler::start() {
+    if (_running.exchange(true)) {
+        return;
+    }
+    for (size_t i = 0; i < _workers.size(); i++) {
+        _workers[i]->thread = new std::thread(&TaskScheduler::workerTask, this, i);
+    }
+}
+
+/*
+ * Restrict every worker to the given cpus. Must be called after start()
+ */
+bool TaskScheduler::pinToCpus(const std::vector<int> & cpus) {
+    bool pinned = true;
+    for (worker_t * worker : _workers) {
+        pinned = worker->thread && cpu_placement::pinThread(worker->thread->native_handle(), cpus) && pinned;
+    }
+    return pinned;
+}
+
+/*
+ * The cpus a worker may run on, as the kernel has them. Empty if it is not running
+ */
+std::vector<int> TaskScheduler::cpusOf(size_t workerIndex) const {
+    std::thread * thread = _workers[workerIndex]->thread;
+    return thread ? cpu_placement::affinityOf(thread->native_handle()) : std::vector<int>();
+}
+
+/*
+ * Let the workers finish every queued task (including tasks those spawn), and join them
+ */
+void TaskScheduler::stop() {
+    if (!_running.exchange(false)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_idleMtx);
+    }
+    _idleCv.notify_all();
+    for (worker_t * worker : _workers) {
+        worker->thread->join();
+        delete worker->thread;
+        worker->thread = nullptr;
+    }
+}
+
+// whether the calling thread is one of the workers of this scheduler
+bool TaskScheduler::isWorkerThread() const {
+    return currentScheduler == this;
+}
+
+/*
+ * Schedule a task. Called from a worker (e.g. a follow up step of a request),
+ * the task goes to that worker's own deque, which keeps related work on a warm cache.
+ */
+void TaskScheduler::spawn(task_t task) {
+    const bool spawnedFromWorker = (currentScheduler == this);
+    if (!spawnedFromWorker && (_workers.empty() || !_running)) {
+        task();
+        return;
+    }
+    const size_t workerIndex = spawnedFromWorker ? currentWorkerIndex : _nextWorker++ % _workers.size();
+    push(workerIndex, std::move(task));
+
+    if (_numOfIdleWorkers > 0) {
+        std::lock_guard<std::mutex> lock(_idleMtx);
+        _idleCv.notify_one();
+    }
+}
+
+void TaskScheduler::push(size_t workerIndex, task_t && task) {
+    worker_t * worker = _workers[workerIndex];
+    {
+        std::lock_guard<std::mutex> lock(worker->tasksMtx);
+        worker->tasks.push_back(std::move(task));
+    }
+    _numOfQueuedTasks++;
+}
+
+bool TaskScheduler::popLocal(size_t workerIndex, task_t & task) {
+    worker_t * worker = _workers[workerIndex];
+    std::lock_guard<std::mutex> lock(worker->tasksMtx);
+    if (worker->tasks.empty()) {
+        return false;
+    }
+    task = std::move(worker->tasks.back());
+    worker->tasks.pop_back();
+    _numOfQueuedTasks--;
+    return true;
+}
+
+/*
+ * Take the oldest task of another worker, trying each victim once
+ */
+bool TaskScheduler::steal(size_t thiefIndex, task_t & task) {
+    const size_t numOfWorkers = _workers.size();
+    for (size_t i = 1; i < numOfWorkers; i++) {
+        worker_t * victim = _workers[(thiefIndex + i) % numOfWorkers];
+        std::unique_lock<std::mutex> lock(victim->tasksMtx, std::try_to_lock);
+        if (!lock.owns_lock() || victim->tasks.empty()) {
+            continue;
+        }
+        task = std::move(victim->tasks.front());
+        victim->tasks.pop_front();
+        _numOfQueuedTasks--;
+        return true;
+    }
+    return false;
+}
+
+void TaskScheduler::workerTask(size_t workerIndex) {
+    currentScheduler = this;
+    currentWorkerIndex = workerIndex;
+
+    while (true) {
+        task_t task;
+        if (popLocal(workerIndex, task) || steal(workerIndex, task)) {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_idleMtx);
+        if (_numOfQueuedTasks > 0) {
+            continue; // a steal lost a try_lock race, look again
+        }
+        if (!_running) {
+            return;
+        }
+        _numOfIdleWorkers++;
+        _idleCv.wait(lock, [this]() { return _numOfQueuedTasks > 0 || !_running; });
+        _numOfIdleWorkers--;
+    }
+}
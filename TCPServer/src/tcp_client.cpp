@@ -1,3 +1,4 @@
+#include <sys/eventfd.h>
 #include "../include/tcp_client.h"
 #include "../include/common.h"
 
@@ -9,6 +10,7 @@ int TcpClient::numClients;
 TcpClient::TcpClient() {
     _isConnected = false;
     _isClosed = true;
+    _wakeupfd.set(-1);
     id = numClients++;
 }
 
@@ -38,7 +40,9 @@ int TcpClient::getMenuSelection() {
 void TcpClient::printMenu() {
     std::cout << "\n\nDear Client, please choose one of the following options: \n" <<
                  "1. Request another unique number from server\n" <<
-                 "2. Close connection to server and exit\n";
+                 "2. Close connection to server and exit\n" <<
+                 "3. Request the sorted list of my numbers\n" <<
+                 "4. Request ten more unique numbers at once\n";
 }
 
 /*
@@ -58,14 +62,24 @@ pipe_ret_t TcpClient::connectTo(const std::string & address, int port) {
         return pipe_ret_t::failure(strerror(errno));
     }
 
-    startReceivingMessages();
-    _isConnected = true;
+    _isConnected = true; // before the receive thread checks it
+    try {
+        startReceivingMessages();
+    } catch (const std::runtime_error& error) {
+        _isConnected = false;
+        ::close(_sockfd.get());
+        return pipe_ret_t::failure(error.what());
+    }
     _isClosed = false;
 
     return pipe_ret_t::success();
 }
 
 void TcpClient::startReceivingMessages() {
+    _wakeupfd.set(eventfd(0, EFD_CLOEXEC));
+    if (_wakeupfd.get() == -1) {
+        throw std::runtime_error(strerror(errno));
+    }
     _receiveTask = new std::thread(&TcpClient::receiveTask, this);
 }
 
@@ -110,21 +124,74 @@ void TcpClient::setAddress(const std::string& address, int port) {
  * Uses the send function, which initiates transmission of a message from the specified socket to its peer. 
  * Sends message from client to server. 
  * Then, client needs to request a number.
+ * The socket is blocking, so a partial write only means the kernel buffer was
+ * full: the rest is sent as the server reads. Concurrent senders do not interleave.
+ * With a framing set, msg is sent as one framed message.
  */
 pipe_ret_t TcpClient::sendMsg(const char * msg, size_t size) {
-    const size_t numBytesSent = send(_sockfd.get(), msg, size, 0);
+    std::lock_guard<std::mutex> lock(_sendMtx);
+    if (!_framing) {
+        return sendAll(msg, size);
+    }
+    if (!_framing->canFrame(size)) {
+        return pipe_ret_t::failure("message does not fit the framing of the connection");
+    }
+    std::string framedMsg = _framing->header(size);
+    framedMsg.append(msg, size);
+    framedMsg.append(_framing->trailer());
+    return sendAll(framedMsg.data(), framedMsg.size());
+}
 
-    if (numBytesSent < 0 ) { // send failed
-        return pipe_ret_t::failure(strerror(errno));
+/*
+ * Pipeline msgs: each is framed like sendMsg() does, and all of them go out
+ * together, in order, without waiting for responses in between. The server
+ * answers them in order; the protocol's request ids tell the responses apart.
+ * Nothing is sent when one of them can not be framed.
+ */
+pipe_ret_t TcpClient::sendMsgs(const std::vector<std::string> & msgs) {
+    std::string batch;
+    for (const std::string & msg : msgs) {
+        if (_framing && !_framing->canFrame(msg.size())) {
+            return pipe_ret_t::failure("message does not fit the framing of the connection");
+        }
+        if (_framing) {
+            batch.append(_framing->header(msg.size()));
+        }
+        batch.append(msg);
+        if (_framing) {
+            batch.append(_framing->trailer());
+        }
     }
-    if (numBytesSent < size) { // not all bytes were sent
-        char errorMsg[100];
-        sprintf(errorMsg, "Only %lu bytes out of %lu was sent to client", numBytesSent, size);
-        return pipe_ret_t::failure(errorMsg);
+    std::lock_guard<std::mutex> lock(_sendMtx);
+    return sendAll(batch.data(), batch.size());
+}
+
+// write all of data, the caller holds _sendMtx
+pipe_ret_t TcpClient::sendAll(const char * data, size_t size) {
+    size_t numBytesSent = 0;
+    while (numBytesSent < size) {
+        const ssize_t sendResult = send(_sockfd.get(), data + numBytesSent, size - numBytesSent, MSG_NOSIGNAL);
+        if (sendResult == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return pipe_ret_t::failure(strerror(errno)); // send failed
+        }
+        numBytesSent += sendResult;
     }
     return pipe_ret_t::success();
 }
 
+/*
+ * Set how messages are delimited on the connection, in both directions, before connecting.
+ * Observers then get one incomingPacketHandler call per complete message.
+ * Null (the default) means every read is one message and messages are sent as is.
+ */
+void TcpClient::setFraming(const std::shared_ptr<const Framing> & framing) {
+    _framing = framing;
+    _reassembler.setFraming(framing);
+}
+
 void TcpClient::subscribe(const client_observer_t & observer) {
     std::lock_guard<std::mutex> lock(_subscribersMtx);
     _subscibers.push_back(observer);
@@ -165,20 +232,29 @@ void TcpClient::publishServerDisconnected(const pipe_ret_t & ret) {
 }
 
 /*
- * Receive server packets, and notify user
+ * Receive server packets, and notify user. Blocks until the socket is readable
+ * or close() signals the wakeup descriptor.
  */
 void TcpClient::receiveTask() {
     while(_isConnected) {
-        const fd_wait::Result waitResult = fd_wait::waitFor(_sockfd);
+        const fd_wait::Result waitResult = fd_wait::waitFor(_sockfd, _wakeupfd);
 
         if (waitResult == fd_wait::Result::FAILURE) {
+            if (errno == EINTR) {
+                continue;
+            }
             throw std::runtime_error(strerror(errno));
-        } else if (waitResult == fd_wait::Result::TIMEOUT) {
-            continue;
+        } else if (waitResult == fd_wait::Result::WAKEUP) {
+            return;
         }
 
-        char msg[MAX_PACKET_SIZE];
-        const size_t numOfBytesReceived = recv(_sockfd.get(), msg, MAX_PACKET_SIZE, 0);
+        // held only while the read is handled, and grown for bursts of responses
+        const PooledBuffer buffer = BufferPool::shared().acquire(_readSize.size());
+        const char * msg = buffer.data();
+        const ssize_t numOfBytesReceived = recv(_sockfd.get(), buffer.data(), buffer.capacity(), 0);
+        if (numOfBytesReceived > 0) {
+            _readSize.update(numOfBytesReceived);
+        }
 
         if(numOfBytesReceived < 1) {
             std::string errorMsg;
@@ -190,8 +266,16 @@ void TcpClient::receiveTask() {
             _isConnected = false;
             publishServerDisconnected(pipe_ret_t::failure(errorMsg));
             return;
-        } else {
-            publishServerMsg(msg, numOfBytesReceived);
+        }
+
+        // one message per complete frame, however the stream was split into reads
+        const bool isValidStream = _reassembler.feed(msg, numOfBytesReceived, [this](const char * frame, size_t frameSize) {
+            publishServerMsg(frame, frameSize);
+        });
+        if (!isValidStream) {
+            _isConnected = false;
+            publishServerDisconnected(pipe_ret_t::failure("Invalid frame"));
+            return;
         }
     }
 }
@@ -200,10 +284,17 @@ void TcpClient::terminateReceiveThread() {
     _isConnected = false;
 
     if (_receiveTask) {
+        const uint64_t one = 1;
+        const ssize_t numBytesWritten = ::write(_wakeupfd.get(), &one, sizeof(one));
+        (void)numBytesWritten; // counter can not overflow with a single write
         _receiveTask->join();
         delete _receiveTask;
         _receiveTask = nullptr;
     }
+    if (_wakeupfd.get() != -1) {
+        ::close(_wakeupfd.get());
+        _wakeupfd.set(-1);
+    }
 }
 
 pipe_ret_t TcpClient::close(){
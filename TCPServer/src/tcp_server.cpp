@@ -1,14 +1,171 @@
 #include <string>
 #include <functional>
 #include <algorithm>
+#include <future>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
 #include "../include/tcp_server.h"
 #include "../include/common.h"
+#include "../include/cpu_placement.h"
+
+#define MAX_ACCEPTS_PER_BATCH 64
+#define DEAD_CLIENTS_REMOVAL_INTERVAL_MS 2000
+
+namespace {
+    /*
+     * Thread safe replacement of inet_ntoa(), which returns a static buffer
+     * shared by every accepting thread
+     */
+    std::string ipToString(const struct sockaddr_in & address) {
+        char ip[INET_ADDRSTRLEN];
+        if (inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip)) == nullptr) {
+            return "";
+        }
+        return ip;
+    }
+
+    using subscribers_t = std::vector<subscriber_index_t::entry_t>;
+
+    template <typename Key>
+    const subscribers_t & subscribersOf(const std::unordered_map<Key, subscribers_t> & subscribersByKey, Key key) {
+        static const subscribers_t noSubscribers;
+        if (subscribersByKey.empty()) { // the common case, spare hashing the key
+            return noSubscribers;
+        }
+        const auto keySubscribers = subscribersByKey.find(key);
+        return (keySubscribers != subscribersByKey.end()) ? keySubscribers->second : noSubscribers;
+    }
+
+    /*
+     * Call onSubscriber with every observer of a client, in subscription order:
+     * the ones wanting its connection, the ones wanting its address and, unless
+     * includeWildcard is false, the ones wanting every client.
+     */
+    template <typename Callback>
+    void forEachSubscriber(const subscriber_index_t & index, connection_handle_t connection, in_addr_t clientAddress,
+                           bool includeWildcard, const Callback & onSubscriber) {
+        static const subscribers_t noSubscribers;
+        const subscribers_t * lists[] = {
+            &subscribersOf(index.byConnection, connection),
+            &subscribersOf(index.byAddress, clientAddress),
+            includeWildcard ? &index.wildcard : &noSubscribers
+        };
+        if (lists[0]->empty() && lists[1]->empty()) { // only wildcard observers, nothing to merge
+            for (const subscriber_index_t::entry_t & entry : *lists[2]) {
+                onSubscriber(entry.observer);
+            }
+            return;
+        }
+        subscribers_t::const_iterator positions[] = { lists[0]->begin(), lists[1]->begin(), lists[2]->begin() };
+
+        while (true) {
+            int next = -1;
+            for (int i = 0; i < 3; i++) {
+                if (positions[i] != lists[i]->end() && (next == -1 || positions[i]->id < positions[next]->id)) {
+                    next = i;
+                }
+            }
+            if (next == -1) {
+                return;
+            }
+            onSubscriber((positions[next]++)->observer);
+        }
+    }
+
+    // index of the I/O loop running on this thread, its lane on every handler worker
+    thread_local size_t currentIoLoopIndex = ThreadPool::ANY_PRODUCER;
+
+    /*
+     * Event loops the clients are served by: one per acceptor, else numOfIoThreads,
+     * else one per hardware thread
+     */
+    size_t numOfIoLoopsFor(const server_options_t & options) {
+        const size_t numOfIoLoops = (options.numOfAcceptors > 0) ? options.numOfAcceptors : options.numOfIoThreads;
+        return (numOfIoLoops > 0) ? numOfIoLoops : std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // versions are unique across servers, so a cached snapshot is never taken for another server's
+    std::atomic<uint64_t> nextSubscribersVersion(1);
+
+    /*
+     * The subscribers snapshot this thread published from last. Publishing only
+     * checks that its version is still current, so publishing threads write to no
+     * shared memory and take no lock until the subscribers change. Snapshots
+     * replaced while a publish of this thread is under way (a callback publishing
+     * in turn) are kept until the outermost publish returns.
+     */
+    struct subscribers_cache_t {
+        uint64_t version = 0;
+        std::shared_ptr<const subscriber_index_t> subscribers;
+        size_t publishDepth = 0;
+        std::vector<std::shared_ptr<const subscriber_index_t>> replaced;
+    };
+
+    thread_local subscribers_cache_t subscribersCache;
+
+    struct publish_scope_t {
+        publish_scope_t() { subscribersCache.publishDepth++; }
+        ~publish_scope_t() {
+            if (--subscribersCache.publishDepth == 0) {
+                subscribersCache.replaced.clear();
+            }
+        }
+    };
+
+    void eraseSubscription(std::vector<subscriber_index_t::entry_t> & entries, subscription_id_t subscriptionId, bool & isErased) {
+        const auto entry = std::find_if(entries.begin(), entries.end(),
+                                        [subscriptionId](const subscriber_index_t::entry_t & e) { return e.id == subscriptionId; });
+        if (entry != entries.end()) {
+            entries.erase(entry);
+            isErased = true;
+        }
+    }
+
+    /*
+     * A thread left where the kernel put it still works, only slower, so failing to
+     * pin one does not fail start(); it is reported on stderr
+     */
+    void reportPinFailure(const std::string & threads, const std::vector<int> & cpus) {
+        std::cerr << "TcpServer: could not pin " << threads << " to " << cpu_placement::describe(cpus) << "\n";
+    }
+
+    std::string describeAffinity(const std::vector<int> & cpus) {
+        return cpus.empty() ? "affinity unknown" : cpu_placement::describe(cpus);
+    }
+
+    /*
+     * One line for workers sharing an affinity, else one line per worker
+     */
+    template <typename Workers>
+    void reportWorkerPlacement(const std::string & name, const Workers & workers) {
+        std::vector<std::vector<int>> cpusOfWorkers;
+        for (size_t i = 0; i < workers.size(); i++) {
+            cpusOfWorkers.push_back(workers.cpusOf(i));
+        }
+        if (std::all_of(cpusOfWorkers.begin(), cpusOfWorkers.end(),
+                        [&cpusOfWorkers](const std::vector<int> & cpus) { return cpus == cpusOfWorkers.front(); })) {
+            std::cout << "  " << workers.size() << " " << name << " threads: " << describeAffinity(cpusOfWorkers.front()) << "\n";
+            return;
+        }
+        for (size_t i = 0; i < cpusOfWorkers.size(); i++) {
+            std::cout << "  " << name << " thread " << i << ": " << describeAffinity(cpusOfWorkers[i]) << "\n";
+        }
+    }
+}
+#ifdef IO_URING_BACKEND
+#include "../include/io_uring_loop.h"
+#endif
 
 
 TcpServer::TcpServer() {
-    _subscribers.reserve(20);
+    _subscribers = std::make_shared<const subscriber_index_t>();
+    _subscribersVersion = nextSubscribersVersion++;
+    _nextConnectionHandle = 1;
+    numClientsConnected = 0;
     _clients.reserve(20);
-    _stopRemoveClientsTask = false;
+    _nextEventLoop = 0;
 }
 
 TcpServer::~TcpServer() {
@@ -20,10 +177,99 @@ TcpServer::~TcpServer() {
  * Observers register with the provider. 
  * Whenever a predefined condition, event, or state change occurs, 
  * the provider automatically notifies all observers by calling one of their methods. 
+ * An observer is indexed by its wantedConnection or wantedIP once here, so publishing
+ * never compares addresses as strings. A wantedIP that is not an IPv4 address matches no client.
+ * Returns the id to unsubscribe the observer with. Can be called from observer callbacks.
  */
-void TcpServer::subscribe(const server_observer_t & observer) {
+subscription_id_t TcpServer::subscribe(const server_observer_t & observer) {
     std::lock_guard<std::mutex> lock(_subscribersMtx);
-    _subscribers.push_back(observer);
+    auto subscribers = std::make_shared<subscriber_index_t>(*_subscribers);
+    const subscriber_index_t::entry_t entry{subscribers->nextId++, observer};
+    if (observer.wantedConnection != 0) {
+        subscribers->byConnection[observer.wantedConnection].push_back(entry);
+    } else if (observer.wantedIP.empty()) {
+        subscribers->wildcard.push_back(entry);
+    } else {
+        struct in_addr wantedAddress;
+        if (inet_pton(AF_INET, observer.wantedIP.c_str(), &wantedAddress) == 1) {
+            subscribers->byAddress[wantedAddress.s_addr].push_back(entry);
+        }
+    }
+    replaceSubscribers(subscribers);
+    return entry.id;
+}
+
+/*
+ * Stop notifying an observer. Publishes already under way may still call it.
+ * Returns false when there is no such subscription. Can be called from observer callbacks.
+ */
+bool TcpServer::unsubscribe(subscription_id_t subscriptionId) {
+    std::lock_guard<std::mutex> lock(_subscribersMtx);
+    auto subscribers = std::make_shared<subscriber_index_t>(*_subscribers);
+    bool isErased = false;
+    eraseSubscription(subscribers->wildcard, subscriptionId, isErased);
+    for (auto connectionSubscribers = subscribers->byConnection.begin(); !isErased && connectionSubscribers != subscribers->byConnection.end(); ) {
+        eraseSubscription(connectionSubscribers->second, subscriptionId, isErased);
+        if (connectionSubscribers->second.empty()) {
+            connectionSubscribers = subscribers->byConnection.erase(connectionSubscribers);
+        } else {
+            ++connectionSubscribers;
+        }
+    }
+    for (auto addressSubscribers = subscribers->byAddress.begin(); !isErased && addressSubscribers != subscribers->byAddress.end(); ) {
+        eraseSubscription(addressSubscribers->second, subscriptionId, isErased);
+        if (addressSubscribers->second.empty()) {
+            addressSubscribers = subscribers->byAddress.erase(addressSubscribers);
+        } else {
+            ++addressSubscribers;
+        }
+    }
+    if (isErased) {
+        replaceSubscribers(subscribers);
+    }
+    return isErased;
+}
+
+/*
+ * End the subscriptions to a connection once its disconnection was published
+ */
+void TcpServer::dropConnectionSubscriptions(connection_handle_t connection) {
+    std::lock_guard<std::mutex> lock(_subscribersMtx);
+    if (_subscribers->byConnection.count(connection) == 0) {
+        return;
+    }
+    auto subscribers = std::make_shared<subscriber_index_t>(*_subscribers);
+    subscribers->byConnection.erase(connection);
+    replaceSubscribers(subscribers);
+}
+
+/*
+ * Publish a new subscribers snapshot. Called with _subscribersMtx held. The
+ * snapshot is stored before the version, so a publisher seeing the new version
+ * loads the new snapshot.
+ */
+void TcpServer::replaceSubscribers(const std::shared_ptr<const subscriber_index_t> & subscribers) {
+    std::atomic_store(&_subscribers, subscribers);
+    _subscribersVersion.store(nextSubscribersVersion++, std::memory_order_release);
+}
+
+/*
+ * The subscribers of this thread's last publish, picked up again only after they
+ * changed, so publishers never lock and only touch the shared reference count
+ * after a change; callbacks run without any lock held. A snapshot newer than the
+ * version read is only loaded again next time. Only valid within a publish_scope_t.
+ */
+const subscriber_index_t & TcpServer::subscribersSnapshot() {
+    subscribers_cache_t & cache = subscribersCache;
+    const uint64_t version = _subscribersVersion.load(std::memory_order_acquire);
+    if (cache.version != version) {
+        if (cache.subscribers && cache.publishDepth > 1) {
+            cache.replaced.push_back(std::move(cache.subscribers));
+        }
+        cache.subscribers = std::atomic_load(&_subscribers);
+        cache.version = version;
+    }
+    return *cache.subscribers;
 }
 
 /**
@@ -70,38 +316,47 @@ void TcpServer::sortList(int ID, std::string clientFileName){
 }
 
 /**
- * Remove dead clients (disconnected) from clients vector periodically
+ * Remove dead clients (disconnected) from clients vector. Runs periodically on the timer loop.
+ * They are closed after _clientsMtx is released: closing waits for their event loops,
+ * which may be waiting for _clientsMtx to register clients they accepted.
  */
 void TcpServer::removeDeadClients() {
-    std::vector<Client*>::const_iterator clientToRemove;
-    while (!_stopRemoveClientsTask) {
-        {
-            std::lock_guard<std::mutex> lock(_clientsMtx);
-            do {
-                clientToRemove = std::find_if(_clients.begin(), _clients.end(),
-                                              [](Client *client) { return !client->isConnected(); });
-
-                if (clientToRemove != _clients.end()) {
-                    (*clientToRemove)->close();
-                    delete *clientToRemove;
-                    _clients.erase(clientToRemove);
-                }
-            } while (clientToRemove != _clients.end());
+    std::vector<Client*> deadClients;
+    {
+        std::lock_guard<std::mutex> lock(_clientsMtx);
+        const auto deadClientsBegin = std::stable_partition(_clients.begin(), _clients.end(),
+                                                            [](Client *client) { return client->isConnected(); });
+        deadClients.assign(deadClientsBegin, _clients.end());
+        _clients.erase(deadClientsBegin, _clients.end());
+        for (const Client * deadClient : deadClients) {
+            removeFromShard(deadClient);
+            _clientsByHandle.erase(deadClient->getHandle());
         }
+    }
+    for (Client * deadClient : deadClients) {
+        deadClient->close();
+        delete deadClient;
+    }
+}
 
-        sleep(2);
+/**
+ * Start the loop running the server wide timers. It only wakes up when a timer is due.
+ */
+void TcpServer::startTimerLoop(const server_options_t & options) {
+    _timerLoop = new EventLoop();
+    _timerLoop->start();
+    if (options.removeDeadClientsAutomatically) {
+        _timerLoop->runEvery(DEAD_CLIENTS_REMOVAL_INTERVAL_MS, [this]() { removeDeadClients(); });
     }
 }
 
 /**
- * Terminate dead client remover thread. 
+ * Stop the timer loop. Pending timers are dropped; the loop itself is deleted by
+ * close() after the clients, whose idle timers may still refer to it.
  */
-void TcpServer::terminateDeadClientsRemover() {
-    if (_clientsRemoverThread) {
-        _stopRemoveClientsTask = true;
-        _clientsRemoverThread->join(); //terminates dead client remover thread 
-        delete _clientsRemoverThread;
-        _clientsRemoverThread = nullptr;
+void TcpServer::stopTimerLoop() {
+    if (_timerLoop) {
+        _timerLoop->stop();
     }
 }
 
@@ -109,15 +364,67 @@ void TcpServer::terminateDeadClientsRemover() {
  * Handle different client events. Subscriber callbacks should be short and fast, and must not
  * call other server functions to avoid deadlock
  */
-void TcpServer::clientEventHandler(const Client &client, ClientEvent event, const std::string &msg) {
+void TcpServer::clientEventHandler(const Client &client, ClientEvent event, const char * data, size_t size) {
+    if (_handlerPool) {
+        dispatchToHandlerPool(client, event, data, size);
+        if (event == ClientEvent::DISCONNECTED) {
+            numClientsConnected--;
+        }
+        return;
+    }
+
     switch (event) {
         case ClientEvent::DISCONNECTED: {
-            publishClientDisconnected(client.getIp(), msg);
+            publishClientDisconnected(client.getHandle(), client.getAddress(), client.getIp(), std::string(data, size));
             numClientsConnected--;
             break;
         }
+        case ClientEvent::INCOMING_MSG: { // observers read straight from the receive buffer
+            publishClientMsg(client.getHandle(), client.getAddress(), client.getIp(), data, size);
+            break;
+        }
+        case ClientEvent::SEND_PAUSED:
+        case ClientEvent::SEND_RESUMED: {
+            publishClientBackpressure(client.getHandle(), client.getAddress(), client.getIp(), event == ClientEvent::SEND_PAUSED);
+            break;
+        }
+    }
+}
+
+/*
+ * Hand a client event over to the handler pool, so the I/O thread can go back
+ * to reading right away. Events of one client always go to the same worker,
+ * through the lane the client's loop has on it, so they are published in the
+ * order they were received. The data outlives
+ * the read it came from here, so this is the one path copying it.
+ */
+void TcpServer::dispatchToHandlerPool(const Client &client, ClientEvent event, const char * data, size_t size) {
+    const connection_handle_t connection = client.getHandle();
+    const in_addr_t clientAddress = client.getAddress();
+    const std::string clientIP = client.getIp();
+    const size_t workerKey = static_cast<size_t>(client._sockfd.get());
+    const size_t producer = currentIoLoopIndex; // events of a client are all raised on its loop
+    const std::string msg(data, size);
+
+    switch (event) {
+        case ClientEvent::DISCONNECTED: {
+            _handlerPool->submit(workerKey, [this, connection, clientAddress, clientIP, msg]() {
+                publishClientDisconnected(connection, clientAddress, clientIP, msg);
+            }, producer);
+            break;
+        }
         case ClientEvent::INCOMING_MSG: {
-            publishClientMsg(client, msg.c_str(), msg.size());
+            _handlerPool->submit(workerKey, [this, connection, clientAddress, clientIP, msg]() {
+                publishClientMsg(connection, clientAddress, clientIP, msg.c_str(), msg.size());
+            }, producer);
+            break;
+        }
+        case ClientEvent::SEND_PAUSED:
+        case ClientEvent::SEND_RESUMED: {
+            const bool isPaused = (event == ClientEvent::SEND_PAUSED);
+            _handlerPool->submit(workerKey, [this, connection, clientAddress, clientIP, isPaused]() {
+                publishClientBackpressure(connection, clientAddress, clientIP, isPaused);
+            }, producer);
             break;
         }
     }
@@ -129,34 +436,66 @@ void TcpServer::clientEventHandler(const Client &client, ClientEvent event, cons
  * from clients with IP address identical to
  * the specific observer requested IP
  */
-void TcpServer::publishClientMsg(const Client & client, const char * msg, size_t msgSize) {
-    std::lock_guard<std::mutex> lock(_subscribersMtx);
+void TcpServer::publishClientMsg(connection_handle_t connection, in_addr_t clientAddress, const std::string &clientIP, const char * msg, size_t msgSize) {
+    const publish_scope_t scope;
+    const subscriber_index_t & subscribers = subscribersSnapshot();
 
-    for (const server_observer_t& subscriber : _subscribers) {
-        if (subscriber.wantedIP == client.getIp() || subscriber.wantedIP.empty()) {
-            if (subscriber.incomingPacketHandler) { //checks to make sure the server has a packet handler
-                subscriber.incomingPacketHandler(client.getIp(), msg, msgSize); //sends the client message to the handler
-            }
+    forEachSubscriber(subscribers, connection, clientAddress, true, [&](const server_observer_t& subscriber) {
+        if (subscriber.incomingPacketHandler) { //checks to make sure the server has a packet handler
+            subscriber.incomingPacketHandler(connection, clientIP, msg, msgSize); //sends the client message to the handler
         }
-    }
+    });
+}
+
+/*
+ * Tell observers to pause or resume sending to a client whose outbound queue
+ * crossed a watermark. Same IP matching as incoming messages.
+ */
+void TcpServer::publishClientBackpressure(connection_handle_t connection, in_addr_t clientAddress, const std::string &clientIP, bool isPaused) {
+    const publish_scope_t scope;
+    const subscriber_index_t & subscribers = subscribersSnapshot();
+
+    forEachSubscriber(subscribers, connection, clientAddress, true, [&](const server_observer_t& subscriber) {
+        if (subscriber.sendBackpressureHandler) {
+            subscriber.sendBackpressureHandler(connection, clientIP, isPaused);
+        }
+    });
+}
+
+/*
+ * Publish newly accepted client to observers.
+ * Observers get only notify about clients
+ * with IP address identical to the specific
+ * observer requested IP (or every client when no IP was requested)
+ */
+void TcpServer::publishClientAccepted(const Client & client) {
+    const publish_scope_t scope;
+    const subscriber_index_t & subscribers = subscribersSnapshot();
+
+    forEachSubscriber(subscribers, client.getHandle(), client.getAddress(), true, [&](const server_observer_t& subscriber) {
+        if (subscriber.clientAcceptedHandler) {
+            subscriber.clientAcceptedHandler(client);
+        }
+    });
 }
 
 /*
  * Publish client disconnection to observer.
  * Observers get only notify about clients
  * with IP address identical to the specific
- * observer requested IP
+ * observer requested IP, or about the connection they requested.
+ * Subscriptions to the connection end here.
  */
-void TcpServer::publishClientDisconnected(const std::string &clientIP, const std::string &clientMsg) {
-    std::lock_guard<std::mutex> lock(_subscribersMtx);
+void TcpServer::publishClientDisconnected(connection_handle_t connection, in_addr_t clientAddress, const std::string &clientIP, const std::string &clientMsg) {
+    const publish_scope_t scope;
+    const subscriber_index_t & subscribers = subscribersSnapshot();
 
-    for (const server_observer_t& subscriber : _subscribers) {
-        if (subscriber.wantedIP == clientIP) {
-            if (subscriber.disconnectionHandler) {
-                subscriber.disconnectionHandler(clientIP, clientMsg);
-            }
+    forEachSubscriber(subscribers, connection, clientAddress, false, [&](const server_observer_t& subscriber) {
+        if (subscriber.disconnectionHandler) {
+            subscriber.disconnectionHandler(connection, clientIP, clientMsg);
         }
-    }
+    });
+    dropConnectionSubscriptions(connection);
 }
 
 /*
@@ -164,19 +503,471 @@ void TcpServer::publishClientDisconnected(const std::string &clientIP, const std
  * Returns whether the server was successfully binded to port/socket.
  */
 pipe_ret_t TcpServer::start(int port, int maxNumOfClients, bool removeDeadClientsAutomatically) {
-    if (removeDeadClientsAutomatically) {
-        _clientsRemoverThread = new std::thread(&TcpServer::removeDeadClients, this);
+    server_options_t options;
+    options.maxNumOfClients = maxNumOfClients;
+    options.removeDeadClientsAutomatically = removeDeadClientsAutomatically;
+    return start(port, options);
+}
+
+pipe_ret_t TcpServer::start(int port, const server_options_t & options) {
+#ifndef IO_URING_BACKEND
+    if (options.ioBackend == IoBackend::IO_URING) {
+        return pipe_ret_t::failure("io_uring backend is not built, configure with -DIO_URING_BACKEND=ON");
+    }
+#endif
+    _clientIdleTimeoutMs = options.clientIdleTimeoutMs;
+    _outboundHighWatermark = options.outboundHighWatermark;
+    _outboundLowWatermark = options.outboundLowWatermark;
+    _coalesceSends = options.coalesceSends;
+    _zeroCopyThreshold = options.zeroCopyThreshold;
+    _framing = options.framing;
+    startTimerLoop(options);
+    if (options.numOfHandlerThreads > 0) {
+        // io_uring loops hand events over through the workers' shared lanes
+        const size_t numOfProducers = (options.ioBackend == IoBackend::EPOLL) ? numOfIoLoopsFor(options) : 0;
+        _handlerPool = new ThreadPool(options.numOfHandlerThreads, options.handlerQueueCapacity, numOfProducers);
+        _handlerPool->start();
+    }
+    if (options.numOfTaskThreads > 0) {
+        _taskScheduler = new TaskScheduler(options.numOfTaskThreads);
+        _taskScheduler->start();
     }
     try {
-        initializeSocket();
-        bindAddress(port);
-        listenToClients(maxNumOfClients);
+        const bool multiAcceptorMode = (options.numOfAcceptors > 0);
+        if (multiAcceptorMode) {
+            openAcceptorSockets(port, options);
+        } else {
+            initializeSocket();
+            bindAddress(port);
+            listenToClients(options.maxNumOfClients);
+        }
+
+        if (options.ioBackend == IoBackend::IO_URING) {
+            startIoUringLoops(options);
+        } else if (multiAcceptorMode) {
+            startEventLoops(options.numOfAcceptors, options);
+            startAcceptors();
+        } else {
+            startEventLoops(options.numOfIoThreads, options);
+            _acceptLoop = new EventLoop();
+        }
     } catch (const std::runtime_error &error) {
         return pipe_ret_t::failure(error.what());
     }
+    placeThreads(options);
+    if (options.reportPlacement) {
+        reportPlacement();
+    }
     return pipe_ret_t::success();
 }
 
+/*
+ * Start the event loops that own the client sockets. Accepted clients are
+ * spread over the loops round robin, so a handful of threads serve every client.
+ */
+void TcpServer::startEventLoops(size_t numOfIoThreads, const server_options_t & options) {
+    if (numOfIoThreads == 0) {
+        numOfIoThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < numOfIoThreads; i++) {
+        EventLoop * eventLoop = new EventLoop();
+        eventLoop->start();
+        eventLoop->queueInLoop([i]() { currentIoLoopIndex = i; }); // runs before any client is added
+        _eventLoops.push_back(eventLoop);
+
+        int cpu = ioCpuFor(i, options);
+        if (cpu != -1 && !eventLoop->pinToCpu(cpu)) {
+            reportPinFailure("I/O loop " + std::to_string(i), std::vector<int>(1, cpu));
+            cpu = -1;
+        }
+        _ioLoopCpus.push_back(cpu);
+    }
+
+    // decided before any client is accepted, the accepting threads read it unsynchronized
+    std::vector<int> pinnedCpus;
+    for (int cpu : _ioLoopCpus) {
+        if (cpu != -1) {
+            pinnedCpus.push_back(cpu);
+        }
+    }
+    _allocateClientsOnLoops = (cpu_placement::numaNodesOf(pinnedCpus).size() > 1);
+    createClientShards();
+}
+
+/*
+ * The cpu I/O loop number loopIndex is pinned to, or -1 to leave it unpinned
+ */
+int TcpServer::ioCpuFor(size_t loopIndex, const server_options_t & options) const {
+    if (!options.ioCpus.empty()) {
+        return options.ioCpus[loopIndex % options.ioCpus.size()];
+    }
+    if (options.numOfAcceptors > 0) {
+        const unsigned numOfCpus = std::max(1u, std::thread::hardware_concurrency());
+        return static_cast<int>(loopIndex % numOfCpus);
+    }
+    return -1;
+}
+
+/*
+ * Pin the handler, task and timer threads. Called once every thread is started.
+ */
+void TcpServer::placeThreads(const server_options_t & options) {
+    if (_handlerPool && !_handlerPool->pinToCpus(options.workerCpus)) {
+        reportPinFailure("the handler threads", options.workerCpus);
+    }
+    if (_taskScheduler && !_taskScheduler->pinToCpus(options.workerCpus)) {
+        reportPinFailure("the task threads", options.workerCpus);
+    }
+    if (!_timerLoop->pinToCpus(options.workerCpus)) {
+        reportPinFailure("the timer thread", options.workerCpus);
+    }
+}
+
+/*
+ * Print the cpus every thread may run on, as the kernel has them, so a pin that
+ * failed or was narrowed by a cgroup shows
+ */
+void TcpServer::reportPlacement() const {
+    std::cout << "TcpServer thread placement:\n";
+    for (size_t i = 0; i < _eventLoops.size(); i++) {
+        std::cout << "  I/O loop " << i << ": " << describeAffinity(_eventLoops[i]->cpus()) << "\n";
+    }
+#ifdef IO_URING_BACKEND
+    for (size_t i = 0; i < _ioUringLoops.size(); i++) {
+        std::cout << "  I/O loop " << i << ": " << describeAffinity(_ioUringLoops[i]->cpus()) << "\n";
+    }
+#endif
+    if (_handlerPool) {
+        reportWorkerPlacement("handler", *_handlerPool);
+    }
+    if (_taskScheduler) {
+        reportWorkerPlacement("task", *_taskScheduler);
+    }
+    std::cout << "  timer thread: " << describeAffinity(_timerLoop->cpus()) << "\n";
+    if (_allocateClientsOnLoops) {
+        std::cout << "  client state is allocated on the NUMA node of the loop serving the client\n";
+    }
+}
+
+/*
+ * One shard per event loop, plus one for clients without a loop. Created
+ * before any client is accepted, and left in place until the server is closed.
+ */
+void TcpServer::createClientShards() {
+    for (EventLoop * eventLoop : _eventLoops) {
+        client_shard_t * shard = new client_shard_t();
+        shard->eventLoop = eventLoop;
+        _clientShards.push_back(shard);
+    }
+    _clientShards.push_back(new client_shard_t());
+}
+
+void TcpServer::clearClientShards() {
+    for (client_shard_t * shard : _clientShards) {
+        std::lock_guard<std::mutex> lock(shard->clientsMtx);
+        shard->clients.clear();
+    }
+}
+
+void TcpServer::deleteClientShards() {
+    for (client_shard_t * shard : _clientShards) {
+        delete shard;
+    }
+    _clientShards.clear();
+}
+
+TcpServer::client_shard_t * TcpServer::shardOf(const Client * client) const {
+    for (client_shard_t * shard : _clientShards) {
+        if (shard->eventLoop == client->eventLoop()) {
+            return shard;
+        }
+    }
+    return _clientShards.back();
+}
+
+/*
+ * Must be called before the client is deleted: once this returns, no broadcast touches it
+ */
+void TcpServer::removeFromShard(const Client * client) {
+    client_shard_t * shard = shardOf(client);
+    std::lock_guard<std::mutex> lock(shard->clientsMtx);
+    const auto clientIter = std::find(shard->clients.begin(), shard->clients.end(), client);
+    if (clientIter != shard->clients.end()) {
+        *clientIter = shard->clients.back();
+        shard->clients.pop_back();
+    }
+}
+
+void TcpServer::stopEventLoops() {
+    for (EventLoop * eventLoop : _eventLoops) {
+        eventLoop->stop();
+        delete eventLoop;
+    }
+    _eventLoops.clear();
+    _ioLoopCpus.clear();
+}
+
+EventLoop * TcpServer::nextEventLoop() {
+    return _eventLoops[_nextEventLoop++ % _eventLoops.size()];
+}
+
+/*
+ * Multi acceptor mode: every event loop gets its own listening socket bound to the
+ * same port with SO_REUSEPORT, and the loop thread is pinned to its own cpu.
+ * The kernel spreads incoming connections over the listeners, and each loop
+ * accepts and serves its connections without touching the other loops.
+ */
+void TcpServer::openAcceptorSockets(int port, const server_options_t & options) {
+    memset(&_serverAddress, 0, sizeof(_serverAddress));
+    _serverAddress.sin_family = AF_INET;
+    _serverAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+    _serverAddress.sin_port = htons(port);
+
+    for (size_t i = 0; i < options.numOfAcceptors; i++) {
+        const int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sockfd == -1) {
+            throw std::runtime_error(strerror(errno));
+        }
+        FileDescriptor acceptorSockfd;
+        acceptorSockfd.set(sockfd);
+        _acceptorSockfds.push_back(acceptorSockfd);
+
+        const int option = 1;
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &option, sizeof(option)) == -1) {
+            throw std::runtime_error(strerror(errno));
+        }
+        if (bind(sockfd, (struct sockaddr *)&_serverAddress, sizeof(_serverAddress)) == -1) {
+            throw std::runtime_error(strerror(errno));
+        }
+        if (listen(sockfd, options.maxNumOfClients) == -1) {
+            throw std::runtime_error(strerror(errno));
+        }
+    }
+}
+
+void TcpServer::startAcceptors() {
+    for (size_t i = 0; i < _acceptorSockfds.size(); i++) {
+        const int sockfd = _acceptorSockfds[i].get();
+        EventLoop * eventLoop = _eventLoops[i];
+        eventLoop->add(sockfd, EPOLLIN, [this, sockfd, eventLoop](uint32_t) {
+            acceptPendingClients(sockfd, eventLoop);
+        });
+    }
+}
+
+void TcpServer::closeAcceptors() {
+    for (size_t i = 0; i < _acceptorSockfds.size(); i++) {
+        if (i < _eventLoops.size()) {
+            _eventLoops[i]->remove(_acceptorSockfds[i].get());
+        }
+        ::close(_acceptorSockfds[i].get());
+    }
+    _acceptorSockfds.clear();
+}
+
+/*
+ * Accept every connection pending on a non blocking listening socket, in batches.
+ * Accepted clients are served by eventLoop, or spread round robin over the
+ * event loops when eventLoop is null.
+ */
+void TcpServer::acceptPendingClients(int listeningSockfd, EventLoop * eventLoop) {
+    std::vector<accepted_client_t> acceptedClients;
+    acceptedClients.reserve(MAX_ACCEPTS_PER_BATCH);
+
+    bool backlogDrained = false;
+    while (!backlogDrained) {
+        while (acceptedClients.size() < MAX_ACCEPTS_PER_BATCH) {
+            struct sockaddr_in clientAddress;
+            socklen_t socketSize = sizeof(clientAddress);
+            const int fileDescriptor = accept4(listeningSockfd, (struct sockaddr*)&clientAddress, &socketSize,
+                                               SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fileDescriptor == -1) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                backlogDrained = true; // EAGAIN. anything else is retried on the next wakeup
+                break;
+            }
+            accepted_client_t acceptedClient;
+            acceptedClient.sockfd = fileDescriptor;
+            acceptedClient.address = clientAddress;
+            acceptedClient.eventLoop = eventLoop ? eventLoop : nextEventLoop();
+            acceptedClients.push_back(acceptedClient);
+        }
+        registerClients(createClients(acceptedClients));
+        acceptedClients.clear();
+    }
+}
+
+/*
+ * Create the Client objects of a batch of accepted sockets. When the I/O loops
+ * span several NUMA nodes, each loop creates its own clients (one round trip
+ * per loop and batch), so first touch places their state on the loop's node.
+ */
+std::vector<Client*> TcpServer::createClients(const std::vector<accepted_client_t> & acceptedClients) {
+    std::vector<Client*> newClients(acceptedClients.size(), nullptr);
+    const auto createClient = [&acceptedClients, &newClients](size_t i) {
+        const accepted_client_t & acceptedClient = acceptedClients[i];
+        Client * newClient = new Client(acceptedClient.sockfd);
+        newClient->setIp(ipToString(acceptedClient.address));
+        newClient->setAddress(acceptedClient.address.sin_addr.s_addr);
+        newClient->setEventLoop(acceptedClient.eventLoop);
+        newClients[i] = newClient;
+    };
+
+    if (!_allocateClientsOnLoops) {
+        for (size_t i = 0; i < acceptedClients.size(); i++) {
+            createClient(i);
+        }
+        return newClients;
+    }
+
+    std::unordered_map<EventLoop*, std::vector<size_t>> clientIndicesByLoop;
+    for (size_t i = 0; i < acceptedClients.size(); i++) {
+        clientIndicesByLoop[acceptedClients[i].eventLoop].push_back(i);
+    }
+    for (const auto & loopAndIndices : clientIndicesByLoop) {
+        const std::vector<size_t> & clientIndices = loopAndIndices.second;
+        loopAndIndices.first->runInLoopAndWait([&createClient, &clientIndices]() {
+            for (size_t i : clientIndices) {
+                createClient(i);
+            }
+        });
+    }
+    return newClients;
+}
+
+/*
+ * io_uring backend: one ring per I/O thread (or per SO_REUSEPORT listener), each
+ * running a multishot accept on the listening socket and serving the clients it accepted.
+ */
+void TcpServer::startIoUringLoops(const server_options_t & options) {
+    createClientShards();
+#ifdef IO_URING_BACKEND
+    const bool multiAcceptorMode = !_acceptorSockfds.empty();
+    size_t numOfLoops = multiAcceptorMode ? _acceptorSockfds.size() : options.numOfIoThreads;
+    if (numOfLoops == 0) {
+        numOfLoops = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < numOfLoops; i++) {
+        IoUringLoop * ioUringLoop = new IoUringLoop();
+        _ioUringLoops.push_back(ioUringLoop);
+        ioUringLoop->start();
+
+        // clients are created on the ring's own thread, so their state is NUMA local already
+        const int listeningSockfd = multiAcceptorMode ? _acceptorSockfds[i].get() : _sockfd.get();
+        int cpu = ioCpuFor(i, options);
+        if (cpu != -1 && !ioUringLoop->pinToCpu(cpu)) {
+            reportPinFailure("I/O loop " + std::to_string(i), std::vector<int>(1, cpu));
+            cpu = -1;
+        }
+        _ioLoopCpus.push_back(cpu);
+        ioUringLoop->acceptOn(listeningSockfd, [this, ioUringLoop](int fileDescriptor, const struct sockaddr_in & clientAddress) {
+            auto newClient = new Client(fileDescriptor);
+            newClient->setIoUringLoop(ioUringLoop);
+            registerClient(newClient, clientAddress);
+        });
+    }
+#else
+    (void)options;
+#endif
+}
+
+/*
+ * Stop the io_uring loop threads, so nothing is accepted or received anymore.
+ * The rings themselves are released by deleteIoUringLoops(), after the clients are closed.
+ */
+void TcpServer::stopIoUringLoops() {
+#ifdef IO_URING_BACKEND
+    for (IoUringLoop * ioUringLoop : _ioUringLoops) {
+        ioUringLoop->stop();
+    }
+#endif
+}
+
+void TcpServer::deleteIoUringLoops() {
+#ifdef IO_URING_BACKEND
+    for (IoUringLoop * ioUringLoop : _ioUringLoops) {
+        delete ioUringLoop;
+    }
+    _ioUringLoops.clear();
+    _ioLoopCpus.clear();
+#endif
+}
+
+/*
+ * Start serving an accepted client on the event loop (or io_uring loop) it was assigned to.
+ */
+Client * TcpServer::registerClient(Client * newClient, const struct sockaddr_in & clientAddress) {
+    newClient->setIp(ipToString(clientAddress));
+    newClient->setAddress(clientAddress.sin_addr.s_addr);
+    registerClients(std::vector<Client*>(1, newClient));
+    return newClient;
+}
+
+/*
+ * Start serving a batch of accepted clients. The clients list is locked once
+ * for the whole batch, and observers are notified after it is released.
+ */
+void TcpServer::registerClients(const std::vector<Client*> & newClients) {
+    if (newClients.empty()) {
+        return;
+    }
+    using namespace std::placeholders;
+    for (Client * newClient : newClients) {
+        newClient->setHandle(_nextConnectionHandle++);
+        newClient->setEventsHandler(std::bind(&TcpServer::clientEventHandler, this, _1, _2, _3, _4));
+        newClient->setTimerLoop(_timerLoop);
+        newClient->setIdleTimeout(_clientIdleTimeoutMs);
+        newClient->setOutboundWatermarks(_outboundHighWatermark, _outboundLowWatermark);
+        newClient->setCoalesceSends(_coalesceSends);
+        newClient->setZeroCopyThreshold(_zeroCopyThreshold);
+        newClient->setFraming(_framing);
+        newClient->startListen();
+    }
+    {
+        std::lock_guard<std::mutex> lock(_clientsMtx);
+        _clients.insert(_clients.end(), newClients.begin(), newClients.end());
+        for (Client * newClient : newClients) {
+            _clientsByHandle[newClient->getHandle()] = newClient;
+            client_shard_t * shard = shardOf(newClient);
+            std::lock_guard<std::mutex> shardLock(shard->clientsMtx);
+            shard->clients.push_back(newClient);
+        }
+        numClientsConnected += static_cast<int>(newClients.size());
+    }
+
+    // once registered, a client may be closed and deleted by the dead client removal,
+    // which runs on the timer loop. Publishing there keeps the client alive meanwhile
+    std::vector<connection_handle_t> handles;
+    handles.reserve(newClients.size());
+    for (const Client * newClient : newClients) {
+        handles.push_back(newClient->getHandle());
+    }
+    _timerLoop->queueInLoop([this, handles]() { publishClientsAccepted(handles); });
+}
+
+/*
+ * Publish the accepted clients still registered. Called on the timer loop thread,
+ * or by close() once the timer loop is stopped and before any client is closed.
+ */
+void TcpServer::publishClientsAccepted(const std::vector<connection_handle_t> & handles) {
+    for (connection_handle_t handle : handles) {
+        const Client * client = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(_clientsMtx);
+            const auto clientIter = _clientsByHandle.find(handle);
+            if (clientIter != _clientsByHandle.end()) {
+                client = clientIter->second;
+            }
+        }
+        if (client) {
+            publishClientAccepted(*client);
+        }
+    }
+}
+
 /*
  * Uses socket command to create a new socket for the server.
  * Checks if socket creation failed.
@@ -229,6 +1020,9 @@ void TcpServer::listenToClients(int maxNumOfClients) {
  * Return accepted client IP, or throw error if failed
  */
 Client* TcpServer::acceptClient(uint timeout) {
+    if (!_acceptLoop) {
+        throw std::runtime_error("clients are accepted by the server acceptors");
+    }
     const pipe_ret_t waitingForClient = waitForClient(timeout);
     if (!waitingForClient.isSuccessful()) {
         throw std::runtime_error(waitingForClient.message());
@@ -241,15 +1035,43 @@ Client* TcpServer::acceptClient(uint timeout) {
     if (acceptFailed) {
         throw std::runtime_error(strerror(errno));
     }
-    auto newClient = new Client(fileDescriptor); //create a new client given the file descriptor 
-    newClient->setIp(inet_ntoa(_clientAddress.sin_addr));
-    using namespace std::placeholders;
-    newClient->setEventsHandler(std::bind(&TcpServer::clientEventHandler, this, _1, _2, _3));
-    newClient->startListen();
-    std::lock_guard<std::mutex> lock(_clientsMtx);
-    _clients.push_back(newClient);
-    numClientsConnected++;
-    return newClient;
+    accepted_client_t acceptedClient; //create a new client given the file descriptor
+    acceptedClient.sockfd = fileDescriptor;
+    acceptedClient.address = _clientAddress;
+    acceptedClient.eventLoop = nextEventLoop();
+    const std::vector<Client*> newClients = createClients(std::vector<accepted_client_t>(1, acceptedClient));
+    registerClients(newClients);
+    return newClients.front();
+}
+
+/*
+ * Accept clients on the calling thread until close() is called. The listening
+ * socket is made non blocking, and every wakeup drains all the pending
+ * connections with accept4(), registering them in batches. Observers are told
+ * about every accepted client through clientAcceptedHandler.
+ */
+pipe_ret_t TcpServer::runAcceptLoop() {
+    if (!_acceptLoop) {
+        return pipe_ret_t::failure("server is not started, or clients are accepted by the server acceptors");
+    }
+    const int listeningSockfd = _sockfd.get();
+    const int flags = fcntl(listeningSockfd, F_GETFL, 0);
+    if (fcntl(listeningSockfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        return pipe_ret_t::failure(strerror(errno));
+    }
+    pipe_ret_t addRet = pipe_ret_t::success();
+    try {
+        _acceptLoop->add(listeningSockfd, EPOLLIN, [this, listeningSockfd](uint32_t) {
+            acceptPendingClients(listeningSockfd, nullptr);
+        }, [this, &addRet](const pipe_ret_t & failure) {
+            addRet = failure; // nothing to accept from, do not loop forever
+            _acceptLoop->stop();
+        });
+        _acceptLoop->run();
+    } catch (const std::runtime_error &error) {
+        return pipe_ret_t::failure(error.what());
+    }
+    return addRet;
 }
 
 
@@ -275,25 +1097,117 @@ pipe_ret_t TcpServer::waitForClient(uint32_t timeout) {
 
 /*
  * Send message to all connected clients.
- * Return true if message was sent successfully to all clients
+ * Return true if message was sent successfully to all clients,
+ * otherwise the first failure. A failure does not stop the others.
  */
 pipe_ret_t TcpServer::sendToAllClients(const char * msg, size_t size) {
-    std::lock_guard<std::mutex> lock(_clientsMtx);
+    std::vector<client_send_result_t> sendingResults;
+    try {
+        sendingResults = broadcast(msg, size);
+    } catch (const std::runtime_error &error) {
+        return pipe_ret_t::failure(error.what());
+    }
+    for (const client_send_result_t & sendingResult : sendingResults) {
+        if (!sendingResult.result.isSuccessful()) {
+            return sendingResult.result;
+        }
+    }
+    return pipe_ret_t::success();
+}
 
-    for (const Client *client : _clients) {
-        pipe_ret_t sendingResult = sendToClient(*client, msg, size);
-        if (!sendingResult.isSuccessful()) {
-            return sendingResult;
+/*
+ * Queue message on every client without waiting for delivery. The message is
+ * framed and copied once into an immutable buffer shared by all client queues,
+ * and onReleased is called (on whichever thread drops the last reference) once
+ * every client handed it to the kernel or dropped it.
+ * Returns the result of queueing it on each client.
+ */
+std::vector<client_send_result_t> TcpServer::broadcast(const char * msg, size_t size, const std::function<void()> & onReleased) {
+    std::string * framedMsg = new std::string();
+    if (_framing) {
+        if (!_framing->canFrame(size)) {
+            delete framedMsg;
+            throw std::runtime_error("message does not fit the framing of the server");
         }
+        *framedMsg = _framing->header(size);
+        framedMsg->append(msg, size);
+        framedMsg->append(_framing->trailer());
+    } else {
+        framedMsg->assign(msg, size);
     }
+    const shared_payload_t payload(framedMsg, [onReleased](const std::string * releasedPayload) {
+        delete releasedPayload;
+        if (onReleased) {
+            onReleased();
+        }
+    });
+    return broadcast(payload);
+}
 
-    return pipe_ret_t::success();
+/*
+ * The payload is sent as is, so with a framing configured it must already be
+ * framed. Every event loop queues it on its own shard of clients, all loops
+ * at once, and this returns once every shard is done queueing. Called from a
+ * thread of the server (an event loop, handler or task thread), the shards are
+ * walked on that thread instead, each under its own lock: queueing never blocks,
+ * while waiting for the loops there could deadlock with a loop waiting on it,
+ * and would hold a worker other clients' events are queued on.
+ */
+std::vector<client_send_result_t> TcpServer::broadcast(const shared_payload_t & payload) {
+    std::vector<std::vector<client_send_result_t>> shardResults(_clientShards.size());
+    std::vector<std::promise<void>> shardsDone(_clientShards.size());
+    const bool isServerThread = (EventLoop::current() != nullptr) ||
+                                (_handlerPool && _handlerPool->isWorkerThread()) ||
+                                (_taskScheduler && _taskScheduler->isWorkerThread());
+    const bool fanOut = !isServerThread;
+
+    for (size_t i = 0; i < _clientShards.size(); i++) {
+        client_shard_t * shard = _clientShards[i];
+        std::vector<client_send_result_t> & sendingResults = shardResults[i];
+        std::promise<void> & shardDone = shardsDone[i];
+        if (fanOut && shard->eventLoop) {
+            shard->eventLoop->queueInLoop([shard, &payload, &sendingResults, &shardDone]() {
+                broadcastToShard(shard, payload, sendingResults);
+                shardDone.set_value();
+            });
+        } else {
+            broadcastToShard(shard, payload, sendingResults);
+            shardDone.set_value();
+        }
+    }
+
+    std::vector<client_send_result_t> sendingResults;
+    for (size_t i = 0; i < _clientShards.size(); i++) {
+        shardsDone[i].get_future().wait();
+        sendingResults.insert(sendingResults.end(), shardResults[i].begin(), shardResults[i].end());
+    }
+    return sendingResults;
+}
+
+void TcpServer::broadcastToShard(client_shard_t * shard, const shared_payload_t & payload,
+                                 std::vector<client_send_result_t> & sendingResults) {
+    std::lock_guard<std::mutex> lock(shard->clientsMtx); // queueing never blocks, so holding it is short
+
+    sendingResults.reserve(shard->clients.size());
+    for (const Client * client : shard->clients) {
+        client_send_result_t sendingResult;
+        sendingResult.connection = client->getHandle();
+        sendingResult.clientIP = client->getIp();
+        try {
+            client->send(payload);
+            sendingResult.result = pipe_ret_t::success();
+        } catch (const std::runtime_error &error) {
+            sendingResult.result = pipe_ret_t::failure(error.what());
+        }
+        sendingResults.push_back(sendingResult);
+    }
 }
 
 /*
  * Generates random even number and adds it to client's linked list 
  */
 int TcpServer::generateNumber(int ID){
+    std::lock_guard<std::mutex> lock(_numbersMtx); // handlers of different clients may run concurrently
     Client* client = _clients[ID];
     bool repeat = true;
     int number;
@@ -327,13 +1241,72 @@ int TcpServer::generateNumber(int ID){
     return number; 
 }
 
+/*
+ * Run task on the server's work stealing scheduler. Meant for the follow up steps
+ * of a request (e.g. sort the client's list, then reply); a task spawned from
+ * another spawned task stays on the same worker unless an idle one steals it.
+ */
+void TcpServer::spawn(std::function<void()> task) {
+    if (!_taskScheduler) {
+        task();
+        return;
+    }
+    _taskScheduler->spawn(std::move(task));
+}
+
+/*
+ * Run task on the server's timer loop after delayMs. Timer tasks share one
+ * thread, so they should be short; hand heavier work to spawn().
+ */
+EventLoop::timer_id_t TcpServer::runAfter(uint64_t delayMs, const std::function<void()> & task) {
+    if (!_timerLoop) {
+        throw std::runtime_error("server is not started");
+    }
+    return _timerLoop->runAfter(delayMs, task);
+}
+
+EventLoop::timer_id_t TcpServer::runEvery(uint64_t intervalMs, const std::function<void()> & task) {
+    if (!_timerLoop) {
+        throw std::runtime_error("server is not started");
+    }
+    return _timerLoop->runEvery(intervalMs, task);
+}
+
+void TcpServer::cancelTimer(EventLoop::timer_id_t timerId) {
+    if (_timerLoop) {
+        _timerLoop->cancelTimer(timerId);
+    }
+}
+
+/*
+ * Send payload to client delayMs from now, without holding a thread meanwhile.
+ * The client is looked up again when the timer fires, and nothing is sent if it
+ * was disconnected or removed by then.
+ */
+pipe_ret_t TcpServer::sendAfter(const Client & client, uint64_t delayMs, const std::string & payload) {
+    return sendAfter(client.getHandle(), delayMs, payload);
+}
+
+pipe_ret_t TcpServer::sendAfter(connection_handle_t connection, uint64_t delayMs, const std::string & payload) {
+    if (!_timerLoop) {
+        return pipe_ret_t::failure("server is not started");
+    }
+    _timerLoop->runAfter(delayMs, [this, connection, payload]() {
+        sendToClient(connection, payload.c_str(), payload.size());
+    });
+    return pipe_ret_t::success();
+}
+
 /*
  * Send message to specific client (determined by client IP address).
  * Return true if message was sent successfully
+ * hasMore marks a part of a burst: it is held back and sent together with the
+ * rest once a part without hasMore is sent.
+ * With a framing configured, msg is sent as one framed message.
  */
-pipe_ret_t TcpServer::sendToClient(const Client & client, const char * msg, size_t size){
+pipe_ret_t TcpServer::sendToClient(const Client & client, const char * msg, size_t size, bool hasMore){
     try{
-        client.send(msg, size);
+        client.sendMessage(msg, size, hasMore);
     } catch (const std::runtime_error &error) {
         return pipe_ret_t::failure(error.what());
     }
@@ -341,7 +1314,63 @@ pipe_ret_t TcpServer::sendToClient(const Client & client, const char * msg, size
     return pipe_ret_t::success();
 }
 
-pipe_ret_t TcpServer::sendToClient(const std::string & clientIP, const char * msg, size_t size) {
+/*
+ * Stream a file to client with sendfile(), straight from the page cache, in
+ * order with the messages queued around it. The file is read as it is sent,
+ * so it must not be rewritten meanwhile; up to its size at the time of this call is sent,
+ * as one framed message when a framing is configured.
+ */
+pipe_ret_t TcpServer::sendFileToClient(const Client & client, const std::string & filePath) {
+    const int fileFd = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fileFd == -1) {
+        return pipe_ret_t::failure(strerror(errno));
+    }
+    FileDescriptor * openFile = new FileDescriptor();
+    openFile->set(fileFd);
+    const shared_file_t file(openFile, [](const FileDescriptor * closedFile) { // closed after the last send
+        ::close(closedFile->get());
+        delete closedFile;
+    });
+
+    struct stat fileStatus;
+    if (fstat(fileFd, &fileStatus) == -1) {
+        return pipe_ret_t::failure(strerror(errno));
+    }
+    try {
+        client.sendFile(file, 0, fileStatus.st_size);
+    } catch (const std::runtime_error &error) {
+        return pipe_ret_t::failure(error.what());
+    }
+    return pipe_ret_t::success();
+}
+
+/*
+ * Send message to the client of a connection. The connection is found in constant
+ * time and held while the message is queued. Fails once the client is disconnected.
+ */
+pipe_ret_t TcpServer::sendToClient(connection_handle_t connection, const char * msg, size_t size, bool hasMore) {
+    std::lock_guard<std::mutex> lock(_clientsMtx);
+    const auto clientIter = _clientsByHandle.find(connection);
+    if (clientIter == _clientsByHandle.end() || !clientIter->second->isConnected()) {
+        return pipe_ret_t::failure("client not found");
+    }
+    return sendToClient(*clientIter->second, msg, size, hasMore);
+}
+
+pipe_ret_t TcpServer::sendFileToClient(connection_handle_t connection, const std::string & filePath) {
+    std::lock_guard<std::mutex> lock(_clientsMtx);
+    const auto clientIter = _clientsByHandle.find(connection);
+    if (clientIter == _clientsByHandle.end() || !clientIter->second->isConnected()) {
+        return pipe_ret_t::failure("client not found");
+    }
+    return sendFileToClient(*clientIter->second, filePath);
+}
+
+/*
+ * Send message to the first client found with the given IP address. Clients behind
+ * one NAT or on one host share it; prefer sending to a connection handle.
+ */
+pipe_ret_t TcpServer::sendToClient(const std::string & clientIP, const char * msg, size_t size, bool hasMore) {
     std::lock_guard<std::mutex> lock(_clientsMtx);
     const auto clientIter = std::find_if(_clients.begin(), _clients.end(),
          [&clientIP](Client *client) { return client->getIp() == clientIP; });
@@ -351,29 +1380,109 @@ pipe_ret_t TcpServer::sendToClient(const std::string & clientIP, const char * ms
     }
 
     const Client &client = *(*clientIter);
-    return sendToClient(client, msg, size);
+    return sendToClient(client, msg, size, hasMore);
 }
 
 /*
- * Close server and clients resources.
- * Return true is successFlag, false otherwise
+ * Close clients in parallel: each event loop gets a single task closing all of
+ * its clients, instead of one blocking round trip to a loop per client.
+ * Clients without an event loop (io_uring backend) are closed on this thread.
  */
-pipe_ret_t TcpServer::close() {
-    terminateDeadClientsRemover();
-    { // close clients
-        std::lock_guard<std::mutex> lock(_clientsMtx);
+pipe_ret_t TcpServer::closeClients(const std::vector<Client*> & clients) {
+    std::unordered_map<EventLoop*, std::vector<Client*>> clientsByLoop;
+    for (Client * client : clients) {
+        clientsByLoop[client->eventLoop()].push_back(client);
+    }
 
-        for (Client * client : _clients) {
+    std::mutex errorMtx;
+    std::string errorMsg;
+    const auto closeAll = [&errorMtx, &errorMsg](const std::vector<Client*> & loopClients) {
+        for (Client * client : loopClients) {
             try {
                 client->close();
             } catch (const std::runtime_error& error) {
-                return pipe_ret_t::failure(error.what());
+                std::lock_guard<std::mutex> lock(errorMtx);
+                errorMsg = error.what();
             }
         }
-        _clients.clear();
+    };
+
+    std::vector<std::future<void>> loopsClosed;
+    for (const auto & loopAndClients : clientsByLoop) {
+        EventLoop * eventLoop = loopAndClients.first;
+        if (!eventLoop) {
+            continue;
+        }
+        auto closed = std::make_shared<std::promise<void>>();
+        loopsClosed.push_back(closed->get_future());
+        const std::vector<Client*> * loopClients = &loopAndClients.second;
+        eventLoop->queueInLoop([closeAll, loopClients, closed]() {
+            closeAll(*loopClients);
+            closed->set_value();
+        });
+    }
+    const auto clientsWithoutLoop = clientsByLoop.find(nullptr);
+    if (clientsWithoutLoop != clientsByLoop.end()) {
+        closeAll(clientsWithoutLoop->second);
+    }
+    for (std::future<void> & closed : loopsClosed) {
+        closed.wait();
+    }
+
+    if (!errorMsg.empty()) {
+        return pipe_ret_t::failure(errorMsg);
+    }
+    return pipe_ret_t::success();
+}
+
+/*
+ * Close server and clients resources.
+ * Return true is successFlag, false otherwise
+ */
+pipe_ret_t TcpServer::close() {
+    stopTimerLoop();
+    if (_acceptLoop) {
+        _acceptLoop->stop();
+    }
+    stopIoUringLoops();
+    const bool multiAcceptorMode = !_acceptorSockfds.empty();
+    closeAcceptors();
+    std::vector<Client*> clientsToClose;
+    {
+        std::lock_guard<std::mutex> lock(_clientsMtx);
+        clientsToClose.swap(_clients);
+        _clientsByHandle.clear();
+    }
+    clearClientShards();
+    const pipe_ret_t closeClientsRet = closeClients(clientsToClose);
+    if (!closeClientsRet.isSuccessful()) {
+        return closeClientsRet;
+    }
+
+    // clients are closed, so only their disconnections are left to submit. Let the
+    // handlers and the tasks they spawned drain while the loops and shards they may
+    // send or broadcast through are still there
+    if (_handlerPool) {
+        _handlerPool->stop();
+        delete _handlerPool;
+        _handlerPool = nullptr;
+    }
+    // handlers may have spawned follow up tasks, stop the scheduler after them
+    if (_taskScheduler) {
+        _taskScheduler->stop();
+        delete _taskScheduler;
+        _taskScheduler = nullptr;
     }
 
-    { // close server
+    stopEventLoops();
+    deleteIoUringLoops();
+    deleteClientShards();
+    delete _acceptLoop;
+    _acceptLoop = nullptr;
+    delete _timerLoop;
+    _timerLoop = nullptr;
+
+    if (!multiAcceptorMode) { // close server
         const int closeServerResult = ::close(_sockfd.get());
         const bool closeServerFailed = (closeServerResult == -1);
         if (closeServerFailed) {
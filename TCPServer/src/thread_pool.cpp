@@ -0,0 +1,227 @@
+#include <utility>
+#include "../include/thread_pool.h"
+#include "../include/cpu_placement.h"
+
+#define MAX_TASKS_PER_BATCH 64
+
+namespace {
+    // the pool the current thread is a worker of, if any
+    thread_local const ThreadPool * currentPool = nullptr;
+
+    void runTask(ThreadPool::task_t && queuedTask) {
+        const ThreadPool::task_t task(std::move(queuedTask)); // captures are released on the worker
+        task();
+    }
+}
+
+ThreadPool::worker_t::worker_t(size_t numOfProducers, size_t queueCapacity) :
+    sharedLane{queueCapacity}
+{
+    hasOverflowTasks = false;
+    isSleeping = false;
+    for (size_t i = 0; i < numOfProducers; i++) {
+        lanes.push_back(new SpscRing<task_t>(queueCapacity));
+    }
+}
+
+ThreadPool::worker_t::~worker_t() {
+    for (SpscRing<task_t> * lane : lanes) {
+        delete lane;
+    }
+}
+
+bool ThreadPool::worker_t::lanesEmpty() const {
+    for (const SpscRing<task_t> * lane : lanes) {
+        if (!lane->empty()) {
+            return false;
+        }
+    }
+    return sharedLane.empty();
+}
+
+bool ThreadPool::worker_t::hasTasks() const {
+    return !lanesEmpty() || hasOverflowTasks;
+}
+
+/*
+ * queueCapacity is rounded up to a power of 2, and is the capacity of each lane
+ */
+ThreadPool::ThreadPool(size_t numOfThreads, size_t queueCapacity, size_t numOfProducers) {
+    _running = false;
+    _stopWorkers = false;
+    _numOfSubmittingThreads = 0;
+    for (size_t i = 0; i < numOfThreads; i++) {
+        _workers.push_back(new worker_t(numOfProducers, queueCapacity));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    stop();
+    for (worker_t * worker : _workers) {
+        delete worker;
+    }
+}
+
+void ThreadPool::start() {
+    if (_running.exchange(true)) {
+        return;
+    }
+    _stopWorkers = false;
+    for (worker_t * worker : _workers) {
+        worker->thread = new std::thread(&ThreadPool::workerTask, this, worker);
+    }
+}
+
+/*
+ * Restrict every worker to the given cpus. Must be called after start()
+ */
+bool ThreadPool::pinToCpus(const std::vector<int> & cpus) {
+    bool pinned = true;
+    for (worker_t * worker : _workers) {
+        pinned = worker->thread && cpu_placement::pinThread(worker->thread->native_handle(), cpus) && pinned;
+    }
+    return pinned;
+}
+
+/*
+ * The cpus a worker may run on, as the kernel has them. Empty if it is not running
+ */
+std::vector<int> ThreadPool::cpusOf(size_t workerIndex) const {
+    std::thread * thread = _workers[workerIndex]->thread;
+    return thread ? cpu_placement::affinityOf(thread->native_handle()) : std::vector<int>();
+}
+
+/*
+ * Let every worker finish the tasks already queued, and join them
+ */
+void ThreadPool::stop() {
+    if (!_running.exchange(false)) {
+        return;
+    }
+    // a submit() that saw the pool running is still pushing, its task must be run too
+    while (_numOfSubmittingThreads.load() > 0) {
+        std::this_thread::yield();
+    }
+    _stopWorkers = true;
+    for (worker_t * worker : _workers) {
+        {
+            std::lock_guard<std::mutex> lock(worker->sleepMtx);
+        }
+        worker->wakeupCv.notify_all();
+    }
+    for (worker_t * worker : _workers) {
+        worker->thread->join();
+        delete worker->thread;
+        worker->thread = nullptr;
+    }
+}
+
+/*
+ * Queue task on the worker picked by key. producer is the index of the calling
+ * thread among the numOfProducers the pool was made for, each of them having its
+ * own lane on every worker; any other thread passes ANY_PRODUCER. Never waits:
+ * the producer may be an I/O thread the worker itself is waiting on (a handler
+ * broadcasting through the loops), so a full lane spills to the worker's overflow
+ * list instead. Returns false if the pool is stopped.
+ */
+bool ThreadPool::submit(size_t key, task_t task, size_t producer) {
+    worker_t * worker = _workers[key % _workers.size()];
+    _numOfSubmittingThreads++;
+    if (!_running) {
+        _numOfSubmittingThreads--;
+        return false;
+    }
+    // once tasks overflowed, later ones follow them there so each producer's stay in order
+    bool isQueued = false;
+    if (!worker->hasOverflowTasks.load(std::memory_order_acquire)) {
+        isQueued = (producer < worker->lanes.size()) ?
+                   worker->lanes[producer]->tryPush(std::move(task)) :
+                   worker->sharedLane.tryPush(std::move(task));
+    }
+    if (!isQueued) {
+        std::lock_guard<std::mutex> lock(worker->overflowMtx);
+        worker->overflowTasks.push_back(std::move(task));
+        worker->hasOverflowTasks = true;
+    }
+    wakeup(worker);
+    _numOfSubmittingThreads--;
+    return true;
+}
+
+/*
+ * Notify worker if it went to sleep. Paired with the fence in waitForTasks():
+ * either the worker sees the task just queued, or this sees it sleeping
+ */
+void ThreadPool::wakeup(worker_t * worker) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (worker->isSleeping.load(std::memory_order_relaxed)) {
+        {
+            std::lock_guard<std::mutex> lock(worker->sleepMtx);
+        }
+        worker->wakeupCv.notify_one();
+    }
+}
+
+/*
+ * Sleep until a task is queued for worker. Returns false once the pool is
+ * stopped and the worker has nothing left to run.
+ */
+bool ThreadPool::waitForTasks(worker_t * worker) {
+    std::unique_lock<std::mutex> lock(worker->sleepMtx);
+    worker->isSleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!worker->hasTasks()) {
+        if (_stopWorkers) {
+            worker->isSleeping = false;
+            return false; // stopped and drained
+        }
+        worker->wakeupCv.wait(lock);
+    }
+    worker->isSleeping = false;
+    return true;
+}
+
+/*
+ * Run the overflow list of worker, once its lanes are empty: the overflowed tasks
+ * were queued after every task in the lanes. Checked under the lock, so a task a
+ * producer put in a lane before overflowing its next one is seen. Returns how many ran.
+ */
+size_t ThreadPool::runOverflowTasks(worker_t * worker) {
+    if (!worker->hasOverflowTasks.load(std::memory_order_acquire)) {
+        return 0;
+    }
+    std::vector<task_t> tasks;
+    {
+        std::lock_guard<std::mutex> lock(worker->overflowMtx);
+        if (!worker->lanesEmpty()) {
+            return 0;
+        }
+        tasks.swap(worker->overflowTasks);
+        worker->hasOverflowTasks = false;
+    }
+    for (task_t & task : tasks) {
+        runTask(std::move(task));
+    }
+    return tasks.size();
+}
+
+// whether the calling thread is one of the workers of this pool
+bool ThreadPool::isWorkerThread() const {
+    return currentPool == this;
+}
+
+void ThreadPool::workerTask(worker_t * worker) {
+    currentPool = this;
+    while (true) {
+        size_t numOfTasks = 0;
+        for (SpscRing<task_t> * lane : worker->lanes) {
+            numOfTasks += lane->drain(runTask, MAX_TASKS_PER_BATCH);
+        }
+        numOfTasks += worker->sharedLane.drain(runTask, MAX_TASKS_PER_BATCH);
+        numOfTasks += runOverflowTasks(worker);
+
+        if (numOfTasks == 0 && !waitForTasks(worker)) {
+            return;
+        }
+    }
+}
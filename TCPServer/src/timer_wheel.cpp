@@ -0,0 +1,232 @@
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include "../include/timer_wheel.h"
+
+TimerWheel::TimerWheel(uint64_t tickMs) :
+    _tickMs{tickMs > 0 ? tickMs : 1},
+    _startMs{nowMs()}
+{
+    memset(_rootSlots, 0, sizeof(_rootSlots));
+    memset(_levelSlots, 0, sizeof(_levelSlots));
+    memset(_rootOccupancy, 0, sizeof(_rootOccupancy));
+}
+
+TimerWheel::~TimerWheel() {
+    for (auto & idAndTimer : _timers) {
+        delete idAndTimer.second;
+    }
+}
+
+uint64_t TimerWheel::nowMs() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t TimerWheel::tickAt(uint64_t timeMs) const {
+    return timeMs < _startMs ? 0 : (timeMs - _startMs) / _tickMs;
+}
+
+/*
+ * Run task once after delayMs, and then every intervalMs if that is not 0.
+ * A timer never fires early; it fires on the first tick at or after its due time.
+ */
+void TimerWheel::schedule(timer_id_t id, uint64_t delayMs, uint64_t intervalMs, const task_t & task) {
+    cancel(id);
+
+    const uint64_t dueMs = nowMs() + delayMs;
+    uint64_t expiryTick = (dueMs - _startMs + _tickMs - 1) / _tickMs;
+    if (expiryTick < _nextTick) {
+        expiryTick = _nextTick;
+    }
+
+    timer_node_t * timer = new timer_node_t();
+    timer->id = id;
+    timer->expiryTick = expiryTick;
+    timer->intervalTicks = intervalMs > 0 ? (intervalMs + _tickMs - 1) / _tickMs : 0;
+    timer->task = task;
+    _timers[id] = timer;
+    link(timer);
+}
+
+/*
+ * Returns false if there is no such timer (it already fired, or was cancelled).
+ * A timer may cancel itself from its own task.
+ */
+bool TimerWheel::cancel(timer_id_t id) {
+    const auto timerIter = _timers.find(id);
+    if (timerIter == _timers.end()) {
+        return false;
+    }
+    timer_node_t * timer = timerIter->second;
+    _timers.erase(timerIter);
+    if (timer == _runningTimer) {
+        timer->isCancelled = true; // freed once its task returns
+        return true;
+    }
+    unlink(timer);
+    delete timer;
+    return true;
+}
+
+/*
+ * Put timer in the slot matching how far its expiry is from the current tick:
+ * the root wheel for the next 256 ticks, then one level per 6 more bits.
+ */
+void TimerWheel::link(timer_node_t * timer) {
+    const uint64_t maxDeltaTicks = 1ull << (ROOT_BITS + (NUM_OF_LEVELS - 1) * LEVEL_BITS);
+    if (timer->expiryTick < _nextTick) {
+        timer->expiryTick = _nextTick;
+    } else if (timer->expiryTick - _nextTick >= maxDeltaTicks) {
+        timer->expiryTick = _nextTick + maxDeltaTicks - 1;
+    }
+    const uint64_t deltaTicks = timer->expiryTick - _nextTick;
+
+    timer_node_t ** slot;
+    if (deltaTicks < ROOT_SIZE) {
+        const uint64_t slotIndex = timer->expiryTick & (ROOT_SIZE - 1);
+        slot = &_rootSlots[slotIndex];
+        _rootOccupancy[slotIndex / 64] |= 1ull << (slotIndex % 64);
+    } else {
+        int level = 1;
+        while (level < NUM_OF_LEVELS - 1 && deltaTicks >= (1ull << (ROOT_BITS + level * LEVEL_BITS))) {
+            level++;
+        }
+        const int shift = ROOT_BITS + (level - 1) * LEVEL_BITS;
+        slot = &_levelSlots[level - 1][(timer->expiryTick >> shift) & (LEVEL_SIZE - 1)];
+    }
+
+    timer->slot = slot;
+    timer->prev = nullptr;
+    timer->next = *slot;
+    if (*slot) {
+        (*slot)->prev = timer;
+    }
+    *slot = timer;
+}
+
+void TimerWheel::unlink(timer_node_t * timer) {
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        *timer->slot = timer->next;
+    }
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+
+    const bool isRootSlot = (timer->slot >= _rootSlots && timer->slot < _rootSlots + ROOT_SIZE);
+    if (isRootSlot && *timer->slot == nullptr) {
+        const uint64_t slotIndex = timer->slot - _rootSlots;
+        _rootOccupancy[slotIndex / 64] &= ~(1ull << (slotIndex % 64));
+    }
+    timer->prev = nullptr;
+    timer->next = nullptr;
+    timer->slot = nullptr;
+}
+
+/*
+ * Move the timers of one upper level slot to the slots they now belong to
+ */
+void TimerWheel::cascade(int level, uint64_t slotIndex) {
+    timer_node_t * timer = _levelSlots[level - 1][slotIndex];
+    _levelSlots[level - 1][slotIndex] = nullptr;
+    while (timer) {
+        timer_node_t * next = timer->next;
+        link(timer);
+        timer = next;
+    }
+}
+
+void TimerWheel::processTick() {
+    const uint64_t rootIndex = _nextTick & (ROOT_SIZE - 1);
+    if (rootIndex == 0) { // the root wheel wrapped, refill it from the levels above
+        for (int level = 1; level < NUM_OF_LEVELS; level++) {
+            const int shift = ROOT_BITS + (level - 1) * LEVEL_BITS;
+            const uint64_t levelIndex = (_nextTick >> shift) & (LEVEL_SIZE - 1);
+            cascade(level, levelIndex);
+            if (levelIndex != 0) {
+                break;
+            }
+        }
+    }
+
+    // detach the due timers, so their tasks can schedule or cancel freely
+    timer_node_t * dueTimers = _rootSlots[rootIndex];
+    _rootSlots[rootIndex] = nullptr;
+    _rootOccupancy[rootIndex / 64] &= ~(1ull << (rootIndex % 64));
+    for (timer_node_t * timer = dueTimers; timer; timer = timer->next) {
+        timer->slot = &dueTimers;
+    }
+    const uint64_t currentTick = _nextTick++;
+
+    while (dueTimers) {
+        timer_node_t * timer = dueTimers;
+        unlink(timer);
+
+        _runningTimer = timer;
+        timer->task();
+        _runningTimer = nullptr;
+
+        if (timer->isCancelled) {
+            delete timer;
+        } else if (timer->intervalTicks > 0) {
+            timer->expiryTick = currentTick + timer->intervalTicks;
+            link(timer);
+        } else {
+            _timers.erase(timer->id);
+            delete timer;
+        }
+    }
+}
+
+/*
+ * Run the tasks of every timer that is due
+ */
+void TimerWheel::advance() {
+    const uint64_t nowTick = tickAt(nowMs());
+    if (_timers.empty()) {
+        if (_nextTick <= nowTick) {
+            _nextTick = nowTick + 1; // nothing to cascade or run, skip ahead
+        }
+        return;
+    }
+    while (_nextTick <= nowTick) {
+        processTick();
+    }
+}
+
+/*
+ * The first root tick holding a timer. If the rest of the root wheel is empty,
+ * the tick where it wraps, since upper level timers are cascaded down there.
+ */
+uint64_t TimerWheel::nextRootTick() const {
+    const uint64_t rootIndex = _nextTick & (ROOT_SIZE - 1);
+    for (uint64_t word = rootIndex / 64; word < ROOT_SIZE / 64; word++) {
+        uint64_t occupancy = _rootOccupancy[word];
+        if (word == rootIndex / 64) {
+            occupancy &= ~0ull << (rootIndex % 64);
+        }
+        if (occupancy) {
+            return _nextTick + (word * 64 + __builtin_ctzll(occupancy)) - rootIndex;
+        }
+    }
+    return (_nextTick | (ROOT_SIZE - 1)) + 1;
+}
+
+/*
+ * How long the owner may sleep before advance() has something to do,
+ * in epoll_wait() terms: -1 when there are no timers at all.
+ */
+int TimerWheel::timeoutMs() const {
+    if (_timers.empty()) {
+        return -1;
+    }
+    const uint64_t wakeupMs = _startMs + nextRootTick() * _tickMs;
+    const uint64_t now = nowMs();
+    if (wakeupMs <= now) {
+        return 0;
+    }
+    const uint64_t waitMs = wakeupMs - now;
+    return waitMs > INT_MAX ? INT_MAX : static_cast<int>(waitMs);
+}
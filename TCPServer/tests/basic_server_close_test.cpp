@@ -0,0 +1,93 @@
+///////////////////////////////////////////////////////////
+//////////////////BASIC SERVER CLOSE TEST//////////////////
+///////////////////////////////////////////////////////////
+
+// Close a BasicTcpServer while a client is still connected. The handler must be
+// told about the disconnection once, with a connection it can still read.
+// Built with -fsanitize=address this also catches a connection freed before
+// onDisconnected() returns.
+//
+// usage: basic_server_close_test [port]
+
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../include/basic_tcp_server.h"
+
+namespace {
+
+    std::atomic<int> numOfAccepted(0);
+    std::atomic<int> numOfDisconnected(0);
+    std::string disconnectedIp;
+    std::string disconnectionReason;
+
+    struct RecordingHandler {
+        void onAccepted(BasicConnection<LengthPrefixedFraming> &) { numOfAccepted++; }
+        void onMessage(BasicConnection<LengthPrefixedFraming> &, const char *, size_t) {}
+        void onDisconnected(BasicConnection<LengthPrefixedFraming> & connection, const std::string & reason) {
+            disconnectedIp = connection.getIp();
+            disconnectionReason = reason;
+            numOfDisconnected++;
+        }
+    };
+
+    int connectTo(int port) {
+        const int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        if (connect(sockfd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+            ::close(sockfd);
+            return -1;
+        }
+        return sockfd;
+    }
+
+    bool check(bool condition, const std::string & what) {
+        if (!condition) {
+            std::cout << "FAILED: " << what << "\n";
+        }
+        return condition;
+    }
+}
+
+int main(int argc, char * argv[]) {
+    const int port = (argc > 1) ? std::atoi(argv[1]) : 65100;
+
+    BasicTcpServer<RecordingHandler, LengthPrefixedFraming> server(RecordingHandler(), std::make_shared<const LengthPrefixedFraming>());
+    const pipe_ret_t startRet = server.start(port, 2);
+    if (!check(startRet.isSuccessful(), "server starts: " + startRet.message())) {
+        return 1;
+    }
+    const int sockfd = connectTo(port);
+    if (!check(sockfd != -1, "client connects")) {
+        return 1;
+    }
+    for (int i = 0; i < 2000 && numOfAccepted == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!check(numOfAccepted == 1, "client is accepted")) {
+        return 1;
+    }
+
+    server.close();
+    ::close(sockfd);
+
+    const bool isSuccessful = check(numOfDisconnected == 1, "onDisconnected called once") &&
+                              check(disconnectionReason == "Server closed", "reason is 'Server closed'") &&
+                              check(disconnectedIp == "127.0.0.1", "connection is readable in onDisconnected");
+    if (isSuccessful) {
+        std::cout << "passed\n";
+    }
+    return isSuccessful ? 0 : 1;
+}
@@ -0,0 +1,226 @@
+///////////////////////////////////////////////////////////
+///////////////////BROADCAST BENCHMARK/////////////////////
+///////////////////////////////////////////////////////////
+
+// Latency of TcpServer::broadcast() to many connected clients: how long the call
+// takes to return, and how long until every client received the payload. It is
+// broadcast from the main thread, which fans out to the event loops and waits
+// for them, and from a handler thread, which walks the shards itself.
+// Every connection takes a descriptor on both ends, so the process needs more
+// than twice numOfConnections descriptors; the soft limit is raised to the hard one.
+//
+// usage: broadcast_benchmark [numOfConnections] [numOfRounds] [port]
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../include/tcp_server.h"
+
+namespace {
+
+    const size_t PAYLOAD_SIZE = 64;
+    const int MAX_EVENTS_PER_WAIT = 1024;
+
+    using benchmark_clock_t = std::chrono::steady_clock;
+
+    double millisecondsSince(const benchmark_clock_t::time_point & start) {
+        const std::chrono::duration<double, std::milli> elapsed = benchmark_clock_t::now() - start;
+        return elapsed.count();
+    }
+
+    bool raiseDescriptorLimit(size_t numOfDescriptors) {
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+            return false;
+        }
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        return limit.rlim_cur >= numOfDescriptors;
+    }
+
+    int connectTo(int port) {
+        const int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        if (connect(sockfd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+            ::close(sockfd);
+            return -1;
+        }
+        return sockfd;
+    }
+
+    /*
+     * Reads every client socket on a thread of its own and counts the bytes received
+     */
+    class Receiver {
+
+    private:
+        int _epollfd;
+        std::atomic<bool> _running;
+        std::thread * _thread = nullptr;
+
+        void receive() {
+            struct epoll_event events[MAX_EVENTS_PER_WAIT];
+            char buffer[16 * 1024];
+            while (_running) {
+                const int numOfEvents = epoll_wait(_epollfd, events, MAX_EVENTS_PER_WAIT, 10);
+                for (int i = 0; i < numOfEvents; i++) {
+                    const ssize_t received = recv(events[i].data.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+                    if (received > 0) {
+                        numOfBytesReceived += received;
+                    }
+                }
+            }
+        }
+
+    public:
+        std::atomic<size_t> numOfBytesReceived;
+
+        explicit Receiver(const std::vector<int> & sockfds) : _epollfd{epoll_create1(0)} {
+            numOfBytesReceived = 0;
+            _running = true;
+            for (int sockfd : sockfds) {
+                struct epoll_event event;
+                memset(&event, 0, sizeof(event));
+                event.events = EPOLLIN;
+                event.data.fd = sockfd;
+                epoll_ctl(_epollfd, EPOLL_CTL_ADD, sockfd, &event);
+            }
+            _thread = new std::thread(&Receiver::receive, this);
+        }
+        ~Receiver() {
+            _running = false;
+            _thread->join();
+            delete _thread;
+            ::close(_epollfd);
+        }
+
+        void waitFor(size_t numOfBytes) {
+            while (numOfBytesReceived < numOfBytes) {
+                std::this_thread::yield();
+            }
+        }
+    };
+
+    struct round_result_t {
+        double callMs = 0;
+        double deliveryMs = 0;
+    };
+
+    void report(const std::string & variant, const std::vector<round_result_t> & results, size_t numOfClients) {
+        round_result_t average;
+        for (const round_result_t & result : results) {
+            average.callMs += result.callMs / results.size();
+            average.deliveryMs += result.deliveryMs / results.size();
+        }
+        std::cout << "broadcast to " << numOfClients << " clients from " << variant << ": returns after " <<
+                  average.callMs << " ms, all clients received it after " << average.deliveryMs << " ms\n";
+    }
+}
+
+int main(int argc, char * argv[]) {
+    const size_t numOfConnections = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 50000;
+    const size_t numOfRounds = (argc > 2) ? std::max(1ul, std::strtoul(argv[2], nullptr, 10)) : 5;
+    const int port = (argc > 3) ? std::atoi(argv[3]) : 65300;
+
+    const size_t numOfDescriptors = 2 * numOfConnections + 64;
+    if (!raiseDescriptorLimit(numOfDescriptors)) {
+        std::cout << "needs " << numOfDescriptors << " file descriptors, raise the limit (ulimit -n)\n";
+        return 1;
+    }
+
+    TcpServer server;
+    server_options_t options;
+    options.maxNumOfClients = static_cast<int>(numOfConnections);
+    options.removeDeadClientsAutomatically = false;
+    options.numOfHandlerThreads = 2;
+    const pipe_ret_t startRet = server.start(port, options);
+    if (!startRet.isSuccessful()) {
+        std::cout << "server failed to start: " << startRet.message() << "\n";
+        return 1;
+    }
+    const std::string payload(PAYLOAD_SIZE, 'b');
+    std::atomic<size_t> numOfClientsAccepted(0);
+    std::atomic<double> handlerCallMs(0);
+    std::atomic<bool> isHandlerBroadcastDone(false);
+    server_observer_t observer;
+    observer.clientAcceptedHandler = [&numOfClientsAccepted](const Client &) { numOfClientsAccepted++; };
+    observer.incomingPacketHandler = [&server, &payload, &handlerCallMs, &isHandlerBroadcastDone](connection_handle_t, const std::string &, const char *, size_t) {
+        const benchmark_clock_t::time_point start = benchmark_clock_t::now();
+        server.broadcast(payload.data(), payload.size());
+        handlerCallMs = millisecondsSince(start);
+        isHandlerBroadcastDone = true;
+    };
+    server.subscribe(observer);
+    std::thread acceptThread([&server]() { server.runAcceptLoop(); });
+
+    std::vector<int> sockfds;
+    for (size_t i = 0; i < numOfConnections; i++) {
+        const int sockfd = connectTo(port);
+        if (sockfd == -1) {
+            std::cout << "connection " << i << " failed: " << strerror(errno) << "\n";
+            break;
+        }
+        sockfds.push_back(sockfd);
+    }
+    while (numOfClientsAccepted < sockfds.size()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    {
+        Receiver receiver(sockfds);
+        const size_t numOfBytesPerRound = sockfds.size() * PAYLOAD_SIZE;
+
+        std::vector<round_result_t> results;
+        for (size_t round = 0; round < numOfRounds; round++) {
+            round_result_t result;
+            const size_t numOfBytesExpected = receiver.numOfBytesReceived + numOfBytesPerRound;
+            const benchmark_clock_t::time_point start = benchmark_clock_t::now();
+            server.broadcast(payload.data(), payload.size());
+            result.callMs = millisecondsSince(start);
+            receiver.waitFor(numOfBytesExpected);
+            result.deliveryMs = millisecondsSince(start);
+            results.push_back(result);
+        }
+        report("the main thread", results, sockfds.size());
+
+        results.clear();
+        const char trigger = 't';
+        for (size_t round = 0; !sockfds.empty() && round < numOfRounds; round++) {
+            round_result_t result;
+            isHandlerBroadcastDone = false;
+            const size_t numOfBytesExpected = receiver.numOfBytesReceived + numOfBytesPerRound;
+            const benchmark_clock_t::time_point start = benchmark_clock_t::now();
+            ::send(sockfds[round % sockfds.size()], &trigger, sizeof(trigger), MSG_NOSIGNAL);
+            receiver.waitFor(numOfBytesExpected);
+            result.deliveryMs = millisecondsSince(start);
+            while (!isHandlerBroadcastDone) {
+                std::this_thread::yield();
+            }
+            result.callMs = handlerCallMs;
+            results.push_back(result);
+        }
+        report("a handler thread", results, sockfds.size());
+    }
+
+    server.close();
+    acceptThread.join();
+    for (int sockfd : sockfds) {
+        ::close(sockfd);
+    }
+    return (sockfds.size() == numOfConnections) ? 0 : 1;
+}
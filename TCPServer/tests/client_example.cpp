@@ -7,8 +7,10 @@
 #include <iostream>
 #include <csignal>
 #include "../include/tcp_client.h"
+#include "../include/protocol.h"
 
 TcpClient* client = new TcpClient();
+uint32_t nextRequestId = 1; // echoed by the server in the response
 
 // on sig_exit, close client
 void sig_exit(int s)
@@ -23,9 +25,25 @@ void sig_exit(int s)
 	exit(0);
 }
 
-// observer callback. will be called for every new message received by the server
+// observer callback. will be called for every response (see protocol.h) received from the server
 void onIncomingMsg(const char * msg, size_t size) {
-	std::cout << "Client # " << client->getID() << " got this unique number from the server: " << msg << "\n";
+	protocol::message_t response;
+	if (!protocol::decode(msg, size, response)) {
+		return;
+	}
+	uint32_t value = 0;
+	std::vector<int32_t> numbers;
+	if (response.header.opcode == protocol::Opcode::NEXT_NUMBER && protocol::decodeUint32(response, value)) {
+		std::cout << "Client # " << client->getID() << " got this unique number from the server: " << static_cast<int32_t>(value) << "\n";
+	} else if (response.header.opcode == protocol::Opcode::LIST && protocol::decodeInt32s(response, numbers)) {
+		std::cout << "Client # " << client->getID() << " sorted list of numbers:";
+		for (int32_t number : numbers) {
+			std::cout << " " << number;
+		}
+		std::cout << "\n";
+	} else if (response.header.opcode == protocol::Opcode::ERROR && protocol::decodeUint32(response, value)) {
+		std::cout << "Request " << response.header.requestId << " failed with error " << value << "\n";
+	}
 }
 
 
@@ -186,6 +204,7 @@ int main() {
 	observer.incomingPacketHandler = onIncomingMsg;
 	observer.disconnectionHandler = onDisconnection;
 	client->subscribe(observer); //for the first client subscribe to observer to display messages from server
+	client->setFraming(std::make_shared<protocol::MessageFraming>()); // same framing as the server
     pipe_ret_t connectRet; 
 	bool connected = false;
     for (int i = 0; i < 10; i++){
@@ -203,8 +222,8 @@ int main() {
         int selection = client->getMenuSelection();
         while (selection != 2){
             if (selection == 1){ //client requesting #
-                    std::string ID = std::to_string(client->getID());
-                    pipe_ret_t sendRet = client->sendMsg(ID.c_str(), ID.size());
+                    const std::string request = protocol::encodeUint32(protocol::Opcode::GET_NEXT_NUMBER, nextRequestId++, client->getID());
+                    pipe_ret_t sendRet = client->sendMsg(request.data(), request.size());
                     if (!sendRet.isSuccessful()) {
                         std::cout << "\nFailed to send message: " << sendRet.message() << "\n";
                     } 
@@ -212,6 +231,23 @@ int main() {
                         std::cout << "\nRequest for a new number was sent successfuly\n";
                     }
                 }
+            else if (selection == 4){ //client pipelining several requests on the connection
+                    std::vector<std::string> requests;
+                    for (int j = 0; j < 10; j++) {
+                        requests.push_back(protocol::encodeUint32(protocol::Opcode::GET_NEXT_NUMBER, nextRequestId++, client->getID()));
+                    }
+                    pipe_ret_t sendRet = client->sendMsgs(requests);
+                    if (!sendRet.isSuccessful()) {
+                        std::cout << "\nFailed to send messages: " << sendRet.message() << "\n";
+                    }
+                }
+            else if (selection == 3){ //client requesting its list
+                    const std::string request = protocol::encodeUint32(protocol::Opcode::GET_LIST, nextRequestId++, client->getID());
+                    pipe_ret_t sendRet = client->sendMsg(request.data(), request.size());
+                    if (!sendRet.isSuccessful()) {
+                        std::cout << "\nFailed to send message: " << sendRet.message() << "\n";
+                    }
+                }
             client->printMenu();
             selection = client->getMenuSelection();
         }
@@ -221,6 +257,7 @@ int main() {
 	    observer.incomingPacketHandler = onIncomingMsg;
 	    observer.disconnectionHandler = onDisconnection;
 	    client->subscribe(observer);
+	    client->setFraming(std::make_shared<protocol::MessageFraming>());
     }
 	return 0;
 }
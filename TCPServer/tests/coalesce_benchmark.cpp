@@ -0,0 +1,189 @@
+///////////////////////////////////////////////////////////
+////////////////////COALESCE BENCHMARK/////////////////////
+///////////////////////////////////////////////////////////
+
+// Send syscalls per message and throughput of the server's outbound path, with
+// one send() per message (coalesceSends = false), with the queued messages of a
+// client flushed by one sendmsg() per loop iteration (coalesceSends = true), and
+// with every response but the last of a request sent with hasMore (MSG_MORE).
+// A client pipelines requests over loopback, and the handler answers each with
+// several small responses, as a handler writing a reply in parts does.
+// send() and sendmsg() are wrapped here to count the calls of the server threads.
+//
+// usage: coalesce_benchmark [numOfRequests] [port]
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "../include/tcp_server.h"
+
+namespace {
+    std::atomic<size_t> numOfSendCalls(0);
+    thread_local bool isClientThread = false;
+
+    template <typename Function>
+    Function nextSymbol(const char * name) {
+        return reinterpret_cast<Function>(dlsym(RTLD_NEXT, name));
+    }
+}
+
+extern "C" ssize_t send(int sockfd, const void * buf, size_t len, int flags) {
+    static const auto realSend = nextSymbol<ssize_t (*)(int, const void *, size_t, int)>("send");
+    if (!isClientThread) {
+        numOfSendCalls.fetch_add(1, std::memory_order_relaxed);
+    }
+    return realSend(sockfd, buf, len, flags);
+}
+
+extern "C" ssize_t sendmsg(int sockfd, const struct msghdr * msg, int flags) {
+    static const auto realSendmsg = nextSymbol<ssize_t (*)(int, const struct msghdr *, int)>("sendmsg");
+    if (!isClientThread) {
+        numOfSendCalls.fetch_add(1, std::memory_order_relaxed);
+    }
+    return realSendmsg(sockfd, msg, flags);
+}
+
+namespace {
+
+    const size_t RESPONSES_PER_REQUEST = 8;
+    const size_t RESPONSE_SIZE = 16;
+    const size_t WRITE_SIZE = 64 * 1024;
+
+    using benchmark_clock_t = std::chrono::steady_clock;
+
+    enum class SendMode {
+        SEND_PER_MESSAGE,
+        COALESCED,
+        COALESCED_BURST
+    };
+
+    int connectTo(int port) {
+        const int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        if (connect(sockfd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+            ::close(sockfd);
+            return -1;
+        }
+        const int noDelay = 1;
+        setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        return sockfd;
+    }
+
+    std::string framedRequests(size_t numOfRequests) {
+        const LengthPrefixedFraming framing;
+        const std::string request = framing.header(sizeof(uint32_t)) + std::string(sizeof(uint32_t), 'r');
+        std::string requests;
+        requests.reserve(request.size() * numOfRequests);
+        for (size_t i = 0; i < numOfRequests; i++) {
+            requests += request;
+        }
+        return requests;
+    }
+
+    /*
+     * Send every request, then read until every response arrived. Runs on the
+     * calling thread, whose send calls are not counted.
+     */
+    bool exchange(int sockfd, const std::string & requests, size_t numOfResponseBytes) {
+        std::thread reader([sockfd, numOfResponseBytes]() {
+            std::vector<char> buffer(WRITE_SIZE);
+            size_t numOfBytesReceived = 0;
+            while (numOfBytesReceived < numOfResponseBytes) {
+                const ssize_t received = recv(sockfd, buffer.data(), buffer.size(), 0);
+                if (received <= 0) {
+                    return;
+                }
+                numOfBytesReceived += received;
+            }
+        });
+        bool isSuccessful = true;
+        for (size_t offset = 0; offset < requests.size(); ) {
+            const ssize_t numOfBytesSent = ::send(sockfd, requests.data() + offset,
+                                                  std::min(WRITE_SIZE, requests.size() - offset), MSG_NOSIGNAL);
+            if (numOfBytesSent == -1) {
+                isSuccessful = false;
+                break;
+            }
+            offset += numOfBytesSent;
+        }
+        reader.join();
+        return isSuccessful;
+    }
+
+    bool benchmark(const std::string & variant, SendMode sendMode, int port, size_t numOfRequests) {
+        TcpServer server;
+        server_options_t options;
+        options.numOfIoThreads = 1;
+        options.removeDeadClientsAutomatically = false;
+        options.coalesceSends = (sendMode != SendMode::SEND_PER_MESSAGE);
+        options.framing = std::make_shared<LengthPrefixedFraming>();
+        const pipe_ret_t startRet = server.start(port, options);
+        if (!startRet.isSuccessful()) {
+            std::cout << variant << ": server failed to start: " << startRet.message() << "\n";
+            return false;
+        }
+        const std::string response(RESPONSE_SIZE, 'x');
+        server_observer_t observer;
+        observer.incomingPacketHandler = [&server, &response, sendMode](connection_handle_t connection, const std::string &, const char *, size_t) {
+            for (size_t i = 0; i < RESPONSES_PER_REQUEST; i++) {
+                const bool hasMore = (sendMode == SendMode::COALESCED_BURST) && (i + 1 < RESPONSES_PER_REQUEST);
+                server.sendToClient(connection, response.data(), response.size(), hasMore);
+            }
+        };
+        server.subscribe(observer);
+
+        const int sockfd = connectTo(port);
+        if (sockfd == -1) {
+            return false;
+        }
+        server.acceptClient(0); // already connected, accept() does not wait
+
+        const size_t numOfMessages = numOfRequests * RESPONSES_PER_REQUEST;
+        const size_t numOfResponseBytes = numOfMessages * (options.framing->header(RESPONSE_SIZE).size() + RESPONSE_SIZE);
+        const std::string requests = framedRequests(numOfRequests);
+
+        numOfSendCalls = 0;
+        const benchmark_clock_t::time_point start = benchmark_clock_t::now();
+        const bool isSuccessful = exchange(sockfd, requests, numOfResponseBytes);
+        const std::chrono::duration<double> elapsed = benchmark_clock_t::now() - start;
+        const size_t numOfSends = numOfSendCalls;
+        ::close(sockfd);
+        server.close();
+        if (!isSuccessful) {
+            std::cout << variant << ": sending failed: " << strerror(errno) << "\n";
+            return false;
+        }
+
+        std::cout << variant << ": " << static_cast<double>(numOfSends) / numOfMessages << " send syscalls/message, " <<
+                  static_cast<size_t>(numOfMessages / elapsed.count()) << " messages/s\n";
+        return true;
+    }
+}
+
+int main(int argc, char * argv[]) {
+    isClientThread = true;
+    const size_t numOfRequests = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    const int port = (argc > 2) ? std::atoi(argv[2]) : 65500;
+
+    std::cout << numOfRequests << " requests, each answered with " << RESPONSES_PER_REQUEST <<
+              " messages of " << RESPONSE_SIZE << " bytes\n";
+    const bool isSuccessful = benchmark("send() per message", SendMode::SEND_PER_MESSAGE, port, numOfRequests) &&
+                              benchmark("coalesced sendmsg()", SendMode::COALESCED, port + 1, numOfRequests) &&
+                              benchmark("coalesced, hasMore bursts", SendMode::COALESCED_BURST, port + 2, numOfRequests);
+    return isSuccessful ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+///////////////////////////////////////////////////////////
+//////////////////COROUTINE SERVER RUNNER/////////////////
+///////////////////////////////////////////////////////////
+
+#ifdef CORO_API
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <vector>
+#include "../include/coro.h"
+#include "../include/protocol.h"
+
+// every client runs this flow on the event loop: receive a request (see protocol.h),
+// pick a number, wait a bit and reply. No thread is blocked while a flow waits
+coro::Task<> serveClient(coro::Connection conn) {
+    std::cout << "\nCoroutine server accepted new client with IP: " << conn.ip() << "\n";
+    FrameReassembler reassembler(std::make_shared<protocol::MessageFraming>());
+    while (true) {
+        const std::string received = co_await conn.read();
+        if (received.empty()) {
+            std::cout << "Client: " << conn.ip() << " disconnected.\n";
+            co_return;
+        }
+        std::vector<std::string> requests;
+        const bool isValidStream = reassembler.feed(received.data(), received.size(), [&requests](const char * msg, size_t size) {
+            requests.emplace_back(msg, size);
+        });
+        if (!isValidStream) {
+            std::cout << "Client: " << conn.ip() << " sent an invalid frame.\n";
+            co_return;
+        }
+
+        for (const std::string & encodedRequest : requests) {
+            protocol::message_t request;
+            uint32_t ID = 0;
+            protocol::decode(encodedRequest.data(), encodedRequest.size(), request);
+            if (request.header.opcode != protocol::Opcode::GET_NEXT_NUMBER || !protocol::decodeUint32(request, ID)) {
+                co_await conn.write(protocol::encodeError(request.header.requestId, protocol::ErrorCode::UNKNOWN_OPCODE));
+                continue;
+            }
+            const int value = (rand() % 50) * 2 + (ID % 2 == 0 ? 0 : 1); // even number for even IDs
+            std::cout << "\nClient with ID " << ID << " requested a new unique number for the day.\n";
+
+            co_await coro::sleep_for(5000);
+            co_await conn.write(protocol::encodeUint32(protocol::Opcode::NEXT_NUMBER, request.header.requestId, value));
+        }
+    }
+}
+
+coro::Task<> acceptClients(EventLoop & loop, coro::Server & server) {
+    while (true) {
+        coro::Connection conn = co_await server.accept();
+        coro::spawn(loop, serveClient(std::move(conn)));
+    }
+}
+
+int main() {
+    const int port = 65123;
+    EventLoop loop;
+    coro::Server server(loop);
+    pipe_ret_t listenRet = server.listen(port);
+    if (!listenRet.isSuccessful()) {
+        std::cout << "\nSERVER SETUP FAILED: " << listenRet.message() << "\n";
+        return 1;
+    }
+    std::cout << "\n\nSERVER SETUP SUCCEEDED WITH PORT NUMBER: " << port << "\n";
+
+    coro::spawn(loop, acceptClients(loop, server));
+    loop.run();
+    return 0;
+}
+
+#endif
@@ -0,0 +1,161 @@
+///////////////////////////////////////////////////////////
+////////////////DISPATCH ALLOCATION TEST///////////////////
+///////////////////////////////////////////////////////////
+
+// Heap allocations of the receive path, from the socket through the client's
+// reassembly to the server observers. A client streams framed messages in
+// writes that cut nearly every frame in two, so they are reassembled across
+// reads. Once the first messages are through, the server must not allocate per
+// message: the test fails above MAX_ALLOCATIONS_PER_MESSAGE.
+// operator new is replaced here to count the allocations.
+//
+// usage: dispatch_allocation_test [port]
+
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <new>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../include/tcp_server.h"
+
+namespace {
+    std::atomic<size_t> numOfAllocations(0);
+}
+
+void * operator new(size_t size) {
+    numOfAllocations.fetch_add(1, std::memory_order_relaxed);
+    void * memory = std::malloc(size ? size : 1);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void * memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void * memory, size_t) noexcept {
+    std::free(memory);
+}
+
+namespace {
+
+    const size_t PAYLOAD_SIZE = 33; // 37 byte frames
+    const size_t WRITE_SIZE = 50;
+    const size_t NUM_OF_WARMUP_MESSAGES = 1000;
+    const size_t NUM_OF_MESSAGES = 20000;
+    const double MAX_ALLOCATIONS_PER_MESSAGE = 0.01;
+
+    std::atomic<size_t> numOfMessagesReceived(0);
+    std::atomic<bool> isIntact(true);
+
+    int connectTo(int port) {
+        const int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        if (connect(sockfd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+            ::close(sockfd);
+            return -1;
+        }
+        return sockfd;
+    }
+
+    std::string framedMessages(size_t numOfMessages) {
+        const LengthPrefixedFraming framing;
+        const std::string message = framing.header(PAYLOAD_SIZE) + std::string(PAYLOAD_SIZE, 'm');
+        std::string messages;
+        messages.reserve(message.size() * numOfMessages);
+        for (size_t i = 0; i < numOfMessages; i++) {
+            messages += message;
+        }
+        return messages;
+    }
+
+    /*
+     * Write the messages WRITE_SIZE bytes at a time, waiting for the server to take
+     * each write in a read of its own. Returns false when the server stops reading.
+     */
+    bool sendInPieces(int sockfd, const std::string & messages, size_t numOfMessagesBefore) {
+        for (size_t offset = 0; offset < messages.size(); offset += WRITE_SIZE) {
+            const size_t numOfBytes = std::min(WRITE_SIZE, messages.size() - offset);
+            if (::send(sockfd, messages.data() + offset, numOfBytes, MSG_NOSIGNAL) != static_cast<ssize_t>(numOfBytes)) {
+                return false;
+            }
+            const size_t numOfMessagesExpected = numOfMessagesBefore + (offset + numOfBytes) / (PAYLOAD_SIZE + LengthPrefixedFraming::HEADER_SIZE);
+            for (int i = 0; i < 2000000 && numOfMessagesReceived < numOfMessagesExpected; i++) {
+                std::this_thread::yield();
+            }
+            if (numOfMessagesReceived < numOfMessagesExpected) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool check(bool condition, const std::string & what) {
+        if (!condition) {
+            std::cout << "FAILED: " << what << "\n";
+        }
+        return condition;
+    }
+}
+
+int main(int argc, char * argv[]) {
+    const int port = (argc > 1) ? std::atoi(argv[1]) : 65101;
+
+    TcpServer server;
+    server_options_t options;
+    options.maxNumOfClients = 1;
+    options.numOfIoThreads = 1;
+    options.removeDeadClientsAutomatically = false;
+    options.framing = std::make_shared<LengthPrefixedFraming>();
+    const pipe_ret_t startRet = server.start(port, options);
+    if (!check(startRet.isSuccessful(), "server starts: " + startRet.message())) {
+        return 1;
+    }
+    server_observer_t observer;
+    observer.incomingPacketHandler = [](connection_handle_t, const std::string &, const char * msg, size_t size) {
+        if (size != PAYLOAD_SIZE || msg[0] != 'm' || msg[size - 1] != 'm') {
+            isIntact = false;
+        }
+        numOfMessagesReceived++;
+    };
+    server.subscribe(observer);
+
+    const int sockfd = connectTo(port);
+    if (!check(sockfd != -1, "client connects")) {
+        return 1;
+    }
+    server.acceptClient(0); // already connected, accept() does not wait
+
+    const std::string warmupMessages = framedMessages(NUM_OF_WARMUP_MESSAGES);
+    const std::string messages = framedMessages(NUM_OF_MESSAGES);
+    const bool isWarmedUp = sendInPieces(sockfd, warmupMessages, 0);
+    const size_t numOfAllocationsBefore = numOfAllocations;
+    const bool isSent = isWarmedUp && sendInPieces(sockfd, messages, NUM_OF_WARMUP_MESSAGES);
+    const size_t numOfAllocationsMade = numOfAllocations - numOfAllocationsBefore;
+
+    ::close(sockfd);
+    server.close();
+
+    const double allocationsPerMessage = static_cast<double>(numOfAllocationsMade) / NUM_OF_MESSAGES;
+    std::cout << allocationsPerMessage << " allocations/message\n";
+    const bool isSuccessful = check(isSent, "every message is received") &&
+                              check(isIntact, "messages arrive intact") &&
+                              check(allocationsPerMessage <= MAX_ALLOCATIONS_PER_MESSAGE, "no allocation per message");
+    if (isSuccessful) {
+        std::cout << "passed\n";
+    }
+    return isSuccessful ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+///////////////////////////////////////////////////////////
+/////////////////////DISPATCH BENCHMARK////////////////////
+///////////////////////////////////////////////////////////
+
+// Per message cost of the receive -> reassemble -> handle path, for TcpServer
+// (std::function observers, virtual framing) and for BasicTcpServer typed on its
+// handler and on LengthPrefixedFraming. A client pipelines many small framed
+// messages over loopback, so each read carries thousands of them and the socket
+// cost is spread thin; what is left is mostly the dispatch path.
+//
+// usage: dispatch_benchmark [numOfMessages] [port]
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "../include/tcp_server.h"
+#include "../include/basic_tcp_server.h"
+
+namespace {
+
+    const size_t PAYLOAD_SIZE = 16;
+    const size_t WRITE_SIZE = 64 * 1024;
+    const int NUM_OF_ROUNDS = 3;
+
+    using benchmark_clock_t = std::chrono::steady_clock;
+
+    // counted by the one loop thread serving the client, read by the main thread
+    std::atomic<size_t> numOfMessagesReceived(0);
+    std::atomic<bool> isClientAccepted(false);
+
+    void countMessage() {
+        numOfMessagesReceived.store(numOfMessagesReceived.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    struct CountingHandler {
+        void onAccepted(BasicConnection<LengthPrefixedFraming> &) { isClientAccepted = true; }
+        void onMessage(BasicConnection<LengthPrefixedFraming> &, const char *, size_t) { countMessage(); }
+        void onDisconnected(BasicConnection<LengthPrefixedFraming> &, const std::string &) {}
+    };
+
+    int connectTo(int port) {
+        const int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        if (connect(sockfd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+            ::close(sockfd);
+            return -1;
+        }
+        const int noDelay = 1;
+        setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        return sockfd;
+    }
+
+    std::string framedMessages(size_t numOfMessages) {
+        const LengthPrefixedFraming framing;
+        const std::string message = framing.header(PAYLOAD_SIZE) + std::string(PAYLOAD_SIZE, 'x');
+        std::string messages;
+        messages.reserve(message.size() * numOfMessages);
+        for (size_t i = 0; i < numOfMessages; i++) {
+            messages += message;
+        }
+        return messages;
+    }
+
+    /*
+     * Send the messages and wait until the server handled all of them.
+     * Returns nanoseconds per message, or a negative value on failure.
+     */
+    double sendAndWait(int sockfd, const std::string & messages, size_t numOfMessages) {
+        numOfMessagesReceived = 0;
+        const benchmark_clock_t::time_point start = benchmark_clock_t::now();
+        for (size_t offset = 0; offset < messages.size(); ) {
+            const ssize_t numOfBytesSent = ::send(sockfd, messages.data() + offset,
+                                                  std::min(WRITE_SIZE, messages.size() - offset), MSG_NOSIGNAL);
+            if (numOfBytesSent == -1) {
+                return -1;
+            }
+            offset += numOfBytesSent;
+        }
+        while (numOfMessagesReceived.load(std::memory_order_relaxed) < numOfMessages) {
+            std::this_thread::yield();
+        }
+        const std::chrono::nanoseconds elapsed = benchmark_clock_t::now() - start;
+        return static_cast<double>(elapsed.count()) / numOfMessages;
+    }
+
+    void report(const std::string & variant, const std::vector<double> & nsPerMessage) {
+        double best = nsPerMessage.front();
+        for (double ns : nsPerMessage) {
+            best = std::min(best, ns);
+        }
+        std::cout << variant << ": " << best << " ns/message, " <<
+                  static_cast<size_t>(1e9 / best) << " messages/s (best of " << nsPerMessage.size() << ")\n";
+    }
+
+    bool benchmarkTcpServer(int port, const std::string & messages, size_t numOfMessages) {
+        TcpServer server;
+        server_options_t options;
+        options.numOfIoThreads = 1;
+        options.removeDeadClientsAutomatically = false;
+        options.framing = std::make_shared<LengthPrefixedFraming>();
+        const pipe_ret_t startRet = server.start(port, options);
+        if (!startRet.isSuccessful()) {
+            std::cout << "TcpServer failed to start: " << startRet.message() << "\n";
+            return false;
+        }
+        server_observer_t observer;
+        observer.incomingPacketHandler = [](connection_handle_t, const std::string &, const char *, size_t) { countMessage(); };
+        server.subscribe(observer);
+
+        const int sockfd = connectTo(port);
+        if (sockfd == -1) {
+            return false;
+        }
+        server.acceptClient(0); // already connected, accept() does not wait
+
+        std::vector<double> nsPerMessage;
+        for (int round = 0; round < NUM_OF_ROUNDS; round++) {
+            const double ns = sendAndWait(sockfd, messages, numOfMessages);
+            if (ns < 0) {
+                std::cout << "sending failed: " << strerror(errno) << "\n";
+                ::close(sockfd);
+                return false;
+            }
+            nsPerMessage.push_back(ns);
+        }
+        ::close(sockfd);
+        server.close();
+        report("TcpServer (type-erased)", nsPerMessage);
+        return true;
+    }
+
+    bool benchmarkBasicTcpServer(int port, const std::string & messages, size_t numOfMessages) {
+        BasicTcpServer<CountingHandler, LengthPrefixedFraming> server(CountingHandler(), std::make_shared<LengthPrefixedFraming>());
+        const pipe_ret_t startRet = server.start(port, 1);
+        if (!startRet.isSuccessful()) {
+            std::cout << "BasicTcpServer failed to start: " << startRet.message() << "\n";
+            return false;
+        }
+        const int sockfd = connectTo(port);
+        if (sockfd == -1) {
+            return false;
+        }
+        while (!isClientAccepted) {
+            std::this_thread::yield();
+        }
+
+        std::vector<double> nsPerMessage;
+        for (int round = 0; round < NUM_OF_ROUNDS; round++) {
+            const double ns = sendAndWait(sockfd, messages, numOfMessages);
+            if (ns < 0) {
+                std::cout << "sending failed: " << strerror(errno) << "\n";
+                ::close(sockfd);
+                return false;
+            }
+            nsPerMessage.push_back(ns);
+        }
+        ::close(sockfd);
+        server.close();
+        report("BasicTcpServer<CountingHandler, LengthPrefixedFraming>", nsPerMessage);
+        return true;
+    }
+}
+
+int main(int argc, char * argv[]) {
+    const size_t numOfMessages = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 2000000;
+    const int port = (argc > 2) ? std::atoi(argv[2]) : 65200;
+    const std::string messages = framedMessages(numOfMessages);
+
+    std::cout << numOfMessages << " messages of " << PAYLOAD_SIZE << " bytes per round\n";
+    const bool isSuccessful = benchmarkTcpServer(port, messages, numOfMessages) &&
+                              benchmarkBasicTcpServer(port + 1, messages, numOfMessages);
+    return isSuccessful ? 0 : 1;
+}
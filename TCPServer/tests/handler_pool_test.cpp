@@ -0,0 +1,117 @@
+///////////////////////////////////////////////////////////
+////////////////////HANDLER POOL TEST//////////////////////
+///////////////////////////////////////////////////////////
+
+// With handler threads, a slow observer callback must only hold up the client it
+// handles. Two clients share one event loop and land on different handler
+// workers; the first one's message sleeps in the callback, and the second one's
+// message has to be handled while it does.
+//
+// usage: handler_pool_test [port]
+
+#include <iostream>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../include/tcp_server.h"
+
+namespace {
+
+    const int SLOW_HANDLER_MS = 1000;
+
+    std::atomic<bool> isSlowStarted(false);
+    std::atomic<bool> isSlowDone(false);
+    std::atomic<bool> isFastDone(false);
+    std::atomic<bool> isFastHandledMeanwhile(false);
+
+    int connectTo(int port) {
+        const int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        if (connect(sockfd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+            ::close(sockfd);
+            return -1;
+        }
+        return sockfd;
+    }
+
+    bool waitFor(const std::atomic<bool> & flag, int timeoutMs) {
+        for (int i = 0; i < timeoutMs && !flag; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return flag;
+    }
+
+    bool check(bool condition, const std::string & what) {
+        if (!condition) {
+            std::cout << "FAILED: " << what << "\n";
+        }
+        return condition;
+    }
+}
+
+int main(int argc, char * argv[]) {
+    const int port = (argc > 1) ? std::atoi(argv[1]) : 65102;
+
+    TcpServer server;
+    server_options_t options;
+    options.maxNumOfClients = 2;
+    options.numOfIoThreads = 1;
+    options.numOfHandlerThreads = 2;
+    options.removeDeadClientsAutomatically = false;
+    const pipe_ret_t startRet = server.start(port, options);
+    if (!check(startRet.isSuccessful(), "server starts: " + startRet.message())) {
+        return 1;
+    }
+    server_observer_t observer;
+    observer.incomingPacketHandler = [](connection_handle_t, const std::string &, const char * msg, size_t) {
+        if (msg[0] == 's') {
+            isSlowStarted = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(SLOW_HANDLER_MS));
+            isSlowDone = true;
+            return;
+        }
+        isFastHandledMeanwhile = isSlowStarted && !isSlowDone;
+        isFastDone = true;
+    };
+    server.subscribe(observer);
+
+    // connected before either is accepted, so the server sockets get consecutive
+    // descriptors, which the pool maps to different workers
+    const int slowSockfd = connectTo(port);
+    const int fastSockfd = connectTo(port);
+    if (!check(slowSockfd != -1 && fastSockfd != -1, "clients connect")) {
+        return 1;
+    }
+    server.acceptClient(0); // already connected, accept() does not wait
+    server.acceptClient(0);
+
+    const char slow = 's';
+    const char fast = 'f';
+    ::send(slowSockfd, &slow, sizeof(slow), MSG_NOSIGNAL);
+    const bool isSlowHandled = waitFor(isSlowStarted, 2000);
+    ::send(fastSockfd, &fast, sizeof(fast), MSG_NOSIGNAL);
+    const bool isFastHandled = waitFor(isFastDone, 2 * SLOW_HANDLER_MS);
+
+    ::close(slowSockfd);
+    ::close(fastSockfd);
+    server.close();
+
+    const bool isSuccessful = check(isSlowHandled, "the slow message is handled") &&
+                              check(isFastHandled, "the fast message is handled") &&
+                              check(isFastHandledMeanwhile, "the fast message is handled while the slow one sleeps");
+    if (isSuccessful) {
+        std::cout << "passed\n";
+    }
+    return isSuccessful ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+///////////////////////////////////////////////////////////
+///////////////////REASSEMBLY BENCHMARK////////////////////
+///////////////////////////////////////////////////////////
+
+// Heap allocations per message and throughput of BasicFrameReassembler, for each
+// framing, with a stream of messages cut into reads of several sizes. Reads
+// holding whole frames should not allocate; a frame split across reads costs one
+// buffer for its head, which later reads only top up with the bytes it misses.
+// The large message rows feed frames of many reads, where rescanning the buffered
+// bytes on every read would show up as a throughput collapse.
+// operator new is replaced here to count the allocations.
+//
+// usage: reassembly_benchmark [numOfBytesPerRun]
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <cstdlib>
+#include "../include/framing.h"
+
+namespace {
+    std::atomic<size_t> numOfAllocations(0);
+}
+
+void * operator new(size_t size) {
+    numOfAllocations.fetch_add(1, std::memory_order_relaxed);
+    void * memory = std::malloc(size ? size : 1);
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void * memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void * memory, size_t) noexcept {
+    std::free(memory);
+}
+
+namespace {
+
+    using benchmark_clock_t = std::chrono::steady_clock;
+
+    /*
+     * numOfMessages framed messages of payloadSize bytes, back to back
+     */
+    template <typename FramingT>
+    std::string framedStream(const FramingT & framing, size_t payloadSize, size_t numOfMessages) {
+        std::string message = framing.header(payloadSize);
+        message += std::string(payloadSize, 'p');
+        message += framing.trailer();
+        std::string stream;
+        stream.reserve(message.size() * numOfMessages);
+        for (size_t i = 0; i < numOfMessages; i++) {
+            stream += message;
+        }
+        return stream;
+    }
+
+    template <typename FramingT>
+    bool benchmark(const std::string & variant, const std::shared_ptr<const FramingT> & framing,
+                   size_t payloadSize, size_t readSize, size_t numOfBytesPerRun) {
+        const size_t numOfMessages = std::max<size_t>(1, numOfBytesPerRun / payloadSize);
+        const std::string stream = framedStream(*framing, payloadSize, numOfMessages);
+        BasicFrameReassembler<FramingT> reassembler(framing);
+        size_t numOfMessagesReceived = 0;
+        bool isIntact = true;
+        const auto onMessage = [&numOfMessagesReceived, &isIntact, payloadSize](const char *, size_t size) {
+            numOfMessagesReceived++;
+            isIntact = isIntact && (size == payloadSize);
+        };
+
+        numOfAllocations = 0;
+        const benchmark_clock_t::time_point start = benchmark_clock_t::now();
+        for (size_t offset = 0; offset < stream.size(); offset += readSize) {
+            if (!reassembler.feed(stream.data() + offset, std::min(readSize, stream.size() - offset), onMessage)) {
+                isIntact = false;
+                break;
+            }
+        }
+        const std::chrono::duration<double> elapsed = benchmark_clock_t::now() - start;
+        const size_t numOfAllocationsMade = numOfAllocations;
+
+        if (!isIntact || numOfMessagesReceived != numOfMessages) {
+            std::cout << variant << ": got " << numOfMessagesReceived << " of " << numOfMessages << " messages\n";
+            return false;
+        }
+        std::cout << variant << ", " << payloadSize << " byte messages in " << readSize << " byte reads: " <<
+                  static_cast<double>(numOfAllocationsMade) / numOfMessages << " allocations/message, " <<
+                  static_cast<size_t>(stream.size() / elapsed.count() / (1024 * 1024)) << " MB/s\n";
+        return true;
+    }
+
+    template <typename FramingT>
+    bool benchmarkReadSizes(const std::string & variant, const std::shared_ptr<const FramingT> & framing, size_t numOfBytesPerRun) {
+        const size_t smallPayloadSize = 100;
+        const size_t largePayloadSize = 1024 * 1024;
+        return benchmark(variant, framing, smallPayloadSize, 16 * 1024, numOfBytesPerRun) &&
+               benchmark(variant, framing, smallPayloadSize, 1500, numOfBytesPerRun) &&
+               benchmark(variant, framing, smallPayloadSize, 37, numOfBytesPerRun) &&
+               benchmark(variant, framing, largePayloadSize, 16 * 1024, numOfBytesPerRun);
+    }
+}
+
+int main(int argc, char * argv[]) {
+    const size_t numOfBytesPerRun = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 64 * 1024 * 1024;
+    const size_t maxPayloadSize = 4 * 1024 * 1024;
+
+    const bool isSuccessful =
+        benchmarkReadSizes("LengthPrefixedFraming", std::make_shared<const LengthPrefixedFraming>(maxPayloadSize), numOfBytesPerRun) &&
+        benchmarkReadSizes("DelimiterFraming(\"\\r\\n\")", std::make_shared<const DelimiterFraming>("\r\n", maxPayloadSize), numOfBytesPerRun) &&
+        benchmark("FixedSizeFraming", std::make_shared<const FixedSizeFraming>(100), 100, 1500, numOfBytesPerRun);
+    return isSuccessful ? 0 : 1;
+}
@@ -0,0 +1,177 @@
+///////////////////////////////////////////////////////////
+//////////////////////RING BENCHMARK///////////////////////
+///////////////////////////////////////////////////////////
+
+// Hand-off between threads through SpscRing, MpscRing and std::mutex + std::queue
+// (with condition variables, as the handler pool queues were).
+// Every item is the time it was pushed at. Each queue is run twice:
+//  - flooded: the producers push as fast as the consumer takes, giving messages/s
+//  - paced: each producer pushes one item every PACING_NS, so the queue is mostly
+//    empty and the p99 of push -> consume is the cost of the hand-off itself
+// Every consumer takes up to MAX_ITEMS_PER_BATCH items at a time, the mutex one all
+// under a single lock, so the rings are compared against a batched baseline. The
+// ring consumers poll, the mutex consumer sleeps on the condition variable when
+// the queue is empty.
+//
+// usage: ring_benchmark [numOfMessages] [numOfProducers]
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include "../include/ring_buffer.h"
+
+namespace {
+
+    const size_t QUEUE_CAPACITY = 1024;
+    const size_t MAX_ITEMS_PER_BATCH = 64;
+    const uint64_t PACING_NS = 2000;
+    const size_t NUM_OF_PACED_MESSAGES = 200000;
+
+    using benchmark_clock_t = std::chrono::steady_clock;
+
+    uint64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(benchmark_clock_t::now().time_since_epoch()).count();
+    }
+
+    struct SpscQueue {
+        SpscRing<uint64_t> ring{QUEUE_CAPACITY};
+
+        void push(uint64_t item) {
+            while (!ring.tryPush(std::move(item))) {
+                std::this_thread::yield();
+            }
+        }
+        template <typename Consumer>
+        size_t take(const Consumer & consume) { return ring.drain(consume, MAX_ITEMS_PER_BATCH); }
+    };
+
+    struct MpscQueue {
+        MpscRing<uint64_t> ring{QUEUE_CAPACITY};
+
+        void push(uint64_t item) {
+            while (!ring.tryPush(std::move(item))) {
+                std::this_thread::yield();
+            }
+        }
+        template <typename Consumer>
+        size_t take(const Consumer & consume) { return ring.drain(consume, MAX_ITEMS_PER_BATCH); }
+    };
+
+    struct MutexQueue {
+        std::mutex mtx;
+        std::condition_variable notEmpty;
+        std::condition_variable notFull;
+        std::queue<uint64_t> items;
+
+        void push(uint64_t item) {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                notFull.wait(lock, [this]() { return items.size() < QUEUE_CAPACITY; });
+                items.push(item);
+            }
+            notEmpty.notify_one();
+        }
+        template <typename Consumer>
+        size_t take(const Consumer & consume) {
+            uint64_t batch[MAX_ITEMS_PER_BATCH];
+            size_t numOfItems = 0;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                if (!notEmpty.wait_for(lock, std::chrono::milliseconds(1), [this]() { return !items.empty(); })) {
+                    return 0;
+                }
+                while (numOfItems < MAX_ITEMS_PER_BATCH && !items.empty()) {
+                    batch[numOfItems++] = items.front();
+                    items.pop();
+                }
+            }
+            notFull.notify_all();
+            for (size_t i = 0; i < numOfItems; i++) {
+                consume(std::move(batch[i]));
+            }
+            return numOfItems;
+        }
+    };
+
+    struct result_t {
+        double messagesPerSecond;
+        uint64_t p99Ns;
+    };
+
+    template <typename Queue>
+    result_t run(size_t numOfProducers, size_t numOfMessages, uint64_t pacingNs) {
+        Queue queue;
+        std::vector<uint64_t> latencies;
+        latencies.reserve(numOfMessages);
+        const size_t messagesPerProducer = numOfMessages / numOfProducers;
+        const size_t numOfMessagesSent = messagesPerProducer * numOfProducers;
+
+        std::atomic<bool> isGo(false);
+        std::vector<std::thread> producers;
+        for (size_t i = 0; i < numOfProducers; i++) {
+            producers.emplace_back([&queue, &isGo, messagesPerProducer, pacingNs]() {
+                while (!isGo) {
+                    std::this_thread::yield();
+                }
+                uint64_t nextPushNs = nowNs();
+                for (size_t j = 0; j < messagesPerProducer; j++) {
+                    if (pacingNs > 0) {
+                        while (nowNs() < nextPushNs) {}
+                        nextPushNs += pacingNs;
+                    }
+                    queue.push(nowNs());
+                }
+            });
+        }
+
+        const benchmark_clock_t::time_point start = benchmark_clock_t::now();
+        isGo = true;
+        while (latencies.size() < numOfMessagesSent) {
+            const size_t numOfItems = queue.take([&latencies](uint64_t && pushedNs) {
+                latencies.push_back(nowNs() - pushedNs);
+            });
+            if (numOfItems == 0) {
+                std::this_thread::yield();
+            }
+        }
+        const std::chrono::duration<double> elapsed = benchmark_clock_t::now() - start;
+        for (std::thread & producer : producers) {
+            producer.join();
+        }
+
+        const size_t p99Index = latencies.size() * 99 / 100;
+        std::nth_element(latencies.begin(), latencies.begin() + p99Index, latencies.end());
+        return result_t{numOfMessagesSent / elapsed.count(), latencies[p99Index]};
+    }
+
+    template <typename Queue>
+    void report(const std::string & variant, size_t numOfProducers, size_t numOfMessages) {
+        const result_t flooded = run<Queue>(numOfProducers, numOfMessages, 0);
+        const result_t paced = run<Queue>(numOfProducers, NUM_OF_PACED_MESSAGES, PACING_NS);
+        std::cout << variant << ", " << numOfProducers << " producer(s): " <<
+                  static_cast<size_t>(flooded.messagesPerSecond) << " messages/s, p99 hand-off " <<
+                  paced.p99Ns << " ns (paced), " << flooded.p99Ns << " ns (flooded)\n";
+    }
+}
+
+int main(int argc, char * argv[]) {
+    const size_t numOfMessages = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 4000000;
+    const size_t numOfProducers = (argc > 2) ? std::max(1ul, std::strtoul(argv[2], nullptr, 10)) : 4;
+
+    std::cout << numOfMessages << " messages per flooded run, " << NUM_OF_PACED_MESSAGES <<
+              " pushed every " << PACING_NS << " ns per paced run\n";
+    report<SpscQueue>("SpscRing", 1, numOfMessages);
+    report<MutexQueue>("std::mutex + std::queue", 1, numOfMessages);
+    report<MpscQueue>("MpscRing", numOfProducers, numOfMessages);
+    report<MutexQueue>("std::mutex + std::queue", numOfProducers, numOfMessages);
+    return 0;
+}
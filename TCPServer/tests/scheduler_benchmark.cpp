@@ -0,0 +1,149 @@
+///////////////////////////////////////////////////////////
+///////////////////SCHEDULER BENCHMARK/////////////////////
+///////////////////////////////////////////////////////////
+
+// Task throughput of TaskScheduler (per worker deques with stealing) against a
+// pool of the same size sharing one std::mutex + std::deque, from 1 to 32 workers.
+// Every request is a chain of short steps, each step spawning the next one from
+// the worker running it, as a handler's generate -> sort -> write -> reply chain
+// does. The requests themselves are spawned from the main thread.
+//
+// usage: scheduler_benchmark [numOfRequests] [maxNumOfWorkers]
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <cstdlib>
+#include "../include/task_scheduler.h"
+
+namespace {
+
+    const size_t STEPS_PER_REQUEST = 4;
+    const size_t WORK_PER_STEP = 200; // iterations of busy work, about a few hundred ns
+
+    using benchmark_clock_t = std::chrono::steady_clock;
+    using task_t = std::function<void()>;
+
+    std::atomic<size_t> numOfStepsDone(0);
+
+    void work() {
+        volatile uint64_t value = 0;
+        for (size_t i = 0; i < WORK_PER_STEP; i++) {
+            value = value * 31 + i;
+        }
+    }
+
+    /*
+     * Workers sharing a single locked queue
+     */
+    class LockedQueuePool {
+
+    private:
+        std::mutex _tasksMtx;
+        std::condition_variable _notEmpty;
+        std::deque<task_t> _tasks;
+        std::vector<std::thread> _threads;
+        bool _running = true;
+
+        void workerTask() {
+            while (true) {
+                task_t task;
+                {
+                    std::unique_lock<std::mutex> lock(_tasksMtx);
+                    _notEmpty.wait(lock, [this]() { return !_tasks.empty() || !_running; });
+                    if (_tasks.empty()) {
+                        return;
+                    }
+                    task = std::move(_tasks.front());
+                    _tasks.pop_front();
+                }
+                task();
+            }
+        }
+
+    public:
+        explicit LockedQueuePool(size_t numOfWorkers) {
+            for (size_t i = 0; i < numOfWorkers; i++) {
+                _threads.emplace_back(&LockedQueuePool::workerTask, this);
+            }
+        }
+        ~LockedQueuePool() {
+            {
+                std::lock_guard<std::mutex> lock(_tasksMtx);
+                _running = false;
+            }
+            _notEmpty.notify_all();
+            for (std::thread & thread : _threads) {
+                thread.join();
+            }
+        }
+
+        void spawn(task_t task) {
+            {
+                std::lock_guard<std::mutex> lock(_tasksMtx);
+                _tasks.push_back(std::move(task));
+            }
+            _notEmpty.notify_one();
+        }
+    };
+
+    template <typename Pool>
+    void step(Pool & pool, size_t stepsLeft) {
+        work();
+        numOfStepsDone.fetch_add(1, std::memory_order_relaxed);
+        if (stepsLeft > 1) {
+            pool.spawn([&pool, stepsLeft]() { step(pool, stepsLeft - 1); });
+        }
+    }
+
+    /*
+     * Returns steps per second
+     */
+    template <typename Pool>
+    double run(Pool & pool, size_t numOfRequests) {
+        numOfStepsDone = 0;
+        const size_t numOfSteps = numOfRequests * STEPS_PER_REQUEST;
+        const benchmark_clock_t::time_point start = benchmark_clock_t::now();
+        for (size_t i = 0; i < numOfRequests; i++) {
+            pool.spawn([&pool]() { step(pool, STEPS_PER_REQUEST); });
+        }
+        while (numOfStepsDone.load(std::memory_order_relaxed) < numOfSteps) {
+            std::this_thread::yield();
+        }
+        const std::chrono::duration<double> elapsed = benchmark_clock_t::now() - start;
+        return numOfSteps / elapsed.count();
+    }
+}
+
+int main(int argc, char * argv[]) {
+    const size_t numOfRequests = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    const size_t maxNumOfWorkers = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 32;
+
+    std::cout << numOfRequests << " requests of " << STEPS_PER_REQUEST << " steps, " <<
+              std::thread::hardware_concurrency() << " hardware threads\n";
+    for (size_t numOfWorkers = 1; numOfWorkers <= maxNumOfWorkers; numOfWorkers *= 2) {
+        double stealingStepsPerSecond;
+        {
+            TaskScheduler scheduler(numOfWorkers);
+            scheduler.start();
+            stealingStepsPerSecond = run(scheduler, numOfRequests);
+            scheduler.stop();
+        }
+        double lockedStepsPerSecond;
+        {
+            LockedQueuePool pool(numOfWorkers);
+            lockedStepsPerSecond = run(pool, numOfRequests);
+        }
+        std::cout << numOfWorkers << " worker(s): TaskScheduler " << static_cast<size_t>(stealingStepsPerSecond) <<
+                  " tasks/s, locked queue " << static_cast<size_t>(lockedStepsPerSecond) << " tasks/s\n";
+    }
+    return 0;
+}
@@ -7,7 +7,10 @@
 #include <iostream>
 #include <csignal>
 #include <fstream>
+#include <cstdio>
+#include <atomic>
 #include "../include/tcp_server.h"
+#include "../include/protocol.h"
 #include <string>
  
  
@@ -18,56 +21,172 @@ TcpServer server;
 // the server supports multiple observers
 server_observer_t observer1, observer2;
 
-// observer callback. will be called for every new message received by clients
-// with the requested IP address
-// this is the callback for the even server 
-void onIncomingMsg1(const std::string &clientIP, const char * msg, size_t size) {
-   std::string msgStr = msg;
-   int ID = std::stoi(msg);
-   Client* client = server._clients[ID];
-   int value = server.generateNumber(ID);
-   Node* head = client->head;
-   std::ofstream clientFile;
-   std::string clientFileName;
+// file the sorted list of numbers given to a client is kept in
+std::string listFileName(int ID) {
    if (ID % 2 == 0){
-       clientFileName = "(EVEN) CLIENT ID #: " + std::to_string(ID);
-   }
-   else{
-       clientFileName = "(ODD) CLIENT ID #: " + std::to_string(ID);
+       return "(EVEN) CLIENT ID #: " + std::to_string(ID);
    }
+   return "(ODD) CLIENT ID #: " + std::to_string(ID);
+}
+
+// clients are looked up by their index in server._clients, so every step touching a
+// client's list or list file holds server._clientsMtx: the client can not be removed
+// meanwhile, and the handler and task threads never work on one list at the same time
+bool isKnownClient(int ID) {
+   return ID >= 0 && static_cast<size_t>(ID) < server._clients.size();
+}
+
+// write the client's list to its file, in list order. Called with server._clientsMtx held
+void writeListFile(int ID, const std::string & clientFileName) {
+   std::ofstream clientFile;
    clientFile.open(clientFileName);
-   while (head->next != nullptr){
-       clientFile << head->data << "->";
-       head = head->next;
-   }
-   if (head != nullptr){
-        clientFile << head->data;
+   for (Node* node = server._clients[ID]->head; node != nullptr; node = node->next) {
+       clientFile << node->data;
+       if (node->next != nullptr) {
+           clientFile << "->";
+       }
    }
    clientFile.close();
+}
+
+// numbers given to a client so far, in list order. Called with server._clientsMtx held
+std::vector<int32_t> numbersOf(int ID) {
+   std::vector<int32_t> numbers;
+   for (Node* node = server._clients[ID]->head; node != nullptr; node = node->next) {
+       numbers.push_back(node->data);
+   }
+   return numbers;
+}
+
+// snapshot files of lists being sent are numbered, so concurrent requests never share one
+std::atomic<uint64_t> nextSnapshotId(0);
+
+// write a message to a file of its own, to be streamed with sendFileToClient()
+bool writeSnapshotFile(const std::string & snapshotFileName, const std::string & message) {
+   std::ofstream snapshotFile(snapshotFileName, std::ios::binary | std::ios::trunc);
+   snapshotFile.write(message.data(), message.size());
+   snapshotFile.close();
+   return !snapshotFile.fail();
+}
+
+// observer callback. will be called for every request (see protocol.h) received by clients
+// with the requested IP address. Responses go back to the connection the request came from
+// this is the callback for the even server 
+void onIncomingMsg1(connection_handle_t connection, const std::string &/*clientIP*/, const char * msg, size_t size) {
+   protocol::message_t request;
+   if (!protocol::decode(msg, size, request)) { // the framing only hands out whole messages
+       return;
+   }
+   const uint32_t requestId = request.header.requestId;
+   uint32_t clientID = 0;
+   if (!protocol::decodeUint32(request, clientID)) {
+       const std::string error = protocol::encodeError(requestId, protocol::ErrorCode::BAD_PAYLOAD);
+       server.sendToClient(connection, error.data(), error.size());
+       return;
+   }
+   const int ID = static_cast<int>(clientID);
+   const std::string unknownClient = protocol::encodeError(requestId, protocol::ErrorCode::UNKNOWN_CLIENT);
+
+   if (request.header.opcode == protocol::Opcode::GET_LIST) { // sort the client's numbers and stream them back
+       server.spawn([connection, ID, requestId, unknownClient]() {
+           std::vector<int32_t> numbers;
+           bool isKnown;
+           {
+               std::lock_guard<std::mutex> lock(server._clientsMtx);
+               isKnown = isKnownClient(ID);
+               if (isKnown) {
+                   server.sortList(ID, listFileName(ID));
+                   numbers = numbersOf(ID);
+               }
+           }
+           if (!isKnown) { // sending takes server._clientsMtx too
+               server.sendToClient(connection, unknownClient.data(), unknownClient.size());
+               return;
+           }
+           // the list goes out as a file, streamed by the event loop with sendfile(). Every
+           // request gets a snapshot file of its own, holding the whole LIST message: the
+           // list file is rewritten by later requests, and a file changing under a send in
+           // flight would desync the peer. The queued send keeps the snapshot open, so it
+           // is unlinked right away
+           const std::string snapshotFileName = listFileName(ID) + " (SENDING " + std::to_string(nextSnapshotId++) + ")";
+           if (!writeSnapshotFile(snapshotFileName, protocol::encodeInt32s(protocol::Opcode::LIST, requestId, numbers))) {
+               std::cout << "\nFailed to write " << snapshotFileName << "\n";
+               return;
+           }
+           const pipe_ret_t sendRet = server.sendFileToClient(connection, snapshotFileName);
+           std::remove(snapshotFileName.c_str());
+           if (!sendRet.isSuccessful()) {
+               std::cout << "\nFailed to send the list of client " << ID << ": " << sendRet.message() << "\n";
+           }
+       });
+       return;
+   }
+   if (request.header.opcode != protocol::Opcode::GET_NEXT_NUMBER) {
+       const std::string error = protocol::encodeError(requestId, protocol::ErrorCode::UNKNOWN_OPCODE);
+       server.sendToClient(connection, error.data(), error.size());
+       return;
+   }
+
+   int value = 0;
+   bool isKnown;
+   {
+       std::lock_guard<std::mutex> lock(server._clientsMtx);
+       isKnown = isKnownClient(ID);
+       if (isKnown) {
+           value = server.generateNumber(ID);
+       }
+   }
+   if (!isKnown) {
+       server.sendToClient(connection, unknownClient.data(), unknownClient.size());
+       return;
+   }
+   std::string clientFileName = listFileName(ID);
    if (ID % 2 == 0){
        std::cout << "\nClient with ID " << ID << " requested a new unique even number for the day." << "\n";
    }
    else{
        std::cout << "\nClient with ID " << ID << " requested a new unique odd number for the day." << "\n";
    }
-   sleep(5);
-   server.sortList(ID, clientFileName);
-   std::string theValue = std::to_string(value);
-   server.sendToClient(*server._clients[ID], theValue.c_str(), theValue.size());
+
+   // write the list, then sort it, as one task on the server's task scheduler
+   server.spawn([connection, ID, value, requestId, clientFileName]() {
+       {
+           std::lock_guard<std::mutex> lock(server._clientsMtx);
+           if (!isKnownClient(ID)) {
+               return; // removed meanwhile
+           }
+           writeListFile(ID, clientFileName);
+           server.sortList(ID, clientFileName);
+       }
+       // answer after 5 seconds, without keeping a thread busy meanwhile
+       server.sendAfter(connection, 5000, protocol::encodeUint32(protocol::Opcode::NEXT_NUMBER, requestId, value));
+   });
 }
 
  
+// observer callback. will be called when the even server accepts a new client
+void onClientAccepted(const Client &client) {
+   std::cout << "\n\n<<Even server accepted new client with IP: " << client.getIp() << ">>\n" <<
+             "== updated list of accepted clients ==" << "\n";
+   server.printClients();
+}
+
 // observer callback. will be called when client disconnects from even server
-void onClientDisconnected(const std::string &ip, const std::string &msg) {
+void onClientDisconnected(connection_handle_t /*connection*/, const std::string &ip, const std::string &msg) {
    std::cout << "Client: " << ip << " disconnected. Reason: " << msg << "\n";
 }
 
 void evenServer(){
    // start server on port 65123
    int port = 65123;
-   int maxClients = 20;
-   bool removeClients = true;
-   pipe_ret_t startRet = server.start(port, maxClients, removeClients);
+   server_options_t options;
+   options.maxNumOfClients = 20;
+   options.removeDeadClientsAutomatically = true;
+   options.numOfHandlerThreads = 4; // onIncomingMsg1 is slow, keep it off the I/O threads
+   options.numOfTaskThreads = 4; // runs the follow up steps spawned by onIncomingMsg1
+   options.framing = std::make_shared<protocol::MessageFraming>(); // one request per callback, however TCP splits them
+   options.reportPlacement = true;
+   pipe_ret_t startRet = server.start(port, options);
    if (startRet.isSuccessful()) {
        std::cout << "\n\nSERVER SETUP SUCCEEDED WITH PORT NUMBER: " << port << "\n";
    } else {
@@ -77,20 +196,14 @@ void evenServer(){
    // configure and register observer1
    observer1.incomingPacketHandler = onIncomingMsg1;
    observer1.disconnectionHandler = onClientDisconnected;
+   observer1.clientAcceptedHandler = onClientAccepted;
    server.subscribe(observer1);
  
-   while (true){
-       try {
-       std::cout << "\nSERVER WAITING FOR INCOMING CLIENT...\n";
-       Client* client = server.acceptClient(0);
-       std::cout << "\n\n<<Even server accepted new client with IP: " << client->getIp() << ">>\n" <<
-                 "== updated list of accepted clients ==" << "\n";
-       server.printClients();
-       observer1.wantedIP = client->getIp();
-   } 
-   catch (const std::runtime_error &error) {
-       std::cout << "Accepting client failed: " << error.what() << "\n";
-    }
+   // accept clients on this thread until the server is closed
+   std::cout << "\nSERVER WAITING FOR INCOMING CLIENTS...\n";
+   pipe_ret_t acceptRet = server.runAcceptLoop();
+   if (!acceptRet.isSuccessful()) {
+       std::cout << "Accepting clients failed: " << acceptRet.message() << "\n";
    }
 }
 
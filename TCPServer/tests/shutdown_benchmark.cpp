@@ -0,0 +1,176 @@
+///////////////////////////////////////////////////////////
+////////////////////SHUTDOWN BENCHMARK/////////////////////
+///////////////////////////////////////////////////////////
+
+// Time TcpServer::close() with many connected clients, and TcpClient::close()
+// for a set of connected TcpClients. Neither waits on a polling timeout: the
+// server's loops tear their clients down in parallel, and a TcpClient wakes its
+// receive thread through its eventfd.
+// Every connection takes a descriptor on both ends, so the process needs more
+// than twice numOfConnections descriptors; the soft limit is raised to the hard one.
+//
+// usage: shutdown_benchmark [numOfConnections] [numOfTcpClients] [port]
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../include/tcp_server.h"
+#include "../include/tcp_client.h"
+
+namespace {
+
+    using benchmark_clock_t = std::chrono::steady_clock;
+
+    double millisecondsSince(const benchmark_clock_t::time_point & start) {
+        const std::chrono::duration<double, std::milli> elapsed = benchmark_clock_t::now() - start;
+        return elapsed.count();
+    }
+
+    bool raiseDescriptorLimit(size_t numOfDescriptors) {
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+            return false;
+        }
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        return limit.rlim_cur >= numOfDescriptors;
+    }
+
+    int connectTo(int port) {
+        const int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        if (connect(sockfd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+            ::close(sockfd);
+            return -1;
+        }
+        return sockfd;
+    }
+
+    /*
+     * Start a server accepting on a thread of its own, and count the clients it accepted
+     */
+    struct server_runner_t {
+        TcpServer server;
+        std::thread * acceptThread = nullptr;
+        std::atomic<size_t> numOfClientsAccepted;
+
+        server_runner_t() { numOfClientsAccepted = 0; }
+
+        bool start(int port, size_t maxNumOfClients) {
+            server_options_t options;
+            options.maxNumOfClients = static_cast<int>(maxNumOfClients);
+            options.removeDeadClientsAutomatically = false;
+            const pipe_ret_t startRet = server.start(port, options);
+            if (!startRet.isSuccessful()) {
+                std::cout << "server failed to start: " << startRet.message() << "\n";
+                return false;
+            }
+            server_observer_t observer;
+            observer.clientAcceptedHandler = [this](const Client &) { numOfClientsAccepted++; };
+            server.subscribe(observer);
+            acceptThread = new std::thread([this]() { server.runAcceptLoop(); });
+            return true;
+        }
+
+        void waitForClients(size_t numOfClients) {
+            while (numOfClientsAccepted < numOfClients) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        void close() {
+            server.close();
+            acceptThread->join();
+            delete acceptThread;
+            acceptThread = nullptr;
+        }
+    };
+
+    bool benchmarkServerClose(int port, size_t numOfConnections) {
+        server_runner_t runner;
+        if (!runner.start(port, numOfConnections)) {
+            return false;
+        }
+        std::vector<int> sockfds;
+        for (size_t i = 0; i < numOfConnections; i++) {
+            const int sockfd = connectTo(port);
+            if (sockfd == -1) {
+                std::cout << "connection " << i << " failed: " << strerror(errno) << "\n";
+                break;
+            }
+            sockfds.push_back(sockfd);
+        }
+        runner.waitForClients(sockfds.size());
+
+        const benchmark_clock_t::time_point start = benchmark_clock_t::now();
+        runner.close();
+        std::cout << "TcpServer::close() with " << sockfds.size() << " clients: " << millisecondsSince(start) << " ms\n";
+
+        for (int sockfd : sockfds) {
+            ::close(sockfd);
+        }
+        return sockfds.size() == numOfConnections;
+    }
+
+    bool benchmarkClientClose(int port, size_t numOfTcpClients) {
+        server_runner_t runner;
+        if (!runner.start(port, numOfTcpClients)) {
+            return false;
+        }
+        std::vector<TcpClient*> clients;
+        for (size_t i = 0; i < numOfTcpClients; i++) {
+            TcpClient * client = new TcpClient();
+            const pipe_ret_t connectRet = client->connectTo("127.0.0.1", port);
+            if (!connectRet.isSuccessful()) {
+                std::cout << "TcpClient " << i << " failed to connect: " << connectRet.message() << "\n";
+                delete client;
+                break;
+            }
+            clients.push_back(client);
+        }
+        runner.waitForClients(clients.size());
+
+        const benchmark_clock_t::time_point start = benchmark_clock_t::now();
+        for (TcpClient * client : clients) {
+            client->close();
+        }
+        const double elapsedMs = millisecondsSince(start);
+        std::cout << "TcpClient::close() of " << clients.size() << " clients: " << elapsedMs << " ms, " <<
+                  (clients.empty() ? 0 : elapsedMs / clients.size()) << " ms per client\n";
+
+        for (TcpClient * client : clients) {
+            delete client;
+        }
+        runner.close();
+        return clients.size() == numOfTcpClients;
+    }
+}
+
+int main(int argc, char * argv[]) {
+    const size_t numOfConnections = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 10000;
+    const size_t numOfTcpClients = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 1000;
+    const int port = (argc > 3) ? std::atoi(argv[3]) : 65400;
+
+    const size_t numOfDescriptors = 2 * std::max(numOfConnections, 2 * numOfTcpClients) + 64;
+    if (!raiseDescriptorLimit(numOfDescriptors)) {
+        std::cout << "needs " << numOfDescriptors << " file descriptors, raise the limit (ulimit -n)\n";
+        return 1;
+    }
+    const bool isSuccessful = benchmarkServerClose(port, numOfConnections) &&
+                              benchmarkClientClose(port + 1, numOfTcpClients);
+    return isSuccessful ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+///////////////////////////////////////////////////////////
+//////////////////SUBSCRIBER BENCHMARK/////////////////////
+///////////////////////////////////////////////////////////
+
+// Dispatch throughput of TcpServer as receive threads are added, from 1 to
+// maxNumOfIoThreads. Every event loop serves one client pipelining small framed
+// messages, and every message is published to NUM_OF_SUBSCRIBERS observers, so
+// the loops contend on nothing but the subscriber set. Each count is run twice:
+// with a fixed set of observers, and while another thread keeps subscribing and
+// unsubscribing one, which swaps the snapshot every loop has to pick up.
+// Throughput only scales with threads given cpus to run them on.
+//
+// usage: subscriber_benchmark [numOfMessagesPerClient] [maxNumOfIoThreads] [port]
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../include/tcp_server.h"
+
+namespace {
+
+    const size_t NUM_OF_SUBSCRIBERS = 8;
+    const size_t PAYLOAD_SIZE = 16;
+    const size_t WRITE_SIZE = 64 * 1024;
+    const size_t MAX_NUM_OF_CLIENTS = 64;
+
+    using benchmark_clock_t = std::chrono::steady_clock;
+
+    // one per connection, each written only by the loop thread serving it
+    struct alignas(64) connection_counter_t {
+        std::atomic<size_t> numOfCalls;
+    };
+    connection_counter_t numOfCallsByConnection[MAX_NUM_OF_CLIENTS];
+
+    void countCall(connection_handle_t connection) {
+        std::atomic<size_t> & numOfCalls = numOfCallsByConnection[connection % MAX_NUM_OF_CLIENTS].numOfCalls;
+        numOfCalls.store(numOfCalls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    size_t numOfCalls() {
+        size_t total = 0;
+        for (const connection_counter_t & counter : numOfCallsByConnection) {
+            total += counter.numOfCalls.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    int connectTo(int port) {
+        const int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        if (connect(sockfd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+            ::close(sockfd);
+            return -1;
+        }
+        return sockfd;
+    }
+
+    std::string framedMessages(size_t numOfMessages) {
+        const LengthPrefixedFraming framing;
+        const std::string message = framing.header(PAYLOAD_SIZE) + std::string(PAYLOAD_SIZE, 'm');
+        std::string messages;
+        messages.reserve(message.size() * numOfMessages);
+        for (size_t i = 0; i < numOfMessages; i++) {
+            messages += message;
+        }
+        return messages;
+    }
+
+    void sendAll(int sockfd, const std::string & messages) {
+        for (size_t offset = 0; offset < messages.size(); ) {
+            const ssize_t numOfBytesSent = ::send(sockfd, messages.data() + offset,
+                                                  std::min(WRITE_SIZE, messages.size() - offset), MSG_NOSIGNAL);
+            if (numOfBytesSent == -1) {
+                return;
+            }
+            offset += numOfBytesSent;
+        }
+    }
+
+    /*
+     * Returns messages published per second, or 0 on failure
+     */
+    double run(size_t numOfIoThreads, const std::string & messages, size_t numOfMessagesPerClient, bool churn, int port) {
+        for (connection_counter_t & counter : numOfCallsByConnection) {
+            counter.numOfCalls = 0;
+        }
+        TcpServer server;
+        server_options_t options;
+        options.maxNumOfClients = static_cast<int>(numOfIoThreads);
+        options.numOfIoThreads = numOfIoThreads;
+        options.removeDeadClientsAutomatically = false;
+        options.framing = std::make_shared<LengthPrefixedFraming>();
+        if (!server.start(port, options).isSuccessful()) {
+            return 0;
+        }
+        server_observer_t observer;
+        observer.incomingPacketHandler = [](connection_handle_t connection, const std::string &, const char *, size_t) {
+            countCall(connection);
+        };
+        for (size_t i = 0; i < NUM_OF_SUBSCRIBERS; i++) {
+            server.subscribe(observer);
+        }
+
+        // one client per loop, clients are handed to the loops round robin
+        std::vector<int> sockfds;
+        for (size_t i = 0; i < numOfIoThreads; i++) {
+            const int sockfd = connectTo(port);
+            if (sockfd == -1) {
+                break;
+            }
+            sockfds.push_back(sockfd);
+            server.acceptClient(0); // already connected, accept() does not wait
+        }
+
+        std::atomic<bool> isDone(false);
+        std::thread churnThread;
+        if (churn) {
+            churnThread = std::thread([&server, &isDone]() {
+                server_observer_t churningObserver;
+                churningObserver.incomingPacketHandler = [](connection_handle_t, const std::string &, const char *, size_t) {};
+                while (!isDone) {
+                    server.unsubscribe(server.subscribe(churningObserver));
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            });
+        }
+
+        const size_t numOfCallsExpected = sockfds.size() * numOfMessagesPerClient * NUM_OF_SUBSCRIBERS;
+        const benchmark_clock_t::time_point start = benchmark_clock_t::now();
+        std::vector<std::thread> senders;
+        for (int sockfd : sockfds) {
+            senders.emplace_back(sendAll, sockfd, std::cref(messages));
+        }
+        while (numOfCalls() < numOfCallsExpected) {
+            std::this_thread::yield();
+        }
+        const std::chrono::duration<double> elapsed = benchmark_clock_t::now() - start;
+
+        isDone = true;
+        for (std::thread & sender : senders) {
+            sender.join();
+        }
+        if (churnThread.joinable()) {
+            churnThread.join();
+        }
+        for (int sockfd : sockfds) {
+            ::close(sockfd);
+        }
+        server.close();
+        if (sockfds.size() != numOfIoThreads) {
+            return 0;
+        }
+        return sockfds.size() * numOfMessagesPerClient / elapsed.count();
+    }
+}
+
+int main(int argc, char * argv[]) {
+    const size_t numOfMessagesPerClient = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    const size_t maxNumOfIoThreads = (argc > 2) ? std::min(MAX_NUM_OF_CLIENTS, std::strtoul(argv[2], nullptr, 10)) :
+                                                  std::max(1u, std::thread::hardware_concurrency());
+    const int port = (argc > 3) ? std::atoi(argv[3]) : 65200;
+
+    const std::string messages = framedMessages(numOfMessagesPerClient);
+    std::cout << numOfMessagesPerClient << " messages per client, " << NUM_OF_SUBSCRIBERS << " subscribers, " <<
+              std::thread::hardware_concurrency() << " hardware threads\n";
+    double singleThreadMessagesPerSecond = 0;
+    int nextPort = port;
+    for (size_t numOfIoThreads = 1; numOfIoThreads <= maxNumOfIoThreads; numOfIoThreads *= 2) {
+        const double messagesPerSecond = run(numOfIoThreads, messages, numOfMessagesPerClient, false, nextPort++);
+        const double churnMessagesPerSecond = run(numOfIoThreads, messages, numOfMessagesPerClient, true, nextPort++);
+        if (messagesPerSecond == 0 || churnMessagesPerSecond == 0) {
+            std::cout << numOfIoThreads << " receive thread(s): server failed\n";
+            return 1;
+        }
+        if (numOfIoThreads == 1) {
+            singleThreadMessagesPerSecond = messagesPerSecond;
+        }
+        std::cout << numOfIoThreads << " receive thread(s): " << static_cast<size_t>(messagesPerSecond) << " messages/s (" <<
+                  messagesPerSecond / singleThreadMessagesPerSecond << "x), " << static_cast<size_t>(churnMessagesPerSecond) <<
+                  " messages/s while subscribers change\n";
+    }
+    return 0;
+}